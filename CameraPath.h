@@ -0,0 +1,192 @@
+#ifndef _CAMERAPATH_H_
+#define _CAMERAPATH_H_
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include "Profiler.h"
+#include "Culling.h"
+#include "DrawSort.h"
+
+#define CAMERA_PATH_VERSION "CPT1"
+
+/**
+ * A recorded camera & light, one entry per frame, for replaying identical workloads.
+ * The file is the version tag, the level it was recorded in & a frame count, then per frame the
+ * camera's world matrix, the light direction & the frame's delta time: 21 floats, written as is
+ * (the file is only read back on the platform that wrote it).
+ */
+class CameraPath
+{
+public:
+	struct FRAME
+	{
+		GW::MATH::GMATRIXF camera; // world matrix, the view is its inverse
+		GW::MATH::GVECTORF lightDirection;
+		float delta; // seconds, what the frame took when it was recorded
+	};
+
+private:
+	static const unsigned FRAME_BYTES = sizeof(float) * 21;
+
+	std::string level;
+	std::vector<FRAME> frames;
+
+	// Bytes between the read position & the end of the file
+	static unsigned long long RemainingBytes(std::ifstream& file)
+	{
+		std::streampos position = file.tellg();
+		file.seekg(0, std::ios::end);
+		std::streampos end = file.tellg();
+		file.seekg(position);
+		return end > position ? (unsigned long long)(end - position) : 0;
+	}
+
+public:
+	void Begin(const std::string& _level)
+	{
+		level = _level;
+		frames.clear();
+	}
+
+	inline void Add(const FRAME& frame) { frames.push_back(frame); }
+
+	bool Save(const char* path) const
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			std::cerr << "ERROR: CameraPath - Unable to write \"" << path << "\"!\n";
+			return false;
+		}
+		uint32_t levelLength = (uint32_t)level.size(), frameCount = (uint32_t)frames.size();
+		file.write(CAMERA_PATH_VERSION, 4);
+		file.write(reinterpret_cast<const char*>(&levelLength), 4);
+		file.write(level.data(), levelLength);
+		file.write(reinterpret_cast<const char*>(&frameCount), 4);
+		for (const FRAME& frame : frames)
+		{
+			file.write(reinterpret_cast<const char*>(frame.camera.data), sizeof(float) * 16);
+			file.write(reinterpret_cast<const char*>(frame.lightDirection.data), sizeof(float) * 4);
+			file.write(reinterpret_cast<const char*>(&frame.delta), sizeof(float));
+		}
+		return file.good();
+	}
+
+	bool Load(const char* path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		char version[4];
+		if (!file.is_open() || !file.read(version, 4) || std::memcmp(version, CAMERA_PATH_VERSION, 4) != 0)
+		{
+			std::cerr << "ERROR: CameraPath - \"" << path << "\" is missing or not a " << CAMERA_PATH_VERSION << " camera path!\n";
+			return false;
+		}
+		// Both lengths are checked against what is left of the file before anything is sized by them,
+		// so a corrupt header can not ask for gigabytes
+		uint32_t levelLength = 0, frameCount = 0;
+		bool complete = file.read(reinterpret_cast<char*>(&levelLength), 4) && levelLength <= RemainingBytes(file);
+		if (complete)
+		{
+			level.resize(levelLength);
+			file.read(&level[0], levelLength);
+			complete = file.read(reinterpret_cast<char*>(&frameCount), 4)
+				&& (unsigned long long)frameCount * FRAME_BYTES <= RemainingBytes(file);
+		}
+		if (complete)
+		{
+			frames.resize(frameCount);
+			for (FRAME& frame : frames)
+			{
+				file.read(reinterpret_cast<char*>(frame.camera.data), sizeof(float) * 16);
+				file.read(reinterpret_cast<char*>(frame.lightDirection.data), sizeof(float) * 4);
+				file.read(reinterpret_cast<char*>(&frame.delta), sizeof(float));
+			}
+			complete = !file.fail();
+		}
+		if (!complete)
+		{
+			std::cerr << "ERROR: CameraPath - \"" << path << "\" is truncated!\n";
+			frames.clear();
+			return false;
+		}
+		return true;
+	}
+
+	inline const std::string& GetLevel() const { return level; }
+	inline unsigned GetFrameCount() const { return (unsigned)frames.size(); }
+	inline const FRAME& GetFrame(unsigned frame) const { return frames[frame]; }
+};
+
+/**
+ * What a replay measured: every frame's time (not just the profiler's rolling window) for the
+ * percentiles, draw & culling counts averaged per frame, & the profiler's per phase timings (over
+ * its last PROFILER_HISTORY frames).
+ */
+class ReplayStats
+{
+	std::vector<float> frameTimes; // milliseconds
+	double recordedSeconds = 0.0;
+	double instancesDrawn = 0.0, triangles = 0.0, draws = 0.0, binds = 0.0;
+
+public:
+	void AddFrame(float milliseconds, float recordedDelta, const Culling::CULLING_STATS& culling,
+		const DrawSort::DRAW_STATS& drawStats)
+	{
+		frameTimes.push_back(milliseconds);
+		recordedSeconds += recordedDelta;
+		instancesDrawn += culling.phaseOneDrawn + culling.phaseTwoDrawn;
+		triangles += (double)culling.trianglesDrawn;
+		draws += drawStats.draws;
+		binds += drawStats.pipelineBinds + drawStats.descriptorBinds + drawStats.bufferBinds;
+	}
+
+	float Percentile(float percent) const
+	{
+		if (frameTimes.empty())
+			return 0.0f;
+		std::vector<float> sorted = frameTimes;
+		std::sort(sorted.begin(), sorted.end());
+		size_t index = std::min(sorted.size() - 1, (size_t)(percent / 100.0f * sorted.size()));
+		return sorted[index];
+	}
+
+	void Print(std::ostream& out) const
+	{
+		double frames = std::max<size_t>(frameTimes.size(), 1);
+		out << "Replay - frames: " << frameTimes.size() << " | p50: " << Percentile(50) << "ms | p90: " << Percentile(90)
+			<< "ms | p99: " << Percentile(99) << "ms | max: " << Percentile(100) << "ms | recorded avg: "
+			<< recordedSeconds * 1000.0 / frames << "ms\n";
+		out << "  per frame - instances: " << instancesDrawn / frames << " | triangles: " << triangles / frames
+			<< " | draws: " << draws / frames << " | binds: " << binds / frames << "\n";
+	}
+
+	bool Write(const char* path, const Profiler& profiler) const
+	{
+		std::ofstream file(path);
+		if (!file.is_open())
+		{
+			std::cerr << "ERROR: ReplayStats - Unable to write \"" << path << "\"!\n";
+			return false;
+		}
+		double frames = std::max<size_t>(frameTimes.size(), 1);
+		file << "{\n\t\"frames\": " << frameTimes.size() << ",\n\t\"frame_ms\": { \"p50\": " << Percentile(50)
+			<< ", \"p90\": " << Percentile(90) << ", \"p95\": " << Percentile(95) << ", \"p99\": " << Percentile(99)
+			<< ", \"max\": " << Percentile(100) << ", \"recorded_avg\": " << recordedSeconds * 1000.0 / frames << " },\n"
+			<< "\t\"per_frame\": { \"instances\": " << instancesDrawn / frames << ", \"triangles\": " << triangles / frames
+			<< ", \"draws\": " << draws / frames << ", \"binds\": " << binds / frames << " },\n\t\"phases\": [";
+		for (unsigned i = 0; i < profiler.GetTimerCount(); i++)
+		{
+			Profiler::STATS stats = profiler.GetStats(i);
+			file << (i > 0 ? "," : "") << "\n\t\t{ \"name\": \"" << profiler.GetTimerName(i) << "\", \"avg_ms\": " << stats.avg
+				<< ", \"p99_ms\": " << stats.p99 << ", \"max_ms\": " << stats.max << ", \"samples\": " << stats.samples << " }";
+		}
+		file << "\n\t]\n}\n";
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef _CULLING_H_
+#define _CULLING_H_
+#include <vector>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include "GraphicsObjects.h"
+
+namespace Culling
+{
+	struct FRUSTUM
+	{
+		// xyz = plane normal, w = distance. Points inside satisfy dot(n, p) + w >= 0
+		GW::MATH::GVECTORF planes[6];
+	};
+
+	struct CULLING_STATS
+	{
+		unsigned totalInstances = 0;
+		unsigned frustumRejected = 0;
+		unsigned occlusionRejected = 0;
+		unsigned phaseOneDrawn = 0;
+		unsigned phaseTwoDrawn = 0;
+		unsigned long long trianglesDrawn = 0;
+	};
+
+	// Local space bounds of a vertex list
+	inline graphics::AABB ComputeBounds(const std::vector<graphics::VERTEX>& vertices)
+	{
+		if (vertices.empty())
+			return { { 0, 0, 0 }, { 0, 0, 0 } };
+
+		graphics::AABB bounds = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+		for (const graphics::VERTEX& vertex : vertices)
+		{
+			bounds.min.x = std::min(bounds.min.x, vertex.pos.x);
+			bounds.min.y = std::min(bounds.min.y, vertex.pos.y);
+			bounds.min.z = std::min(bounds.min.z, vertex.pos.z);
+			bounds.max.x = std::max(bounds.max.x, vertex.pos.x);
+			bounds.max.y = std::max(bounds.max.y, vertex.pos.y);
+			bounds.max.z = std::max(bounds.max.z, vertex.pos.z);
+		}
+		return bounds;
+	}
+
+	// Row vector transform, matches mul(float4(p, 1), M) in the shaders
+	inline GW::MATH::GVECTORF TransformPoint(const GW::MATH::GMATRIXF& m, float x, float y, float z)
+	{
+		GW::MATH::GVECTORF out;
+		out.x = x * m.data[0] + y * m.data[4] + z * m.data[8] + m.data[12];
+		out.y = x * m.data[1] + y * m.data[5] + z * m.data[9] + m.data[13];
+		out.z = x * m.data[2] + y * m.data[6] + z * m.data[10] + m.data[14];
+		out.w = x * m.data[3] + y * m.data[7] + z * m.data[11] + m.data[15];
+		return out;
+	}
+
+	// World space bounds of a transformed box (Arvo's method, no corner transforms needed)
+	inline graphics::AABB TransformBounds(const graphics::AABB& local, const GW::MATH::GMATRIXF& world)
+	{
+		const float localMin[3] = { local.min.x, local.min.y, local.min.z };
+		const float localMax[3] = { local.max.x, local.max.y, local.max.z };
+		float outMin[3] = { world.data[12], world.data[13], world.data[14] };
+		float outMax[3] = { world.data[12], world.data[13], world.data[14] };
+
+		for (int row = 0; row < 3; row++)
+		{
+			for (int col = 0; col < 3; col++)
+			{
+				float a = world.data[row * 4 + col] * localMin[row];
+				float b = world.data[row * 4 + col] * localMax[row];
+				outMin[col] += std::min(a, b);
+				outMax[col] += std::max(a, b);
+			}
+		}
+
+		return { { outMin[0], outMin[1], outMin[2] }, { outMax[0], outMax[1], outMax[2] } };
+	}
+
+	// Gribb/Hartmann plane extraction for row vector matrices with a [0, 1] depth range
+	inline void ExtractFrustum(const GW::MATH::GMATRIXF& viewProjection, FRUSTUM& frustum)
+	{
+		const float* m = viewProjection.data;
+		for (int i = 0; i < 3; i++)
+		{
+			// Column i, column 3
+			float ci[4] = { m[i], m[4 + i], m[8 + i], m[12 + i] };
+			float c3[4] = { m[3], m[7], m[11], m[15] };
+
+			if (i < 2)
+			{
+				frustum.planes[i * 2 + 0] = { c3[0] + ci[0], c3[1] + ci[1], c3[2] + ci[2], c3[3] + ci[3] };
+				frustum.planes[i * 2 + 1] = { c3[0] - ci[0], c3[1] - ci[1], c3[2] - ci[2], c3[3] - ci[3] };
+			}
+			else
+			{
+				// Near plane is z >= 0, far plane is z <= w
+				frustum.planes[4] = { ci[0], ci[1], ci[2], ci[3] };
+				frustum.planes[5] = { c3[0] - ci[0], c3[1] - ci[1], c3[2] - ci[2], c3[3] - ci[3] };
+			}
+		}
+	}
+
+	inline bool IsAABBInFrustum(const FRUSTUM& frustum, const graphics::AABB& bounds)
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			const GW::MATH::GVECTORF& plane = frustum.planes[i];
+
+			// Test the corner furthest along the plane normal
+			float x = plane.x >= 0 ? bounds.max.x : bounds.min.x;
+			float y = plane.y >= 0 ? bounds.max.y : bounds.min.y;
+			float z = plane.z >= 0 ? bounds.max.z : bounds.min.z;
+			if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0)
+				return false;
+		}
+		return true;
+	}
+
+	// Fraction of the screen covered by a box's projected rectangle, a whole screen when it crosses the near plane
+	inline float ProjectedArea(const graphics::AABB& bounds, const GW::MATH::GMATRIXF& viewProjection)
+	{
+		float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+		for (int corner = 0; corner < 8; corner++)
+		{
+			GW::MATH::GVECTORF clip = TransformPoint(viewProjection,
+				(corner & 1) ? bounds.max.x : bounds.min.x,
+				(corner & 2) ? bounds.max.y : bounds.min.y,
+				(corner & 4) ? bounds.max.z : bounds.min.z);
+			if (clip.w <= 0.0f || clip.z < 0.0f)
+				return 1.0f;
+
+			float invW = 1.0f / clip.w;
+			minX = std::min(minX, clip.x * invW);
+			maxX = std::max(maxX, clip.x * invW);
+			minY = std::min(minY, clip.y * invW);
+			maxY = std::max(maxY, clip.y * invW);
+		}
+
+		float width = std::max(std::min(maxX, 1.0f) - std::max(minX, -1.0f), 0.0f);
+		float height = std::max(std::min(maxY, 1.0f) - std::max(minY, -1.0f), 0.0f);
+		return width * height * 0.25f;
+	}
+
+	// Hierarchical depth buffer. Every texel stores the farthest depth of the 2x2 block below it,
+	// so a box whose nearest depth is behind every covered texel can not be visible.
+	class DepthPyramid
+	{
+		struct LEVEL
+		{
+			unsigned width;
+			unsigned height;
+			unsigned offset;
+		};
+
+		std::vector<LEVEL> levels;
+		std::vector<float> depths;
+
+	public:
+		// Lays out every level down to 1x1, tightly packed one after the other
+		void Resize(unsigned baseWidth, unsigned baseHeight)
+		{
+			levels.clear();
+			unsigned width = std::max(baseWidth, 1u);
+			unsigned height = std::max(baseHeight, 1u);
+			unsigned offset = 0;
+			while (true)
+			{
+				levels.push_back({ width, height, offset });
+				offset += width * height;
+				if (width == 1 && height == 1)
+					break;
+				width = std::max((width + 1) / 2, 1u);
+				height = std::max((height + 1) / 2, 1u);
+			}
+			depths.assign(offset, 1.0f);
+		}
+
+		// Builds the pyramid from a full resolution depth buffer, level zero is half its size
+		void Build(const float* depthBuffer, unsigned width, unsigned height)
+		{
+			if (levels.empty() || levels[0].width != std::max((width + 1) / 2, 1u)
+				|| levels[0].height != std::max((height + 1) / 2, 1u))
+				Resize((width + 1) / 2, (height + 1) / 2);
+
+			Downsample(depthBuffer, width, height, levels[0]);
+			for (unsigned i = 1; i < levels.size(); i++)
+				Downsample(&depths[levels[i - 1].offset], levels[i - 1].width, levels[i - 1].height, levels[i]);
+		}
+
+		// offScreenVisible: for a pyramid rendered from an older view than the frustum test used, where
+		// what lies outside that view (even partly) has no depth to be tested against
+		bool IsOccluded(const graphics::AABB& bounds, const GW::MATH::GMATRIXF& viewProjection,
+			bool offScreenVisible = false) const
+		{
+			if (levels.empty())
+				return false;
+
+			float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+			float maxX = -FLT_MAX, maxY = -FLT_MAX;
+			for (int corner = 0; corner < 8; corner++)
+			{
+				GW::MATH::GVECTORF clip = TransformPoint(viewProjection,
+					(corner & 1) ? bounds.max.x : bounds.min.x,
+					(corner & 2) ? bounds.max.y : bounds.min.y,
+					(corner & 4) ? bounds.max.z : bounds.min.z);
+
+				// Anything crossing the near plane is treated as visible
+				if (clip.w <= 0.0f || clip.z < 0.0f)
+					return false;
+
+				float invW = 1.0f / clip.w;
+				minX = std::min(minX, clip.x * invW);
+				maxX = std::max(maxX, clip.x * invW);
+				minY = std::min(minY, clip.y * invW);
+				maxY = std::max(maxY, clip.y * invW);
+				minZ = std::min(minZ, clip.z * invW);
+			}
+
+			if (offScreenVisible && (minX < -1.0f || maxX > 1.0f || minY < -1.0f || maxY > 1.0f))
+				return false;
+
+			// NDC to level zero texels, y is flipped to match shaderc's invert_y
+			const LEVEL& base = levels[0];
+			float u0 = std::max((minX * 0.5f + 0.5f) * base.width, 0.0f);
+			float u1 = std::min((maxX * 0.5f + 0.5f) * base.width, (float)base.width);
+			float v0 = std::max((0.5f - maxY * 0.5f) * base.height, 0.0f);
+			float v1 = std::min((0.5f - minY * 0.5f) * base.height, (float)base.height);
+			if (u0 >= u1 || v0 >= v1)
+				return true; // entirely off screen
+
+			// Pick the level where the rectangle covers at most 2x2 texels
+			float extent = std::max(u1 - u0, v1 - v0);
+			unsigned level = extent > 1.0f ? (unsigned)std::ceil(std::log2(extent)) : 0;
+			level = std::min(level, (unsigned)levels.size() - 1);
+			float scale = 1.0f / (float)(1u << level);
+
+			const LEVEL& sampled = levels[level];
+			int x0 = std::max((int)(u0 * scale), 0);
+			int y0 = std::max((int)(v0 * scale), 0);
+			int x1 = std::min((int)std::ceil(u1 * scale) - 1, (int)sampled.width - 1);
+			int y1 = std::min((int)std::ceil(v1 * scale) - 1, (int)sampled.height - 1);
+
+			float farthest = 0.0f;
+			for (int y = y0; y <= y1; y++)
+				for (int x = x0; x <= x1; x++)
+					farthest = std::max(farthest, depths[sampled.offset + y * sampled.width + x]);
+
+			return minZ > farthest;
+		}
+
+		inline unsigned GetLevelCount() const { return (unsigned)levels.size(); }
+		inline unsigned GetLevelWidth(unsigned level) const { return levels[level].width; }
+		inline unsigned GetLevelHeight(unsigned level) const { return levels[level].height; }
+		inline unsigned GetLevelOffset(unsigned level) const { return levels[level].offset; }
+		inline unsigned GetTexelCount() const { return (unsigned)depths.size(); }
+		inline float* GetData() { return depths.data(); }
+
+	private:
+		void Downsample(const float* src, unsigned srcWidth, unsigned srcHeight, const LEVEL& dst)
+		{
+			for (unsigned y = 0; y < dst.height; y++)
+			{
+				unsigned sy0 = std::min(y * 2, srcHeight - 1);
+				unsigned sy1 = std::min(y * 2 + 1, srcHeight - 1);
+				for (unsigned x = 0; x < dst.width; x++)
+				{
+					unsigned sx0 = std::min(x * 2, srcWidth - 1);
+					unsigned sx1 = std::min(x * 2 + 1, srcWidth - 1);
+					float farthest = std::max(
+						std::max(src[sy0 * srcWidth + sx0], src[sy0 * srcWidth + sx1]),
+						std::max(src[sy1 * srcWidth + sx0], src[sy1 * srcWidth + sx1]));
+					depths[dst.offset + y * dst.width + x] = farthest;
+				}
+			}
+		}
+	};
+}
+
+#endif
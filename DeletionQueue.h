@@ -0,0 +1,52 @@
+#ifndef _DELETIONQUEUE_H_
+#define _DELETIONQUEUE_H_
+#include <vector>
+#include <functional>
+
+/**
+ * Deferred destruction for GPU objects frames in flight may still use.
+ * Each destroy is queued with the first frame at which nothing recorded earlier can be running
+ * (the frame it was retired on plus the frames in flight, see FrameRing) & runs from Flush once that
+ * frame starts. Nothing here waits on the device; only shutdown, after an idle, uses FlushAll.
+ */
+class DeletionQueue
+{
+	struct PENDING
+	{
+		unsigned long long frame; // safe to destroy once this frame starts
+		std::function<void()> destroy;
+	};
+	std::vector<PENDING> pending;
+
+public:
+	inline void Push(unsigned long long frame, std::function<void()> destroy)
+	{
+		pending.push_back({ frame, std::move(destroy) });
+	}
+
+	// Runs every destroy due by frame, in the order they were queued
+	void Flush(unsigned long long frame)
+	{
+		unsigned kept = 0;
+		for (unsigned i = 0; i < pending.size(); i++)
+		{
+			if (pending[i].frame <= frame)
+				pending[i].destroy();
+			else
+				pending[kept++] = std::move(pending[i]);
+		}
+		pending.resize(kept);
+	}
+
+	// Only once the device is idle
+	void FlushAll()
+	{
+		for (PENDING& item : pending)
+			item.destroy();
+		pending.clear();
+	}
+
+	inline unsigned GetPendingCount() const { return (unsigned)pending.size(); }
+};
+
+#endif
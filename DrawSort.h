@@ -0,0 +1,117 @@
+#ifndef _DRAWSORT_H_
+#define _DRAWSORT_H_
+#include <vector>
+#include <algorithm>
+
+// Sort key layout, most significant first: pipeline | texture set | depth | model | lod
+#define DRAW_KEY_PIPELINE_BITS 4
+#define DRAW_KEY_TEXTURE_SET_BITS 20
+#define DRAW_KEY_DEPTH_BITS 16
+#define DRAW_KEY_MODEL_BITS 20
+#define DRAW_KEY_LOD_BITS 4
+
+/**
+ * State sorted draw lists.
+ * Every draw gets a 64 bit key so one sort groups draws by pipeline, then by texture set, then
+ * front to back. Consecutive draws that end up sharing everything but their index range are
+ * merged into a single draw.
+ */
+namespace DrawSort
+{
+	// Per mesh state, resolved once per level
+	struct DRAW_STATE
+	{
+		unsigned materialSlot; // index into SHADER_MODEL_DATA::materials
+		unsigned diffuseSet;
+		unsigned specularSet;
+		unsigned normalSet;
+		unsigned textureSet; // unique id for the diffuse/specular/normal combination
+		unsigned variant; // pipeline variant, the sort key's pipeline field
+	};
+
+	struct DRAW
+	{
+		unsigned long long key;
+		unsigned model;
+		unsigned mesh;
+		unsigned indexCount;
+		unsigned indexOffset;
+		unsigned matrixOffset;
+		unsigned instanceCount;
+		unsigned materialSlot;
+	};
+
+	struct DRAW_STATS
+	{
+		unsigned submitted = 0; // draws before merging
+		unsigned draws = 0;
+		unsigned pipelineBinds = 0;
+		unsigned descriptorBinds = 0;
+		unsigned bufferBinds = 0;
+		unsigned bindsSaved = 0; // against binding every mesh's state in model order
+	};
+
+	inline unsigned long long MakeKey(unsigned pipeline, unsigned textureSet, unsigned depth, unsigned model, unsigned lod)
+	{
+		auto field = [](unsigned value, unsigned bits) { return (unsigned long long)(value & ((1u << bits) - 1)); };
+
+		unsigned long long key = field(pipeline, DRAW_KEY_PIPELINE_BITS);
+		key = (key << DRAW_KEY_TEXTURE_SET_BITS) | field(textureSet, DRAW_KEY_TEXTURE_SET_BITS);
+		key = (key << DRAW_KEY_DEPTH_BITS) | field(depth, DRAW_KEY_DEPTH_BITS);
+		key = (key << DRAW_KEY_MODEL_BITS) | field(model, DRAW_KEY_MODEL_BITS);
+		key = (key << DRAW_KEY_LOD_BITS) | field(lod, DRAW_KEY_LOD_BITS);
+		return key;
+	}
+
+	// View space depth to a coarse front to back bucket
+	inline unsigned QuantizeDepth(float viewDepth, float farPlane)
+	{
+		float normalized = std::min(std::max(viewDepth / farPlane, 0.0f), 1.0f);
+		return (unsigned)(normalized * ((1u << DRAW_KEY_DEPTH_BITS) - 1));
+	}
+
+	class DrawList
+	{
+		std::vector<DRAW> draws;
+
+	public:
+		inline void Clear() { draws.clear(); }
+		inline void Add(const DRAW& draw) { draws.push_back(draw); }
+		inline const std::vector<DRAW>& GetDraws() const { return draws; }
+
+		// Stable, so meshes of one model stay in order and stay mergeable
+		void Sort()
+		{
+			std::stable_sort(draws.begin(), draws.end(),
+				[](const DRAW& a, const DRAW& b) { return a.key < b.key; });
+		}
+
+		// Joins neighbouring draws of the same instances & material whose index ranges touch
+		void Merge()
+		{
+			if (draws.empty())
+				return;
+
+			unsigned last = 0;
+			for (unsigned i = 1; i < draws.size(); i++)
+			{
+				DRAW& previous = draws[last];
+				const DRAW& current = draws[i];
+				if (current.key == previous.key
+					&& current.model == previous.model
+					&& current.materialSlot == previous.materialSlot
+					&& current.matrixOffset == previous.matrixOffset
+					&& current.instanceCount == previous.instanceCount
+					&& current.indexOffset == previous.indexOffset + previous.indexCount)
+				{
+					previous.indexCount += current.indexCount;
+					continue;
+				}
+				draws[++last] = current;
+			}
+			draws.resize(last + 1);
+		}
+	};
+}
+
+#endif
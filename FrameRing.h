@@ -0,0 +1,77 @@
+#ifndef _FRAMERING_H_
+#define _FRAMERING_H_
+#include <vector>
+#include <iostream>
+
+/**
+ * Frames-in-flight ring, independent of the swapchain image count.
+ * Per-frame resources (matrix buffers, their descriptor sets) are indexed by the ring slot Begin
+ * returns. Each slot has a fence signalled by an empty submit after the frame's own work, so
+ * waiting on it means every command submitted up to that frame has finished. The CPU can then be
+ * at most count frames ahead of the GPU, & anything retired count frames ago is safe to free.
+ */
+class FrameRing
+{
+	VkDevice device = nullptr;
+	std::vector<VkFence> fences;
+	std::vector<bool> submitted; // fence has a pending or finished signal to wait on
+	unsigned current = 0;
+	unsigned long long frame = 0;
+
+public:
+	bool Create(VkDevice _device, unsigned count)
+	{
+		device = _device;
+		fences.assign(count, nullptr);
+		submitted.assign(count, false);
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		for (VkFence& fence : fences)
+		{
+			if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VkResult::VK_SUCCESS)
+			{
+				std::cerr << "ERROR: FrameRing - Unable to create frame fences!\n";
+				Destroy();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Waits until the slot's previous frame is done on the GPU, returns the slot to record into
+	unsigned Begin()
+	{
+		current = (unsigned)(frame % fences.size());
+		if (submitted[current])
+		{
+			vkWaitForFences(device, 1, &fences[current], VK_TRUE, UINT64_MAX);
+			vkResetFences(device, 1, &fences[current]);
+			submitted[current] = false;
+		}
+		return current;
+	}
+
+	// Call once the frame's command buffer has been submitted to queue
+	void End(VkQueue queue)
+	{
+		if (vkQueueSubmit(queue, 0, nullptr, fences[current]) == VkResult::VK_SUCCESS)
+			submitted[current] = true;
+		else
+			std::cerr << "ERROR: FrameRing - Unable to submit the frame fence!\n";
+		frame++;
+	}
+
+	void Destroy()
+	{
+		for (VkFence fence : fences)
+			if (fence != nullptr)
+				vkDestroyFence(device, fence, nullptr);
+		fences.clear();
+		submitted.clear();
+	}
+
+	inline unsigned GetCount() const { return (unsigned)fences.size(); }
+	inline unsigned GetIndex() const { return current; }
+};
+
+#endif
@@ -46,6 +46,12 @@ namespace graphics {
 		unsigned materialIndex;
 	};
 #pragma pack(pop)
+	struct AABB
+	{
+		VECTOR min;
+		VECTOR max;
+	};
+
 	struct MATERIAL_INFO
 	{
 		unsigned materialCount = 0;
@@ -68,6 +74,9 @@ namespace graphics {
 		std::vector<graphics::BATCH> batches;
 		std::vector<graphics::MESH> meshes;
 		std::vector<GW::MATH::GMATRIXF> worldMatrices;
+		AABB bounds; // local space
+		std::vector<AABB> instanceBounds; // world space, one per world matrix
+		std::vector<std::vector<BATCH>> lods; // [lod][mesh], LOD 0 is each mesh's drawInfo
 		MATERIAL_INFO materialInfo;
 		std::string modelName;
 		void clear()
@@ -79,6 +88,9 @@ namespace graphics {
 			materials.clear();
 			batches.clear();
 			meshes.clear();
+			worldMatrices.clear();
+			instanceBounds.clear();
+			lods.clear();
 
 			diffuseTextures.clear();
 			specularTextures.clear();
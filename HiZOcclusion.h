@@ -0,0 +1,556 @@
+#ifndef _HIZOCCLUSION_H_
+#define _HIZOCCLUSION_H_
+#include <vector>
+#include <cstring>
+#include "Culling.h"
+#include "VulkanHelpers.h"
+
+// Phase one depth target, low resolution is plenty for culling
+#define HIZ_DEPTH_WIDTH 256
+#define HIZ_DEPTH_HEIGHT 128
+#define HIZ_DEPTH_FORMAT VK_FORMAT_D32_SFLOAT
+#define HIZ_PYRAMID_FORMAT VK_FORMAT_R32_SFLOAT
+#define HIZ_GROUP_SIZE 8
+
+/**
+ * Two-phase hierarchical-Z occlusion.
+ * Each frame's visible instances are rendered depth-only into a small target, a compute shader
+ * reduces it into a max-depth pyramid which is copied into the frame's ring slot readback buffer.
+ * Nothing waits on that submit: the copy is read when the slot comes around again (after its
+ * FrameRing fence), & instances are tested against that pyramid with the view it was built from.
+ */
+class HiZOcclusion
+{
+	struct LEVEL_PUSH_CONSTANTS
+	{
+		unsigned srcWidth, srcHeight;
+		unsigned dstWidth, dstHeight;
+	};
+
+	// Recorded & read back per frames-in-flight ring slot
+	struct FRAME_SLOT
+	{
+		VkCommandBuffer commandBuffer = nullptr;
+		VkBuffer readbackBuffer = nullptr;
+		VkDeviceMemory readbackMemory = nullptr;
+		void* readbackMapped = nullptr;
+		GW::MATH::GMATRIXF viewProjection;
+		bool pending = false; // submitted, not read back yet
+	};
+
+	VkDevice device = nullptr;
+	VkQueue queue = nullptr;
+	VkCommandPool commandPool = nullptr;
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+
+	// Phase one depth target
+	VkImage depthImage = nullptr;
+	VkDeviceMemory depthMemory = nullptr;
+	VkImageView depthView = nullptr;
+	VkRenderPass renderPass = nullptr;
+	VkFramebuffer framebuffer = nullptr;
+	VkPipeline depthPipeline = nullptr;
+
+	// Depth pyramid (one view per mip so each level can be read & written separately)
+	VkImage pyramidImage = nullptr;
+	VkDeviceMemory pyramidMemory = nullptr;
+	std::vector<VkImageView> pyramidViews;
+	VkDescriptorSetLayout pyramidSetLayout = nullptr;
+	VkPipelineLayout pyramidPipelineLayout = nullptr;
+	VkPipeline pyramidPipeline = nullptr;
+	VkDescriptorPool descriptorPool = nullptr;
+	std::vector<VkDescriptorSet> pyramidSets;
+
+	// CPU copy of the newest finished pyramid & the view it was rendered with
+	std::vector<FRAME_SLOT> slots;
+	unsigned slot = 0;
+	Culling::DepthPyramid pyramid;
+	GW::MATH::GMATRIXF pyramidViewProjection;
+	bool pyramidReady = false;
+
+	bool valid = false;
+
+public:
+	// commandPool must allow resetting individual command buffers, every slot's is re-recorded
+	bool Create(VkDevice _device, VkPhysicalDevice _physicalDevice, VkQueue _queue, VkCommandPool _commandPool,
+		VkPipelineLayout drawPipelineLayout, VkShaderModule depthVertexShader, VkShaderModule pyramidComputeShader,
+		unsigned framesInFlight, VkPipelineCache _pipelineCache = VK_NULL_HANDLE)
+	{
+		device = _device;
+		queue = _queue;
+		commandPool = _commandPool;
+		pipelineCache = _pipelineCache;
+		slots.resize(framesInFlight);
+
+		// Pyramid level zero is half the depth target, every texel covers a 2x2 depth block
+		pyramid.Resize(HIZ_DEPTH_WIDTH / 2, HIZ_DEPTH_HEIGHT / 2);
+
+		if (!CreateDepthTarget(_physicalDevice))
+		{
+			std::cerr << "ERROR: HiZOcclusion - Unable to create depth target!\n";
+			return false;
+		}
+		if (!CreateDepthPipeline(drawPipelineLayout, depthVertexShader))
+		{
+			std::cerr << "ERROR: HiZOcclusion - Unable to create depth pipeline!\n";
+			return false;
+		}
+		if (!CreatePyramid(_physicalDevice, pyramidComputeShader))
+		{
+			std::cerr << "ERROR: HiZOcclusion - Unable to create depth pyramid!\n";
+			return false;
+		}
+
+		if (!CreateFrameSlots(_physicalDevice))
+		{
+			std::cerr << "ERROR: HiZOcclusion - Unable to create readback buffers!\n";
+			return false;
+		}
+
+		valid = true;
+		return true;
+	}
+
+	// Call once the ring slot's fence has been waited on: picks up the pyramid the slot last built
+	void BeginFrame(unsigned _slot)
+	{
+		slot = _slot;
+		FRAME_SLOT& frame = slots[slot];
+		if (!frame.pending)
+			return;
+		memcpy(pyramid.GetData(), frame.readbackMapped, sizeof(float) * pyramid.GetTexelCount());
+		pyramidViewProjection = frame.viewProjection;
+		pyramidReady = true;
+		frame.pending = false;
+	}
+
+	// Drops the current pyramid & any in flight, e.g. when the level or culling mode changes
+	void Invalidate()
+	{
+		pyramidReady = false;
+		for (FRAME_SLOT& frame : slots)
+			frame.pending = false;
+	}
+
+	// Starts the depth pass in this slot's command buffer, the caller binds set 0 and records the occluder draws
+	VkCommandBuffer BeginOcclusionPass(const GW::MATH::GMATRIXF& viewProjection)
+	{
+		FRAME_SLOT& frame = slots[slot];
+		frame.viewProjection = viewProjection;
+		VkCommandBuffer commandBuffer = frame.commandBuffer;
+
+		// The slot's last submit is done (its fence has passed), beginning implicitly resets it
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VkResult::VK_SUCCESS)
+			return nullptr;
+
+		VkClearValue clearDepth;
+		clearDepth.depthStencil = { 1.0f, 0u };
+		VkRenderPassBeginInfo passInfo = {};
+		passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		passInfo.renderPass = renderPass;
+		passInfo.framebuffer = framebuffer;
+		passInfo.renderArea = { { 0, 0 }, { HIZ_DEPTH_WIDTH, HIZ_DEPTH_HEIGHT } };
+		passInfo.clearValueCount = 1;
+		passInfo.pClearValues = &clearDepth;
+		vkCmdBeginRenderPass(commandBuffer, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPipeline);
+
+		return commandBuffer;
+	}
+
+	// Ends the depth pass, builds the pyramid & submits the copy back, read by BeginFrame a ring later
+	bool EndOcclusionPass(VkCommandBuffer commandBuffer)
+	{
+		FRAME_SLOT& frame = slots[slot];
+		vkCmdEndRenderPass(commandBuffer);
+
+		// Every level is rewritten so the previous contents can be discarded, once the last frame's
+		// build & copy (which may still be running) are done reading them
+		unsigned levelCount = pyramid.GetLevelCount();
+		VkUtils::ImageBarrier(commandBuffer, pyramidImage, VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_WRITE_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pyramidPipeline);
+		for (unsigned level = 0; level < levelCount; level++)
+		{
+			LEVEL_PUSH_CONSTANTS sizes;
+			sizes.srcWidth = level == 0 ? HIZ_DEPTH_WIDTH : pyramid.GetLevelWidth(level - 1);
+			sizes.srcHeight = level == 0 ? HIZ_DEPTH_HEIGHT : pyramid.GetLevelHeight(level - 1);
+			sizes.dstWidth = pyramid.GetLevelWidth(level);
+			sizes.dstHeight = pyramid.GetLevelHeight(level);
+
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pyramidPipelineLayout,
+				0, 1, &pyramidSets[level], 0, nullptr);
+			vkCmdPushConstants(commandBuffer, pyramidPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+				0, sizeof(LEVEL_PUSH_CONSTANTS), &sizes);
+			vkCmdDispatch(commandBuffer, (sizes.dstWidth + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE,
+				(sizes.dstHeight + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+
+			// Next level (and the readback) reads what was just written
+			VkUtils::ImageBarrier(commandBuffer, pyramidImage, VK_IMAGE_ASPECT_COLOR_BIT, level, 1,
+				VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+				VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT);
+		}
+
+		// Copy every level into the readback buffer using the same packing as the CPU pyramid
+		std::vector<VkBufferImageCopy> regions(levelCount);
+		for (unsigned level = 0; level < levelCount; level++)
+		{
+			regions[level] = {};
+			regions[level].bufferOffset = (VkDeviceSize)pyramid.GetLevelOffset(level) * sizeof(float);
+			regions[level].imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+			regions[level].imageExtent = { pyramid.GetLevelWidth(level), pyramid.GetLevelHeight(level), 1 };
+		}
+		vkCmdCopyImageToBuffer(commandBuffer, pyramidImage, VK_IMAGE_LAYOUT_GENERAL, frame.readbackBuffer,
+			levelCount, regions.data());
+
+		VkBufferMemoryBarrier hostBarrier = {};
+		hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		hostBarrier.buffer = frame.readbackBuffer;
+		hostBarrier.offset = 0;
+		hostBarrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+			0, 0, nullptr, 1, &hostBarrier, 0, nullptr);
+
+		vkEndCommandBuffer(commandBuffer);
+
+		// Submitted ahead of the surface's frame, so the slot's FrameRing fence also covers it
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		frame.pending = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) == VkResult::VK_SUCCESS;
+		return frame.pending;
+	}
+
+	inline const Culling::DepthPyramid& GetPyramid() const { return pyramid; }
+	inline const GW::MATH::GMATRIXF& GetPyramidViewProjection() const { return pyramidViewProjection; }
+	inline bool HasPyramid() const { return pyramidReady; }
+	inline bool IsValid() const { return valid; }
+
+	// Only once the device is idle
+	void Destroy()
+	{
+		if (device == nullptr)
+			return;
+
+		for (FRAME_SLOT& frame : slots)
+		{
+			if (frame.commandBuffer != nullptr)
+				vkFreeCommandBuffers(device, commandPool, 1, &frame.commandBuffer);
+			if (frame.readbackMapped != nullptr)
+				vkUnmapMemory(device, frame.readbackMemory);
+			vkDestroyBuffer(device, frame.readbackBuffer, nullptr);
+			vkFreeMemory(device, frame.readbackMemory, nullptr);
+		}
+
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		vkDestroyPipeline(device, pyramidPipeline, nullptr);
+		vkDestroyPipelineLayout(device, pyramidPipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, pyramidSetLayout, nullptr);
+		for (VkImageView& view : pyramidViews)
+			vkDestroyImageView(device, view, nullptr);
+		vkDestroyImage(device, pyramidImage, nullptr);
+		vkFreeMemory(device, pyramidMemory, nullptr);
+
+		vkDestroyPipeline(device, depthPipeline, nullptr);
+		vkDestroyFramebuffer(device, framebuffer, nullptr);
+		vkDestroyRenderPass(device, renderPass, nullptr);
+		vkDestroyImageView(device, depthView, nullptr);
+		vkDestroyImage(device, depthImage, nullptr);
+		vkFreeMemory(device, depthMemory, nullptr);
+
+		*this = HiZOcclusion();
+	}
+
+private:
+	bool CreateDepthTarget(VkPhysicalDevice physicalDevice)
+	{
+		if (VkUtils::CreateImage(device, physicalDevice, HIZ_DEPTH_WIDTH, HIZ_DEPTH_HEIGHT, 1, HIZ_DEPTH_FORMAT,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			&depthImage, &depthMemory) != VkResult::VK_SUCCESS)
+			return false;
+		if (VkUtils::CreateImageView(device, depthImage, HIZ_DEPTH_FORMAT, VK_IMAGE_ASPECT_DEPTH_BIT,
+			0, 1, &depthView) != VkResult::VK_SUCCESS)
+			return false;
+
+		// Depth only pass, the result is left ready for the pyramid compute shader
+		VkAttachmentDescription depthAttachment = {};
+		depthAttachment.format = HIZ_DEPTH_FORMAT;
+		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		depthAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		VkAttachmentReference depthReference = { 0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+		VkSubpassDescription subpass = {};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = 0;
+		subpass.pDepthStencilAttachment = &depthReference;
+
+		VkSubpassDependency dependencies[2] = {};
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[1].srcSubpass = 0;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		VkRenderPassCreateInfo passInfo = {};
+		passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		passInfo.attachmentCount = 1;
+		passInfo.pAttachments = &depthAttachment;
+		passInfo.subpassCount = 1;
+		passInfo.pSubpasses = &subpass;
+		passInfo.dependencyCount = 2;
+		passInfo.pDependencies = dependencies;
+		if (vkCreateRenderPass(device, &passInfo, nullptr, &renderPass) != VkResult::VK_SUCCESS)
+			return false;
+
+		VkFramebufferCreateInfo framebufferInfo = {};
+		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferInfo.renderPass = renderPass;
+		framebufferInfo.attachmentCount = 1;
+		framebufferInfo.pAttachments = &depthView;
+		framebufferInfo.width = HIZ_DEPTH_WIDTH;
+		framebufferInfo.height = HIZ_DEPTH_HEIGHT;
+		framebufferInfo.layers = 1;
+		return vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffer) == VkResult::VK_SUCCESS;
+	}
+
+	bool CreateDepthPipeline(VkPipelineLayout drawPipelineLayout, VkShaderModule depthVertexShader)
+	{
+		// Vertex stage only, no fragment shader is needed to write depth
+		VkPipelineShaderStageCreateInfo stage_create_info = {};
+		stage_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		stage_create_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+		stage_create_info.module = depthVertexShader;
+		stage_create_info.pName = "main";
+
+		VkPipelineInputAssemblyStateCreateInfo assembly_create_info = {};
+		assembly_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		assembly_create_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		assembly_create_info.primitiveRestartEnable = false;
+
+		// Only the position of the interleaved vertex is read
+		VkVertexInputBindingDescription vertex_binding_description = {};
+		vertex_binding_description.binding = 0;
+		vertex_binding_description.stride = sizeof(graphics::VERTEX);
+		vertex_binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		VkVertexInputAttributeDescription vertex_attribute_description = { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 };
+		VkPipelineVertexInputStateCreateInfo input_vertex_info = {};
+		input_vertex_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		input_vertex_info.vertexBindingDescriptionCount = 1;
+		input_vertex_info.pVertexBindingDescriptions = &vertex_binding_description;
+		input_vertex_info.vertexAttributeDescriptionCount = 1;
+		input_vertex_info.pVertexAttributeDescriptions = &vertex_attribute_description;
+
+		VkViewport viewport = { 0, 0, (float)HIZ_DEPTH_WIDTH, (float)HIZ_DEPTH_HEIGHT, 0, 1 };
+		VkRect2D scissor = { { 0, 0 }, { HIZ_DEPTH_WIDTH, HIZ_DEPTH_HEIGHT } };
+		VkPipelineViewportStateCreateInfo viewport_create_info = {};
+		viewport_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewport_create_info.viewportCount = 1;
+		viewport_create_info.pViewports = &viewport;
+		viewport_create_info.scissorCount = 1;
+		viewport_create_info.pScissors = &scissor;
+
+		// Same culling & winding as the main pipeline
+		VkPipelineRasterizationStateCreateInfo rasterization_create_info = {};
+		rasterization_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterization_create_info.polygonMode = VK_POLYGON_MODE_FILL;
+		rasterization_create_info.lineWidth = 1.0f;
+		rasterization_create_info.cullMode = VK_CULL_MODE_BACK_BIT;
+		rasterization_create_info.frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+		VkPipelineMultisampleStateCreateInfo multisample_create_info = {};
+		multisample_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisample_create_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+		multisample_create_info.minSampleShading = 1.0f;
+
+		VkPipelineDepthStencilStateCreateInfo depth_stencil_create_info = {};
+		depth_stencil_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depth_stencil_create_info.depthTestEnable = VK_TRUE;
+		depth_stencil_create_info.depthWriteEnable = VK_TRUE;
+		depth_stencil_create_info.depthCompareOp = VK_COMPARE_OP_LESS;
+		depth_stencil_create_info.minDepthBounds = 0.0f;
+		depth_stencil_create_info.maxDepthBounds = 1.0f;
+
+		VkPipelineColorBlendStateCreateInfo color_blend_create_info = {};
+		color_blend_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		color_blend_create_info.attachmentCount = 0;
+
+		VkGraphicsPipelineCreateInfo pipeline_create_info = {};
+		pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipeline_create_info.stageCount = 1;
+		pipeline_create_info.pStages = &stage_create_info;
+		pipeline_create_info.pInputAssemblyState = &assembly_create_info;
+		pipeline_create_info.pVertexInputState = &input_vertex_info;
+		pipeline_create_info.pViewportState = &viewport_create_info;
+		pipeline_create_info.pRasterizationState = &rasterization_create_info;
+		pipeline_create_info.pMultisampleState = &multisample_create_info;
+		pipeline_create_info.pDepthStencilState = &depth_stencil_create_info;
+		pipeline_create_info.pColorBlendState = &color_blend_create_info;
+		pipeline_create_info.layout = drawPipelineLayout;
+		pipeline_create_info.renderPass = renderPass;
+		pipeline_create_info.subpass = 0;
+		pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+		return vkCreateGraphicsPipelines(device, pipelineCache, 1,
+			&pipeline_create_info, nullptr, &depthPipeline) == VkResult::VK_SUCCESS;
+	}
+
+	bool CreatePyramid(VkPhysicalDevice physicalDevice, VkShaderModule pyramidComputeShader)
+	{
+		unsigned levelCount = pyramid.GetLevelCount();
+		if (VkUtils::CreateImage(device, physicalDevice, pyramid.GetLevelWidth(0), pyramid.GetLevelHeight(0),
+			levelCount, HIZ_PYRAMID_FORMAT,
+			VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+			&pyramidImage, &pyramidMemory) != VkResult::VK_SUCCESS)
+			return false;
+
+		pyramidViews.resize(levelCount, nullptr);
+		for (unsigned level = 0; level < levelCount; level++)
+		{
+			if (VkUtils::CreateImageView(device, pyramidImage, HIZ_PYRAMID_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT,
+				level, 1, &pyramidViews[level]) != VkResult::VK_SUCCESS)
+				return false;
+		}
+
+		// binding 0 = previous level (or the depth target), binding 1 = level being written
+		VkDescriptorSetLayoutBinding bindings[2] = {};
+		bindings[0].binding = 0;
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		bindings[0].descriptorCount = 1;
+		bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[1].binding = 1;
+		bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		bindings[1].descriptorCount = 1;
+		bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+		setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		setLayoutInfo.bindingCount = 2;
+		setLayoutInfo.pBindings = bindings;
+		if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr, &pyramidSetLayout) != VkResult::VK_SUCCESS)
+			return false;
+
+		VkPushConstantRange constantRange = {};
+		constantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		constantRange.offset = 0;
+		constantRange.size = sizeof(LEVEL_PUSH_CONSTANTS);
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &pyramidSetLayout;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &constantRange;
+		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pyramidPipelineLayout) != VkResult::VK_SUCCESS)
+			return false;
+
+		VkComputePipelineCreateInfo computeInfo = {};
+		computeInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		computeInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		computeInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		computeInfo.stage.module = pyramidComputeShader;
+		computeInfo.stage.pName = "main";
+		computeInfo.layout = pyramidPipelineLayout;
+		if (vkCreateComputePipelines(device, pipelineCache, 1, &computeInfo, nullptr, &pyramidPipeline) != VkResult::VK_SUCCESS)
+			return false;
+
+		// One descriptor set per level
+		VkDescriptorPoolSize poolSizes[2] = {
+			{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, levelCount },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, levelCount }
+		};
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = levelCount;
+		poolInfo.poolSizeCount = 2;
+		poolInfo.pPoolSizes = poolSizes;
+		if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VkResult::VK_SUCCESS)
+			return false;
+
+		pyramidSets.resize(levelCount, nullptr);
+		VkDescriptorSetAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocateInfo.descriptorPool = descriptorPool;
+		allocateInfo.descriptorSetCount = 1;
+		allocateInfo.pSetLayouts = &pyramidSetLayout;
+		for (unsigned level = 0; level < levelCount; level++)
+		{
+			if (vkAllocateDescriptorSets(device, &allocateInfo, &pyramidSets[level]) != VkResult::VK_SUCCESS)
+				return false;
+
+			VkDescriptorImageInfo srcInfo = { nullptr,
+				level == 0 ? depthView : pyramidViews[level - 1],
+				level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL };
+			VkDescriptorImageInfo dstInfo = { nullptr, pyramidViews[level], VK_IMAGE_LAYOUT_GENERAL };
+
+			VkWriteDescriptorSet writes[2] = {};
+			writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[0].dstSet = pyramidSets[level];
+			writes[0].dstBinding = 0;
+			writes[0].descriptorCount = 1;
+			writes[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			writes[0].pImageInfo = &srcInfo;
+			writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[1].dstSet = pyramidSets[level];
+			writes[1].dstBinding = 1;
+			writes[1].descriptorCount = 1;
+			writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			writes[1].pImageInfo = &dstInfo;
+			vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+		}
+		return true;
+	}
+
+	bool CreateFrameSlots(VkPhysicalDevice physicalDevice)
+	{
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.commandPool = commandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = 1;
+
+		// Host visible copy of every level per slot, mapped for the lifetime of the object
+		VkDeviceSize readbackSize = sizeof(float) * pyramid.GetTexelCount();
+		for (FRAME_SLOT& frame : slots)
+		{
+			if (vkAllocateCommandBuffers(device, &allocateInfo, &frame.commandBuffer) != VkResult::VK_SUCCESS)
+			{
+				frame.commandBuffer = nullptr;
+				return false;
+			}
+			if (GvkHelper::create_buffer(physicalDevice, device, readbackSize,
+				VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &frame.readbackBuffer, &frame.readbackMemory) != VkResult::VK_SUCCESS)
+				return false;
+			if (vkMapMemory(device, frame.readbackMemory, 0, readbackSize, 0, &frame.readbackMapped) != VkResult::VK_SUCCESS)
+			{
+				frame.readbackMapped = nullptr;
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+#endif
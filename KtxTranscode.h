@@ -0,0 +1,74 @@
+#ifndef _KTXTRANSCODE_H_
+#define _KTXTRANSCODE_H_
+#include <string>
+#include <sys/stat.h>
+#include "ktx.h"
+#include <ktxvulkan.h>
+
+/**
+ * KTX2 / Basis Universal input.
+ * Supercompressed textures are transcoded once, when read, to the best block compressed format the
+ * device samples & has enabled (BC7, then ASTC 4x4, then ETC2), or to plain RGBA otherwise.
+ * A "name.ktx2" next to a level's "name.ktx" is read in its place, so assets can ship compressed
+ * without touching the level files.
+ */
+namespace KtxTranscode
+{
+	inline bool IsSampleable(VkPhysicalDevice physicalDevice, VkFormat format)
+	{
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+		return (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+	}
+
+	// features are the ones the device was created with, a supported but disabled compression
+	// feature may not be sampled
+	inline ktx_transcode_fmt_e ChooseFormat(VkPhysicalDevice physicalDevice, const VkPhysicalDeviceFeatures& features)
+	{
+		if (features.textureCompressionBC && IsSampleable(physicalDevice, VK_FORMAT_BC7_UNORM_BLOCK))
+			return KTX_TTF_BC7_RGBA;
+		if (features.textureCompressionASTC_LDR && IsSampleable(physicalDevice, VK_FORMAT_ASTC_4x4_UNORM_BLOCK))
+			return KTX_TTF_ASTC_4x4_RGBA;
+		if (features.textureCompressionETC2 && IsSampleable(physicalDevice, VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK))
+			return KTX_TTF_ETC2_RGBA;
+		if (features.textureCompressionBC && IsSampleable(physicalDevice, VK_FORMAT_BC3_UNORM_BLOCK))
+			return KTX_TTF_BC3_RGBA;
+		return KTX_TTF_RGBA32;
+	}
+
+	// "../Assets/Textures/Brick.ktx" -> "../Assets/Textures/Brick.ktx2" when that file exists
+	inline std::string PreferredPath(const std::string& path)
+	{
+		if (path.size() < 4 || path.compare(path.size() - 4, 4, ".ktx") != 0)
+			return path;
+		struct stat info;
+		std::string compressed = path + "2";
+		return stat(compressed.c_str(), &info) == 0 ? compressed : path;
+	}
+
+	// Reads path (or its .ktx2) with its image data, transcoding Basis textures to format
+	inline KTX_error_code ReadTexture(const std::string& path, ktx_transcode_fmt_e format, ktxTexture** kTexture)
+	{
+		*kTexture = nullptr;
+		KTX_error_code result = ktxTexture_CreateFromNamedFile(PreferredPath(path).c_str(),
+			KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, kTexture);
+		if (result != KTX_error_code::KTX_SUCCESS)
+		{
+			*kTexture = nullptr;
+			return result;
+		}
+
+		if (ktxTexture_NeedsTranscoding(*kTexture))
+		{
+			result = ktxTexture2_TranscodeBasis((ktxTexture2*)*kTexture, format, 0);
+			if (result != KTX_error_code::KTX_SUCCESS)
+			{
+				ktxTexture_Destroy(*kTexture);
+				*kTexture = nullptr;
+			}
+		}
+		return result;
+	}
+}
+
+#endif
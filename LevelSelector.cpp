@@ -2,9 +2,15 @@
 #include <algorithm> 
 #include <cctype>
 #include <locale>
+#include <chrono>
+#ifdef _WIN32
 #include <windows.h>
 #include <Commdlg.h>
+#else
+#include <cstdlib>
+#endif
 
+#ifdef _WIN32
 bool LevelSelector::Selector::SelectNewLevel(bool showPrompt = false)
 {
 
@@ -40,6 +46,35 @@ bool LevelSelector::Selector::SelectNewLevel(bool showPrompt = false)
 
 	return newFileSelected;
 }
+#else
+// No file dialog outside win32: the level path is typed into the console instead
+bool LevelSelector::Selector::SelectNewLevel(bool showPrompt = false)
+{
+	if (showPrompt)
+		std::cout << "Levels can be loaded by pressing the 'F1' key.\n\nCamera Controls: WASD\n\nLight Controls NUM Pad 4(left) 5(backwards) 6(right) 8(forwards) +(up) enter(down)\n\nReset the light using NUM Pad 0.\n\n";
+
+	std::cout << "Level file (.txt): " << std::flush;
+	std::string fileStr;
+	if (!std::getline(std::cin, fileStr))
+	{
+		// Nothing more can be read, so asking again would never end
+		if (selectedFile.empty())
+		{
+			std::cerr << "Level Selector - ERROR: No level given, pass one on the command line.\n";
+			std::exit(EXIT_FAILURE);
+		}
+		return true;
+	}
+	trim(fileStr);
+
+	bool newFileSelected = fileStr.compare("") != 0;
+
+	if (newFileSelected)
+		selectedFile = fileStr;
+
+	return newFileSelected;
+}
+#endif
 
 const char* LevelSelector::modelAssetPath = "../Assets/Models/";
 const char* LevelSelector::textureAssetPath = "../Assets/Textures/";
@@ -50,6 +85,11 @@ const char* LevelSelector::modelAssetExt = ".h2b";
 
 int LevelSelector::Parser::ParseGameLevel(std::string& filePath)
 {
+	TRACE_SCOPE("ParseGameLevel");
+	auto parseStart = std::chrono::high_resolution_clock::now();
+	double nestedStart = report == nullptr ? 0.0 : report->GetPhase(LOAD_PHASE_H2B_READ).milliseconds
+		+ report->GetPhase(LOAD_PHASE_MATERIALS).milliseconds;
+
 	// Clear Old Data
 	LevelSelector::Parser::Clear();
 
@@ -105,6 +145,19 @@ int LevelSelector::Parser::ParseGameLevel(std::string& filePath)
 
 	fileHandler.close();
 
+	// Mesh files & materials are read while the level text is, the rest of the time is the text itself
+	if (report != nullptr)
+	{
+		double nested = report->GetPhase(LOAD_PHASE_H2B_READ).milliseconds
+			+ report->GetPhase(LOAD_PHASE_MATERIALS).milliseconds - nestedStart;
+		unsigned instanceCount = 0;
+		for (auto& model : models)
+			instanceCount += model.second.instanceCount;
+		report->AddPhase(LOAD_PHASE_TEXT_PARSE, std::chrono::duration<double, std::milli>(
+			std::chrono::high_resolution_clock::now() - parseStart).count() - nested,
+			LoadReport::FileSize(filePath), 0, instanceCount + cameraCount);
+	}
+
 	return LevelSelector::OK;
 }
 
@@ -175,6 +228,7 @@ int LevelSelector::Parser::ParseMatrix(GW::MATH::GMATRIXF& matrix)
 
 int LevelSelector::Parser::LoadMesh(std::string meshName)
 {
+	TRACE_SCOPE("LoadMesh");
 	if (models.find(meshName) == models.end())
 	{
 		h2bParser.Clear();
@@ -182,12 +236,25 @@ int LevelSelector::Parser::LoadMesh(std::string meshName)
 			+ meshName
 			+ modelAssetExt;
 		
+		auto readStart = std::chrono::high_resolution_clock::now();
 		if (!h2bParser.Parse(fullPath.c_str()))
 			return ErrFindingModelFile(fullPath);
+		auto materialsStart = std::chrono::high_resolution_clock::now();
 
 		h2bParser.model.instanceCount = 1;
 		ParseMaterials();
 
+		if (report != nullptr)
+		{
+			double readTime = std::chrono::duration<double, std::milli>(materialsStart - readStart).count();
+			double materialsTime = std::chrono::duration<double, std::milli>(
+				std::chrono::high_resolution_clock::now() - materialsStart).count();
+			uint64_t fileBytes = LoadReport::FileSize(fullPath);
+			report->AddPhase(LOAD_PHASE_H2B_READ, readTime, fileBytes, 0, 1);
+			report->AddPhase(LOAD_PHASE_MATERIALS, materialsTime, 0, 0, h2bParser.model.materialInfo.materialCount);
+			report->AddMesh(meshName, readTime + materialsTime, fileBytes);
+		}
+
 		h2bParser.model.modelName = meshName;
 		models[meshName] = h2bParser.model;
 	}
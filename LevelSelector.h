@@ -2,6 +2,7 @@
 #define __LEVELPARSER_H__
 #include <fstream>
 #include "h2bParser.h"
+#include "LoadReport.h"
 #include <iostream>
 #include <unordered_map>
 #include <vector>
@@ -85,6 +86,9 @@ namespace LevelSelector
 		std::vector<graphics::CAMERA> CamerasToVector();
 
 		graphics::LEVEL_INFO levelInfo = { 0 };
+
+		// Parse, H2B read & material timings of the next ParseGameLevel go here when set
+		LoadReport* report = nullptr;
 	};
 
 	class Selector
@@ -98,6 +102,7 @@ namespace LevelSelector
 		bool SelectNewLevel(bool showPrompt);
 
 		inline std::string GetSelectedFile() { return selectedFile; }
+		inline void SetSelectedFile(const std::string& file) { selectedFile = file; }
 		inline bool IsCurrentlySelectingFile() { return currentlySelectingFile; }
 		inline int ParseSelectedLevel() { return levelParser.ParseGameLevel(selectedFile); }
 	};
@@ -0,0 +1,203 @@
+#ifndef _LOADREPORT_H_
+#define _LOADREPORT_H_
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <ostream>
+#include <cstdint>
+#include <sys/stat.h>
+
+// Slowest meshes & textures listed by a report
+#define LOAD_REPORT_SLOWEST 10
+
+enum LOAD_PHASE
+{
+	LOAD_PHASE_TEXT_PARSE = 0,
+	LOAD_PHASE_H2B_READ,
+	LOAD_PHASE_MATERIALS,
+	LOAD_PHASE_BOUNDS_LODS,
+	LOAD_PHASE_BUFFERS,
+	LOAD_PHASE_DESCRIPTORS,
+	LOAD_PHASE_TEXTURE_DECODE,
+	LOAD_PHASE_TEXTURE_UPLOAD,
+	LOAD_PHASE_PIPELINES,
+	LOAD_PHASE_COUNT
+};
+
+/**
+ * Where a level load's time went.
+ * Each phase gets the time spent in it, bytes read from disk, bytes uploaded to the device & how many
+ * objects it produced; meshes & textures are also timed one by one so the slowest can be listed.
+ * A report belongs to one load & is only touched by one thread at a time: the level loader fills
+ * the parse & buffer phases, then hands it to the render thread with the level, which adds
+ * descriptors, textures & (at startup) pipelines & finishes it once the textures are all in.
+ */
+class LoadReport
+{
+public:
+	struct PHASE
+	{
+		double milliseconds = 0.0;
+		uint64_t bytesRead = 0;
+		uint64_t bytesUploaded = 0;
+		unsigned objects = 0;
+	};
+
+	struct ITEM
+	{
+		std::string name;
+		double milliseconds;
+		uint64_t bytes;
+	};
+
+private:
+	std::string level;
+	PHASE phases[LOAD_PHASE_COUNT];
+	std::vector<ITEM> meshes;
+	std::vector<ITEM> textures;
+	std::chrono::high_resolution_clock::time_point start;
+	double wallMilliseconds = 0.0;
+	bool finished = false;
+	bool succeeded = false;
+
+public:
+	void Begin(const std::string& _level)
+	{
+		*this = LoadReport();
+		level = _level;
+		start = std::chrono::high_resolution_clock::now();
+	}
+
+	void AddPhase(LOAD_PHASE phase, double milliseconds, uint64_t bytesRead, uint64_t bytesUploaded, unsigned objects)
+	{
+		phases[phase].milliseconds += milliseconds;
+		phases[phase].bytesRead += bytesRead;
+		phases[phase].bytesUploaded += bytesUploaded;
+		phases[phase].objects += objects;
+	}
+
+	// Repeated names add up (a mesh's file read, then its buffers)
+	inline void AddMesh(const std::string& name, double milliseconds, uint64_t bytes) { AddItem(meshes, name, milliseconds, bytes); }
+	inline void AddTexture(const std::string& name, double milliseconds, uint64_t bytes) { AddItem(textures, name, milliseconds, bytes); }
+
+	// Begin to now is the load's wall time, everything it waited on included
+	void Finish(bool _succeeded)
+	{
+		wallMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		finished = true;
+		succeeded = _succeeded;
+	}
+
+	inline const PHASE& GetPhase(LOAD_PHASE phase) const { return phases[phase]; }
+	inline bool IsFinished() const { return finished; }
+	inline bool IsSucceeded() const { return succeeded; }
+	inline bool IsStarted() const { return !level.empty(); }
+
+	static const char* GetPhaseName(LOAD_PHASE phase)
+	{
+		static const char* names[LOAD_PHASE_COUNT] = { "text parse", "H2B read", "material resolution",
+			"bounds & LODs", "buffer creation & upload", "descriptor allocation", "texture decode",
+			"texture upload", "pipeline creation" };
+		return names[phase];
+	}
+
+	static uint64_t FileSize(const std::string& path)
+	{
+		struct stat info;
+		return stat(path.c_str(), &info) == 0 ? (uint64_t)info.st_size : 0;
+	}
+
+	void Print(std::ostream& out) const
+	{
+		out << "Load report - " << level << (succeeded ? "" : " (FAILED)") << " | wall: " << wallMilliseconds << "ms\n";
+		for (unsigned i = 0; i < LOAD_PHASE_COUNT; i++)
+		{
+			const PHASE& phase = phases[i];
+			out << "  " << GetPhaseName((LOAD_PHASE)i) << ": " << phase.milliseconds << "ms | read: "
+				<< phase.bytesRead / 1024 << "KB | uploaded: " << phase.bytesUploaded / 1024 << "KB | objects: " << phase.objects << "\n";
+		}
+		PrintSlowest(out, "meshes", meshes);
+		PrintSlowest(out, "textures", textures);
+	}
+
+	bool Write(const char* path) const
+	{
+		std::ofstream file(path);
+		if (!file.is_open())
+			return false;
+		file << "{\n\t\"level\": \"" << Escape(level) << "\",\n\t\"succeeded\": " << (succeeded ? "true" : "false")
+			<< ",\n\t\"wall_ms\": " << wallMilliseconds << ",\n\t\"phases\": [";
+		for (unsigned i = 0; i < LOAD_PHASE_COUNT; i++)
+		{
+			const PHASE& phase = phases[i];
+			file << (i > 0 ? "," : "") << "\n\t\t{ \"name\": \"" << GetPhaseName((LOAD_PHASE)i) << "\", \"ms\": " << phase.milliseconds
+				<< ", \"bytes_read\": " << phase.bytesRead << ", \"bytes_uploaded\": " << phase.bytesUploaded
+				<< ", \"objects\": " << phase.objects << " }";
+		}
+		file << "\n\t],\n";
+		WriteSlowest(file, "slowest_meshes", meshes);
+		file << ",\n";
+		WriteSlowest(file, "slowest_textures", textures);
+		file << "\n}\n";
+		return true;
+	}
+
+private:
+	static void AddItem(std::vector<ITEM>& items, const std::string& name, double milliseconds, uint64_t bytes)
+	{
+		for (ITEM& item : items)
+		{
+			if (item.name == name)
+			{
+				item.milliseconds += milliseconds;
+				item.bytes += bytes;
+				return;
+			}
+		}
+		items.push_back({ name, milliseconds, bytes });
+	}
+
+	static std::vector<ITEM> Slowest(const std::vector<ITEM>& items)
+	{
+		std::vector<ITEM> sorted = items;
+		std::sort(sorted.begin(), sorted.end(), [](const ITEM& a, const ITEM& b) { return a.milliseconds > b.milliseconds; });
+		if (sorted.size() > LOAD_REPORT_SLOWEST)
+			sorted.resize(LOAD_REPORT_SLOWEST);
+		return sorted;
+	}
+
+	static void PrintSlowest(std::ostream& out, const char* label, const std::vector<ITEM>& items)
+	{
+		out << "  slowest " << label << ":";
+		for (const ITEM& item : Slowest(items))
+			out << "\n    " << item.milliseconds << "ms " << item.name << " (" << item.bytes / 1024 << "KB)";
+		out << "\n";
+	}
+
+	static void WriteSlowest(std::ostream& out, const char* key, const std::vector<ITEM>& items)
+	{
+		std::vector<ITEM> slowest = Slowest(items);
+		out << "\t\"" << key << "\": [";
+		for (unsigned i = 0; i < slowest.size(); i++)
+			out << (i > 0 ? "," : "") << "\n\t\t{ \"name\": \"" << Escape(slowest[i].name) << "\", \"ms\": "
+				<< slowest[i].milliseconds << ", \"bytes\": " << slowest[i].bytes << " }";
+		out << "\n\t]";
+	}
+
+	// Level & texture paths carry Windows separators
+	static std::string Escape(const std::string& text)
+	{
+		std::string escaped;
+		for (char c : text)
+		{
+			if (c == '\\' || c == '"')
+				escaped += '\\';
+			escaped += c;
+		}
+		return escaped;
+	}
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef _MEMORYSTATS_H_
+#define _MEMORYSTATS_H_
+#include <atomic>
+#include <ostream>
+#include <cstdint>
+
+enum MEMORY_CATEGORY
+{
+	MEMORY_CPU_GEOMETRY = 0, // vertices, indices, matrices & bounds of the current level
+	MEMORY_GPU_VERTEX, // vertex & position buffers
+	MEMORY_GPU_INDEX,
+	MEMORY_TEXTURE_DIFFUSE, // resident levels, a texture used by several maps counts once
+	MEMORY_TEXTURE_SPECULAR,
+	MEMORY_TEXTURE_NORMAL,
+	MEMORY_STORAGE_BUFFERS, // per frame matrix buffers
+	MEMORY_DESCRIPTOR_POOLS, // estimated, see MEMORY_DESCRIPTOR_BYTES
+	MEMORY_STAGING, // texture staging ring (persistent) & overflow buffers, freed once their transfer is done
+	MEMORY_CATEGORY_COUNT
+};
+
+// Drivers don't report descriptor pool memory, pools are counted at this much per descriptor
+#define MEMORY_DESCRIPTOR_BYTES 64
+
+/**
+ * Live & peak bytes per category.
+ * Buffers are counted at their allocation size where they are created & destroyed, categories the
+ * renderer derives (textures per map, descriptor pools) are Set whenever they change. Peaks are
+ * never reset, so they cover every level loaded since startup. The level loader thread adds its
+ * buffers while the render thread reads, so every counter is atomic.
+ */
+class MemoryStats
+{
+	std::atomic<uint64_t> current[MEMORY_CATEGORY_COUNT];
+	std::atomic<uint64_t> peak[MEMORY_CATEGORY_COUNT];
+	std::atomic<uint64_t> peakTotal;
+
+public:
+	MemoryStats()
+	{
+		for (unsigned i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+		{
+			current[i] = 0;
+			peak[i] = 0;
+		}
+		peakTotal = 0;
+	}
+
+	void Add(MEMORY_CATEGORY category, uint64_t bytes)
+	{
+		Raise(peak[category], current[category].fetch_add(bytes) + bytes);
+		Raise(peakTotal, GetTotal());
+	}
+
+	void Remove(MEMORY_CATEGORY category, uint64_t bytes)
+	{
+		current[category].fetch_sub(bytes);
+	}
+
+	void Set(MEMORY_CATEGORY category, uint64_t bytes)
+	{
+		current[category] = bytes;
+		Raise(peak[category], bytes);
+		Raise(peakTotal, GetTotal());
+	}
+
+	inline uint64_t GetCurrent(MEMORY_CATEGORY category) const { return current[category]; }
+	inline uint64_t GetPeak(MEMORY_CATEGORY category) const { return peak[category]; }
+	inline uint64_t GetPeakTotal() const { return peakTotal; }
+
+	uint64_t GetTotal() const
+	{
+		uint64_t total = 0;
+		for (unsigned i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+			total += current[i];
+		return total;
+	}
+
+	static const char* GetCategoryName(MEMORY_CATEGORY category)
+	{
+		static const char* names[MEMORY_CATEGORY_COUNT] = { "cpu geometry", "gpu vertex", "gpu index",
+			"diffuse maps", "specular maps", "normal maps", "storage buffers", "descriptor pools", "staging" };
+		return names[category];
+	}
+
+	// One line, MB current / peak per category
+	void Print(std::ostream& out) const
+	{
+		out << "Memory (MB now / peak) - total: " << GetTotal() / (1024.0 * 1024.0) << " / " << GetPeakTotal() / (1024.0 * 1024.0);
+		for (unsigned i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+			out << " | " << GetCategoryName((MEMORY_CATEGORY)i) << ": " << current[i] / (1024.0 * 1024.0)
+				<< " / " << peak[i] / (1024.0 * 1024.0);
+		out << "\n";
+	}
+
+private:
+	static void Raise(std::atomic<uint64_t>& maximum, uint64_t value)
+	{
+		uint64_t previous = maximum;
+		while (value > previous && !maximum.compare_exchange_weak(previous, value))
+			;
+	}
+};
+
+#endif
@@ -0,0 +1,406 @@
+#ifndef _MESHLOD_H_
+#define _MESHLOD_H_
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "Culling.h"
+
+// Triangle ratio between neighbouring LODs. Each LOD is used over half the projected size of the
+// previous one, so a quarter of the triangles keeps triangle count falling with distance squared
+#define MESH_LOD_MAX_COUNT 4
+#define MESH_LOD_REDUCTION 0.25f
+#define MESH_LOD_MIN_TRIANGLES 16
+// A LOD that does not drop at least this fraction of the previous LOD's triangles ends the chain
+#define MESH_LOD_MIN_SAVINGS 0.2f
+// Projected radius (fraction of half the screen height) below which LOD 1 is used, halves per LOD
+#define MESH_LOD_SCREEN_SIZE 0.5f
+// Allowed collapse error for LOD 1 as a fraction of the model's bounding radius. Doubles per LOD,
+// which keeps the error roughly constant on screen
+#define MESH_LOD_MAX_ERROR 0.02f
+#define MESH_LOD_BOUNDARY_WEIGHT 10.0
+
+/**
+ * Mesh simplification & LOD selection.
+ * Uses quadric error metric edge collapse (Garland & Heckbert) on a position welded copy of the
+ * mesh, so UV & normal seams never crack. Collapsed corners pick the copy of the surviving vertex
+ * with the closest attributes, which keeps every LOD in the model's original vertex buffer.
+ */
+namespace MeshLod
+{
+	// Symmetric 4x4 matrix stored as its upper triangle, plus the summed weight of its planes
+	struct QUADRIC
+	{
+		double a[10];
+		double weight;
+	};
+
+	inline void AddPlane(QUADRIC& q, double a, double b, double c, double d, double weight)
+	{
+		q.a[0] += weight * a * a; q.a[1] += weight * a * b; q.a[2] += weight * a * c; q.a[3] += weight * a * d;
+		q.a[4] += weight * b * b; q.a[5] += weight * b * c; q.a[6] += weight * b * d;
+		q.a[7] += weight * c * c; q.a[8] += weight * c * d;
+		q.a[9] += weight * d * d;
+		q.weight += weight;
+	}
+
+	inline void AddQuadric(QUADRIC& q, const QUADRIC& other)
+	{
+		for (int i = 0; i < 10; i++)
+			q.a[i] += other.a[i];
+		q.weight += other.weight;
+	}
+
+	inline double QuadricError(const QUADRIC& q, const graphics::VECTOR& p)
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double error = q.a[0] * x * x + 2 * q.a[1] * x * y + 2 * q.a[2] * x * z + 2 * q.a[3] * x
+			+ q.a[4] * y * y + 2 * q.a[5] * y * z + 2 * q.a[6] * y
+			+ q.a[7] * z * z + 2 * q.a[8] * z
+			+ q.a[9];
+		return std::fabs(error);
+	}
+
+	// Planes are weighted by area (& boundary edge length squared), so the raw error grows with
+	// length^4. Dividing by the summed weight gives the weighted mean squared distance to the planes
+	inline double QuadricDistanceSquared(const QUADRIC& q, const graphics::VECTOR& p)
+	{
+		return q.weight > 0.0 ? QuadricError(q, p) / q.weight : 0.0;
+	}
+
+	inline graphics::VECTOR Subtract(const graphics::VECTOR& a, const graphics::VECTOR& b)
+	{
+		return { a.x - b.x, a.y - b.y, a.z - b.z };
+	}
+
+	inline graphics::VECTOR Cross(const graphics::VECTOR& a, const graphics::VECTOR& b)
+	{
+		return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+	}
+
+	inline float Dot(const graphics::VECTOR& a, const graphics::VECTOR& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	// Maps every vertex to the first vertex sharing its exact position
+	inline void WeldPositions(const std::vector<graphics::VERTEX>& vertices, std::vector<unsigned>& weld)
+	{
+		struct KEY
+		{
+			unsigned bits[3];
+			bool operator==(const KEY& other) const { return std::memcmp(bits, other.bits, sizeof(bits)) == 0; }
+		};
+		struct HASH
+		{
+			size_t operator()(const KEY& key) const { return key.bits[0] * 73856093u ^ key.bits[1] * 19349663u ^ key.bits[2] * 83492791u; }
+		};
+
+		std::unordered_map<KEY, unsigned, HASH> firstVertex;
+		weld.resize(vertices.size());
+		for (unsigned i = 0; i < vertices.size(); i++)
+		{
+			KEY key;
+			std::memcpy(key.bits, &vertices[i].pos, sizeof(key.bits));
+			weld[i] = firstVertex.emplace(key, i).first->second;
+		}
+	}
+
+	/**
+	 * Simplifies one index range down to (at most) targetIndexCount indices, stopping early once
+	 * the next collapse would move the surface further than maxError. Output indices reference the
+	 * same vertex list as the input.
+	 */
+	inline void Simplify(const std::vector<graphics::VERTEX>& vertices, const std::vector<unsigned>& weld,
+		const unsigned* indices, unsigned indexCount, unsigned targetIndexCount, float maxError, std::vector<unsigned>& out)
+	{
+		unsigned triangleCount = indexCount / 3;
+		unsigned targetTriangles = targetIndexCount / 3;
+		double maxCost = (double)maxError * maxError;
+
+		// Triangles on welded positions, plus the original vertex used by each corner
+		std::vector<unsigned> corners(indices, indices + triangleCount * 3);
+		std::vector<unsigned> welded(triangleCount * 3);
+		for (unsigned i = 0; i < welded.size(); i++)
+			welded[i] = weld[corners[i]];
+		std::vector<bool> removed(triangleCount, false);
+
+		// Original vertices sharing each welded position, so collapsed corners can pick the closest attributes
+		std::unordered_map<unsigned, std::vector<unsigned>> copies;
+		for (unsigned corner : corners)
+		{
+			std::vector<unsigned>& list = copies[weld[corner]];
+			if (std::find(list.begin(), list.end(), corner) == list.end())
+				list.push_back(corner);
+		}
+
+		std::unordered_map<unsigned, QUADRIC> quadrics;
+		for (unsigned t = 0; t < triangleCount; t++)
+		{
+			const graphics::VECTOR& p0 = vertices[welded[t * 3 + 0]].pos;
+			const graphics::VECTOR& p1 = vertices[welded[t * 3 + 1]].pos;
+			const graphics::VECTOR& p2 = vertices[welded[t * 3 + 2]].pos;
+			graphics::VECTOR normal = Cross(Subtract(p1, p0), Subtract(p2, p0));
+			double length = std::sqrt((double)Dot(normal, normal));
+			if (length <= 0.0)
+			{
+				for (int k = 0; k < 3; k++)
+					quadrics.emplace(welded[t * 3 + k], QUADRIC{});
+				continue;
+			}
+			double nx = normal.x / length, ny = normal.y / length, nz = normal.z / length;
+			double d = -(nx * p0.x + ny * p0.y + nz * p0.z);
+			for (int k = 0; k < 3; k++)
+				AddPlane(quadrics[welded[t * 3 + k]], nx, ny, nz, d, length * 0.5);
+		}
+
+		// Open edges get a perpendicular plane so borders stay in place
+		std::unordered_map<unsigned long long, unsigned> edgeUse;
+		auto edgeKey = [](unsigned a, unsigned b) {
+			return a < b ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a;
+		};
+		for (unsigned t = 0; t < triangleCount; t++)
+			for (int k = 0; k < 3; k++)
+				++edgeUse[edgeKey(welded[t * 3 + k], welded[t * 3 + (k + 1) % 3])];
+		for (unsigned t = 0; t < triangleCount; t++)
+		{
+			const graphics::VECTOR& p0 = vertices[welded[t * 3 + 0]].pos;
+			graphics::VECTOR faceNormal = Cross(Subtract(vertices[welded[t * 3 + 1]].pos, p0), Subtract(vertices[welded[t * 3 + 2]].pos, p0));
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned a = welded[t * 3 + k], b = welded[t * 3 + (k + 1) % 3];
+				if (edgeUse[edgeKey(a, b)] != 1)
+					continue;
+				graphics::VECTOR edge = Subtract(vertices[b].pos, vertices[a].pos);
+				graphics::VECTOR normal = Cross(edge, faceNormal);
+				double length = std::sqrt((double)Dot(normal, normal));
+				if (length <= 0.0)
+					continue;
+				double nx = normal.x / length, ny = normal.y / length, nz = normal.z / length;
+				double d = -(nx * vertices[a].pos.x + ny * vertices[a].pos.y + nz * vertices[a].pos.z);
+				double weight = MESH_LOD_BOUNDARY_WEIGHT * Dot(edge, edge);
+				AddPlane(quadrics[a], nx, ny, nz, d, weight);
+				AddPlane(quadrics[b], nx, ny, nz, d, weight);
+			}
+		}
+
+		struct COLLAPSE
+		{
+			unsigned from;
+			unsigned to;
+			double cost;
+		};
+
+		// Each pass collapses the cheapest edges whose neighbourhoods do not overlap, then rebuilds
+		unsigned liveTriangles = triangleCount;
+		std::vector<COLLAPSE> collapses;
+		std::unordered_map<unsigned, std::vector<unsigned>> adjacency;
+		std::unordered_map<unsigned, bool> locked;
+		while (liveTriangles > targetTriangles)
+		{
+			collapses.clear();
+			adjacency.clear();
+			locked.clear();
+			edgeUse.clear();
+			for (unsigned t = 0; t < triangleCount; t++)
+			{
+				if (removed[t])
+					continue;
+				for (int k = 0; k < 3; k++)
+				{
+					unsigned a = welded[t * 3 + k], b = welded[t * 3 + (k + 1) % 3];
+					adjacency[a].push_back(t);
+					if (!edgeUse.emplace(edgeKey(a, b), 1).second)
+						continue;
+
+					QUADRIC q = quadrics[a];
+					AddQuadric(q, quadrics[b]);
+					double toB = QuadricDistanceSquared(q, vertices[b].pos);
+					double toA = QuadricDistanceSquared(q, vertices[a].pos);
+					if (toB <= toA)
+						collapses.push_back({ a, b, toB });
+					else
+						collapses.push_back({ b, a, toA });
+				}
+			}
+			std::sort(collapses.begin(), collapses.end(),
+				[](const COLLAPSE& a, const COLLAPSE& b) { return a.cost < b.cost; });
+
+			unsigned collapsed = 0;
+			for (const COLLAPSE& collapse : collapses)
+			{
+				if (liveTriangles <= targetTriangles || collapse.cost > maxCost)
+					break;
+				if (locked[collapse.from] || locked[collapse.to])
+					continue;
+
+				// Reject collapses that flip a remaining triangle
+				const std::vector<unsigned>& around = adjacency[collapse.from];
+				bool flips = false;
+				for (unsigned t : around)
+				{
+					unsigned* tri = &welded[t * 3];
+					if (removed[t] || tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to)
+						continue;
+					graphics::VECTOR p[3], moved[3];
+					for (int k = 0; k < 3; k++)
+					{
+						p[k] = vertices[tri[k]].pos;
+						moved[k] = tri[k] == collapse.from ? vertices[collapse.to].pos : p[k];
+					}
+					graphics::VECTOR before = Cross(Subtract(p[1], p[0]), Subtract(p[2], p[0]));
+					graphics::VECTOR after = Cross(Subtract(moved[1], moved[0]), Subtract(moved[2], moved[0]));
+					if (Dot(before, after) <= 0.0f)
+					{
+						flips = true;
+						break;
+					}
+				}
+				if (flips)
+					continue;
+
+				const std::vector<unsigned>& targets = copies[collapse.to];
+				for (unsigned t : around)
+				{
+					if (removed[t])
+						continue;
+					unsigned* tri = &welded[t * 3];
+					for (int k = 0; k < 3; k++)
+						locked[tri[k]] = true;
+
+					if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to)
+					{
+						removed[t] = true;
+						--liveTriangles;
+						continue;
+					}
+
+					for (int k = 0; k < 3; k++)
+					{
+						if (tri[k] != collapse.from)
+							continue;
+						tri[k] = collapse.to;
+
+						// Closest uv, then normal, among the vertices sitting at the new position
+						const graphics::VERTEX& old = vertices[corners[t * 3 + k]];
+						float best = FLT_MAX;
+						for (unsigned candidate : targets)
+						{
+							const graphics::VERTEX& v = vertices[candidate];
+							float du = v.uvw.x - old.uvw.x, dv = v.uvw.y - old.uvw.y;
+							float score = (du * du + dv * dv) * 4.0f + (1.0f - Dot(v.nrm, old.nrm));
+							if (score < best)
+							{
+								best = score;
+								corners[t * 3 + k] = candidate;
+							}
+						}
+					}
+				}
+				AddQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+				locked[collapse.from] = locked[collapse.to] = true;
+				++collapsed;
+			}
+
+			if (collapsed == 0)
+				break;
+		}
+
+		out.clear();
+		out.reserve(liveTriangles * 3);
+		for (unsigned t = 0; t < triangleCount; t++)
+			if (!removed[t])
+				out.insert(out.end(), &corners[t * 3], &corners[t * 3] + 3);
+	}
+
+	/**
+	 * Builds the LOD chain for every mesh of a model. Coarser index ranges are appended to
+	 * model.indices, model.lods[0] mirrors the original mesh draw info.
+	 */
+	inline void BuildLodChain(graphics::MODEL& model)
+	{
+		model.lods.assign(1, std::vector<graphics::BATCH>(model.meshCount));
+		for (unsigned j = 0; j < model.meshCount; j++)
+			model.lods[0][j] = model.meshes[j].drawInfo;
+		if (model.indices.empty())
+			return;
+
+		graphics::VECTOR extent = Subtract(model.bounds.max, model.bounds.min);
+		float radius = std::sqrt(Dot(extent, extent)) * 0.5f;
+
+		std::vector<unsigned> weld;
+		WeldPositions(model.vertices, weld);
+
+		std::vector<unsigned> simplified;
+		for (unsigned lod = 1; lod < MESH_LOD_MAX_COUNT; lod++)
+		{
+			std::vector<graphics::BATCH> batches(model.meshCount);
+			size_t appendStart = model.indices.size();
+			unsigned previousIndices = 0, lodIndices = 0;
+			for (unsigned j = 0; j < model.meshCount; j++)
+			{
+				const graphics::BATCH& original = model.meshes[j].drawInfo;
+				const graphics::BATCH& previous = model.lods[lod - 1][j];
+				previousIndices += previous.indexCount;
+
+				unsigned target = (unsigned)(original.indexCount * std::pow(MESH_LOD_REDUCTION, (float)lod)) / 3 * 3;
+				if (previous.indexCount <= MESH_LOD_MIN_TRIANGLES * 3 || target >= previous.indexCount)
+				{
+					batches[j] = previous;
+					lodIndices += previous.indexCount;
+					continue;
+				}
+				target = std::max(target, (unsigned)MESH_LOD_MIN_TRIANGLES * 3);
+
+				Simplify(model.vertices, weld, &model.indices[original.indexOffset], original.indexCount, target,
+					MESH_LOD_MAX_ERROR * (float)(1u << (lod - 1)) * radius, simplified);
+				if (simplified.size() >= previous.indexCount)
+				{
+					batches[j] = previous;
+					lodIndices += previous.indexCount;
+					continue;
+				}
+
+				batches[j] = { (unsigned)simplified.size(), (unsigned)model.indices.size() };
+				model.indices.insert(model.indices.end(), simplified.begin(), simplified.end());
+				lodIndices += (unsigned)simplified.size();
+			}
+
+			if (lodIndices > previousIndices * (1.0f - MESH_LOD_MIN_SAVINGS))
+			{
+				// Not worth another level, drop whatever this one appended
+				model.indices.resize(appendStart);
+				break;
+			}
+			model.lods.push_back(batches);
+		}
+	}
+
+	// Picks a LOD from the bounding sphere's projected size, projection.data[5] is cot(fov / 2)
+	inline unsigned SelectLod(const graphics::AABB& bounds, const GW::MATH::GMATRIXF& view,
+		const GW::MATH::GMATRIXF& projection, unsigned lodCount)
+	{
+		if (lodCount <= 1)
+			return 0;
+
+		graphics::VECTOR extent = Subtract(bounds.max, bounds.min);
+		float radius = std::sqrt(Dot(extent, extent)) * 0.5f;
+		GW::MATH::GVECTORF center = Culling::TransformPoint(view,
+			(bounds.min.x + bounds.max.x) * 0.5f, (bounds.min.y + bounds.max.y) * 0.5f, (bounds.min.z + bounds.max.z) * 0.5f);
+		if (center.z <= radius)
+			return 0;
+
+		float screenSize = radius * projection.data[5] / center.z;
+		unsigned lod = 0;
+		float threshold = MESH_LOD_SCREEN_SIZE;
+		while (lod + 1 < lodCount && screenSize < threshold)
+		{
+			++lod;
+			threshold *= 0.5f;
+		}
+		return lod;
+	}
+}
+
+#endif
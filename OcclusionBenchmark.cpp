@@ -0,0 +1,149 @@
+// Standalone benchmark for the software occlusion culler, runs without a window or Vulkan device
+// Usage: Occlusion_Benchmark <level file> [frames] [worker threads]
+#define GATEWARE_ENABLE_CORE // All libraries need this
+#define GATEWARE_ENABLE_SYSTEM // LevelSelector uses GFile through the h2b parser
+#define GATEWARE_ENABLE_MATH
+#include "../Gateware/Gateware/Gateware.h"
+#include "SoftwareOcclusion.h"
+#include "MeshLod.h"
+#include "LevelSelector.h"
+#include <chrono>
+#include <cstdlib>
+
+struct TIMINGS
+{
+	double total = 0.0;
+	double min = DBL_MAX;
+	double max = 0.0;
+
+	void Add(double ms)
+	{
+		total += ms;
+		min = std::min(min, ms);
+		max = std::max(max, ms);
+	}
+};
+
+static double ElapsedMs(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static void PrintTimings(const char* label, const TIMINGS& timings, unsigned frames)
+{
+	std::cout << label << " - avg: " << timings.total / frames << "ms | min: " << timings.min
+		<< "ms | max: " << timings.max << "ms\n";
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: Occlusion_Benchmark <level file> [frames] [worker threads]\n";
+		return 1;
+	}
+
+	std::string levelPath = argv[1];
+	unsigned frames = argc > 2 ? (unsigned)std::max(atoi(argv[2]), 1) : 1000;
+	unsigned workerCount = argc > 3 ? (unsigned)std::max(atoi(argv[3]), 0) : 0;
+
+	LevelSelector::Parser parser;
+	if (parser.ParseGameLevel(levelPath) != LevelSelector::OK)
+	{
+		std::cerr << "ERROR: Unable to parse level \"" << levelPath << "\"!\n";
+		return 1;
+	}
+
+	// Same bounds setup as Renderer::ChangeLevel
+	std::vector<graphics::MODEL> models = parser.ModelsToVector();
+	graphics::AABB levelBounds = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+	unsigned totalInstances = 0;
+	for (graphics::MODEL& obj : models)
+	{
+		obj.bounds = Culling::ComputeBounds(obj.vertices);
+		obj.instanceBounds.resize(obj.worldMatrices.size());
+		for (int i = 0; i < obj.worldMatrices.size(); i++)
+		{
+			obj.instanceBounds[i] = Culling::TransformBounds(obj.bounds, obj.worldMatrices[i]);
+			levelBounds.min.x = std::min(levelBounds.min.x, obj.instanceBounds[i].min.x);
+			levelBounds.min.y = std::min(levelBounds.min.y, obj.instanceBounds[i].min.y);
+			levelBounds.min.z = std::min(levelBounds.min.z, obj.instanceBounds[i].min.z);
+			levelBounds.max.x = std::max(levelBounds.max.x, obj.instanceBounds[i].max.x);
+			levelBounds.max.y = std::max(levelBounds.max.y, obj.instanceBounds[i].max.y);
+			levelBounds.max.z = std::max(levelBounds.max.z, obj.instanceBounds[i].max.z);
+		}
+		totalInstances += obj.instanceCount;
+
+		// Occluders rasterize the coarsest LOD, same as in the renderer
+		MeshLod::BuildLodChain(obj);
+	}
+	if (totalInstances == 0)
+	{
+		std::cerr << "ERROR: Level \"" << levelPath << "\" has no instances!\n";
+		return 1;
+	}
+
+	SoftwareOcclusion occlusion;
+	occlusion.Start(workerCount);
+	occlusion.SelectOccluders(models);
+
+	std::cout << "Level: " << levelPath << " | models: " << models.size() << " | instances: " << totalInstances
+		<< " | occluders: " << occlusion.GetOccluders().size() << " | workers: " << occlusion.GetWorkerCount()
+		<< " | frames: " << frames << "\n";
+
+	// Camera walks a circle inside the level looking outward, at roughly eye height
+	GW::MATH::GVECTORF center = {
+		(levelBounds.min.x + levelBounds.max.x) * 0.5f,
+		levelBounds.min.y + (levelBounds.max.y - levelBounds.min.y) * 0.25f,
+		(levelBounds.min.z + levelBounds.max.z) * 0.5f, 1.0f };
+	float radius = std::max(levelBounds.max.x - levelBounds.min.x, levelBounds.max.z - levelBounds.min.z) * 0.25f;
+
+	GW::MATH::GMATRIXF projection;
+	GW::MATH::GMatrix::ProjectionDirectXLHF(G_DEGREE_TO_RADIAN(90), 800.0f / 600.0f, 0.1f, 1000.0f, projection);
+
+	TIMINGS rasterTimings, testTimings;
+	unsigned long long occluderTriangles = 0, frustumRejected = 0, occlusionRejected = 0;
+	for (unsigned frame = 0; frame < frames; frame++)
+	{
+		float angle = G_PI * 2.0f * frame / frames;
+		GW::MATH::GVECTORF eye = { center.x + std::cos(angle) * radius, center.y, center.z + std::sin(angle) * radius, 1.0f };
+		GW::MATH::GVECTORF at = { eye.x + std::cos(angle), eye.y, eye.z + std::sin(angle), 1.0f };
+		GW::MATH::GVECTORF up = { 0.0f, 1.0f, 0.0f, 0.0f };
+
+		GW::MATH::GMATRIXF view, viewProjection;
+		GW::MATH::GMatrix::LookAtLHF(eye, at, up, view);
+		GW::MATH::GMatrix::MultiplyMatrixF(view, projection, viewProjection);
+
+		Culling::FRUSTUM frustum;
+		Culling::ExtractFrustum(viewProjection, frustum);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		occlusion.Render(models, viewProjection, frustum);
+		rasterTimings.Add(ElapsedMs(start));
+		occluderTriangles += occlusion.GetStats().trianglesRendered;
+
+		start = std::chrono::high_resolution_clock::now();
+		for (const graphics::MODEL& obj : models)
+		{
+			for (unsigned int j = 0; j < obj.instanceCount; j++)
+			{
+				if (!Culling::IsAABBInFrustum(frustum, obj.instanceBounds[j]))
+					++frustumRejected;
+				else if (occlusion.IsOccluded(obj.instanceBounds[j], viewProjection))
+					++occlusionRejected;
+			}
+		}
+		testTimings.Add(ElapsedMs(start));
+	}
+
+	occlusion.Stop();
+
+	PrintTimings("Occluder raster", rasterTimings, frames);
+	PrintTimings("Instance tests ", testTimings, frames);
+	std::cout << "Per frame - occluder triangles: " << occluderTriangles / frames
+		<< " | frustum rejected: " << (double)frustumRejected / frames
+		<< " | occlusion rejected: " << (double)occlusionRejected / frames
+		<< " of " << totalInstances << " instances\n";
+
+	return 0;
+}
@@ -0,0 +1,469 @@
+#ifndef _OFFSCREENSURFACE_H_
+#define _OFFSCREENSURFACE_H_
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include "VulkanHelpers.h"
+
+// Same attachments as the window's surface so the renderer's pipelines need no changes
+#define OFFSCREEN_COLOR_FORMAT VK_FORMAT_B8G8R8A8_UNORM
+#define OFFSCREEN_DEPTH_FORMAT VK_FORMAT_D32_SFLOAT
+#define OFFSCREEN_FRAME_COUNT 2 // command buffers, the renderer's FrameRing paces the CPU on top
+
+/**
+ * Stand-in for GVulkanSurface with no window or swapchain, for headless benchmarks & golden images.
+ * Owns its own instance (no surface extensions, so any implementation works, lavapipe included),
+ * device, command pool & a color + depth target drawn by one render pass like the surface's.
+ * StartFrame begins the next command buffer & the pass, EndFrame ends & submits it. A frame ended
+ * with a capture path copies the color target to host memory, waits for it & writes a PPM.
+ */
+class OffscreenSurface
+{
+	VkInstance instance = nullptr;
+	VkPhysicalDevice physicalDevice = nullptr;
+	VkPhysicalDeviceFeatures enabledFeatures = {};
+	bool hostQueryReset = false; // VK_EXT_host_query_reset enabled, the profiler resets its queries on the host
+	VkDevice device = nullptr;
+	VkQueue queue = nullptr;
+	VkCommandPool commandPool = nullptr;
+	unsigned width = 0, height = 0;
+
+	VkImage colorImage = nullptr;
+	VkDeviceMemory colorMemory = nullptr;
+	VkImageView colorView = nullptr;
+	VkImage depthImage = nullptr;
+	VkDeviceMemory depthMemory = nullptr;
+	VkImageView depthView = nullptr;
+	VkRenderPass renderPass = nullptr;
+	VkFramebuffer framebuffer = nullptr;
+
+	std::vector<VkCommandBuffer> commandBuffers;
+	std::vector<VkFence> fences;
+	unsigned current = 0;
+
+	// Tightly packed BGRA copy of the color target
+	VkBuffer readbackBuffer = nullptr;
+	VkDeviceMemory readbackMemory = nullptr;
+	void* readbackMapped = nullptr;
+
+public:
+	bool Create(unsigned _width, unsigned _height, unsigned layerCount = 0, const char* const* layers = nullptr)
+	{
+		width = _width;
+		height = _height;
+		if (!CreateDevice(layerCount, layers))
+		{
+			std::cerr << "ERROR: OffscreenSurface - Unable to create a Vulkan device!\n";
+			return false;
+		}
+		if (!CreateTargets())
+		{
+			std::cerr << "ERROR: OffscreenSurface - Unable to create the " << width << "x" << height << " render targets!\n";
+			return false;
+		}
+		if (!CreateFrames())
+		{
+			std::cerr << "ERROR: OffscreenSurface - Unable to create command buffers!\n";
+			return false;
+		}
+		return true;
+	}
+
+	// Waits for the frame that last used the next command buffer, then records into it inside the pass
+	bool StartFrame(unsigned clearCount, const VkClearValue* clearValues)
+	{
+		current = (current + 1) % commandBuffers.size();
+		vkWaitForFences(device, 1, &fences[current], VK_TRUE, UINT64_MAX);
+		vkResetFences(device, 1, &fences[current]);
+
+		VkCommandBuffer commandBuffer = commandBuffers[current];
+		vkResetCommandBuffer(commandBuffer, 0);
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VkResult::VK_SUCCESS)
+			return false;
+
+		VkRenderPassBeginInfo passInfo = {};
+		passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		passInfo.renderPass = renderPass;
+		passInfo.framebuffer = framebuffer;
+		passInfo.renderArea = { { 0, 0 }, { width, height } };
+		passInfo.clearValueCount = clearCount;
+		passInfo.pClearValues = clearValues;
+		vkCmdBeginRenderPass(commandBuffer, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+		return true;
+	}
+
+	// capturePath stalls until the frame is done & writes it as a binary PPM
+	bool EndFrame(const char* capturePath = nullptr)
+	{
+		VkCommandBuffer commandBuffer = commandBuffers[current];
+		vkCmdEndRenderPass(commandBuffer);
+		if (capturePath != nullptr)
+			RecordReadback(commandBuffer);
+		vkEndCommandBuffer(commandBuffer);
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		if (vkQueueSubmit(queue, 1, &submitInfo, fences[current]) != VkResult::VK_SUCCESS)
+		{
+			std::cerr << "ERROR: OffscreenSurface - Unable to submit the frame!\n";
+			return false;
+		}
+		if (capturePath == nullptr)
+			return true;
+
+		vkWaitForFences(device, 1, &fences[current], VK_TRUE, UINT64_MAX);
+		return WritePpm(capturePath);
+	}
+
+	inline VkInstance GetInstance() const { return instance; }
+	inline VkPhysicalDevice GetPhysicalDevice() const { return physicalDevice; }
+	inline const VkPhysicalDeviceFeatures& GetEnabledFeatures() const { return enabledFeatures; }
+	inline bool HasHostQueryReset() const { return hostQueryReset; }
+	inline VkDevice GetDevice() const { return device; }
+	inline VkQueue GetGraphicsQueue() const { return queue; }
+	inline VkCommandPool GetCommandPool() const { return commandPool; }
+	inline VkRenderPass GetRenderPass() const { return renderPass; }
+	inline VkCommandBuffer GetCommandBuffer() const { return commandBuffers[current]; }
+	inline unsigned GetWidth() const { return width; }
+	inline unsigned GetHeight() const { return height; }
+	inline float GetAspectRatio() const { return width / (float)height; }
+
+	void Destroy()
+	{
+		if (device != nullptr)
+		{
+			vkDeviceWaitIdle(device);
+			for (VkFence fence : fences)
+				vkDestroyFence(device, fence, nullptr);
+			if (!commandBuffers.empty())
+				vkFreeCommandBuffers(device, commandPool, (uint32_t)commandBuffers.size(), commandBuffers.data());
+			vkDestroyCommandPool(device, commandPool, nullptr);
+
+			if (readbackMapped != nullptr)
+				vkUnmapMemory(device, readbackMemory);
+			vkDestroyBuffer(device, readbackBuffer, nullptr);
+			vkFreeMemory(device, readbackMemory, nullptr);
+
+			vkDestroyFramebuffer(device, framebuffer, nullptr);
+			vkDestroyRenderPass(device, renderPass, nullptr);
+			vkDestroyImageView(device, depthView, nullptr);
+			vkDestroyImage(device, depthImage, nullptr);
+			vkFreeMemory(device, depthMemory, nullptr);
+			vkDestroyImageView(device, colorView, nullptr);
+			vkDestroyImage(device, colorImage, nullptr);
+			vkFreeMemory(device, colorMemory, nullptr);
+			vkDestroyDevice(device, nullptr);
+		}
+		if (instance != nullptr)
+			vkDestroyInstance(instance, nullptr);
+
+		*this = OffscreenSurface();
+	}
+
+private:
+	bool CreateDevice(unsigned layerCount, const char* const* layers)
+	{
+		// 1.1 for vkGetPhysicalDeviceMemoryProperties2 (texture budget)
+		VkApplicationInfo appInfo = {};
+		appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+		appInfo.pApplicationName = "Level Renderer (headless)";
+		appInfo.apiVersion = VK_API_VERSION_1_1;
+
+		// Same as the window path: debug utils labels the profiler's scopes when the loader has it
+		std::vector<const char*> extensions;
+		if (VkUtils::SupportsInstanceExtension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME))
+			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+
+		VkInstanceCreateInfo instanceInfo = {};
+		instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+		instanceInfo.pApplicationInfo = &appInfo;
+		instanceInfo.enabledLayerCount = layerCount;
+		instanceInfo.ppEnabledLayerNames = layers;
+		instanceInfo.enabledExtensionCount = (uint32_t)extensions.size();
+		instanceInfo.ppEnabledExtensionNames = extensions.data();
+		if (vkCreateInstance(&instanceInfo, nullptr, &instance) != VkResult::VK_SUCCESS)
+		{
+			// Validation layers are optional, retry without them
+			if (layerCount == 0)
+				return false;
+			instanceInfo.enabledLayerCount = 0;
+			if (vkCreateInstance(&instanceInfo, nullptr, &instance) != VkResult::VK_SUCCESS)
+				return false;
+		}
+
+		// Discrete before integrated before anything else (CPU implementations like lavapipe last)
+		uint32_t deviceCount = 0;
+		vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+		std::vector<VkPhysicalDevice> devices(deviceCount);
+		vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+		uint32_t queueFamily = 0;
+		int bestRank = -1;
+		for (VkPhysicalDevice candidate : devices)
+		{
+			uint32_t family;
+			if (!FindGraphicsQueue(candidate, family))
+				continue;
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(candidate, &properties);
+			int rank = properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ? 3
+				: properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ? 2
+				: properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU ? 0 : 1;
+			if (rank > bestRank)
+			{
+				bestRank = rank;
+				physicalDevice = candidate;
+				queueFamily = family;
+			}
+		}
+		if (physicalDevice == nullptr)
+			return false;
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		std::cout << "Headless device: " << properties.deviceName << "\n";
+
+		// Everything the device has, texture format selection picks from what is enabled here
+		vkGetPhysicalDeviceFeatures(physicalDevice, &enabledFeatures);
+		std::vector<const char*> deviceExtensions;
+		if (VkUtils::SupportsDeviceExtension(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+			deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		VkPhysicalDeviceHostQueryResetFeaturesEXT queryResetFeatures = {};
+		queryResetFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES_EXT;
+		if (VkUtils::SupportsDeviceExtension(physicalDevice, VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME))
+		{
+			VkPhysicalDeviceFeatures2 features2 = {};
+			features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+			features2.pNext = &queryResetFeatures;
+			vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+			hostQueryReset = queryResetFeatures.hostQueryReset == VK_TRUE;
+			if (hostQueryReset)
+				deviceExtensions.push_back(VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME);
+		}
+
+		float priority = 1.0f;
+		VkDeviceQueueCreateInfo queueInfo = {};
+		queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		queueInfo.queueFamilyIndex = queueFamily;
+		queueInfo.queueCount = 1;
+		queueInfo.pQueuePriorities = &priority;
+
+		VkDeviceCreateInfo deviceInfo = {};
+		deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		deviceInfo.queueCreateInfoCount = 1;
+		deviceInfo.pQueueCreateInfos = &queueInfo;
+		deviceInfo.enabledExtensionCount = (uint32_t)deviceExtensions.size();
+		deviceInfo.ppEnabledExtensionNames = deviceExtensions.data();
+		deviceInfo.pEnabledFeatures = &enabledFeatures;
+		deviceInfo.pNext = hostQueryReset ? &queryResetFeatures : nullptr;
+		if (vkCreateDevice(physicalDevice, &deviceInfo, nullptr, &device) != VkResult::VK_SUCCESS)
+			return false;
+		vkGetDeviceQueue(device, queueFamily, 0, &queue);
+
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		poolInfo.queueFamilyIndex = queueFamily;
+		return vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) == VkResult::VK_SUCCESS;
+	}
+
+	static bool FindGraphicsQueue(VkPhysicalDevice candidate, uint32_t& family)
+	{
+		uint32_t count = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(candidate, &count, nullptr);
+		std::vector<VkQueueFamilyProperties> families(count);
+		vkGetPhysicalDeviceQueueFamilyProperties(candidate, &count, families.data());
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			{
+				family = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool CreateTargets()
+	{
+		if (VkUtils::CreateImage(device, physicalDevice, width, height, 1, OFFSCREEN_COLOR_FORMAT,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+			&colorImage, &colorMemory) != VkResult::VK_SUCCESS)
+			return false;
+		if (VkUtils::CreateImageView(device, colorImage, OFFSCREEN_COLOR_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT,
+			0, 1, &colorView) != VkResult::VK_SUCCESS)
+			return false;
+		if (VkUtils::CreateImage(device, physicalDevice, width, height, 1, OFFSCREEN_DEPTH_FORMAT,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, &depthImage, &depthMemory) != VkResult::VK_SUCCESS)
+			return false;
+		if (VkUtils::CreateImageView(device, depthImage, OFFSCREEN_DEPTH_FORMAT, VK_IMAGE_ASPECT_DEPTH_BIT,
+			0, 1, &depthView) != VkResult::VK_SUCCESS)
+			return false;
+
+		// Color is left ready to copy out, the copy (if any) is recorded after the pass
+		VkAttachmentDescription attachments[2] = {};
+		attachments[0].format = OFFSCREEN_COLOR_FORMAT;
+		attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachments[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		attachments[1].format = OFFSCREEN_DEPTH_FORMAT;
+		attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		VkAttachmentReference depthReference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+		VkSubpassDescription subpass = {};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = 1;
+		subpass.pColorAttachments = &colorReference;
+		subpass.pDepthStencilAttachment = &depthReference;
+
+		// Every frame reuses the targets: the previous frame's writes & copy finish before this one clears
+		VkSubpassDependency dependencies[2] = {};
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT
+			| VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependencies[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+			| VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+			| VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependencies[1].srcSubpass = 0;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+		VkRenderPassCreateInfo passInfo = {};
+		passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		passInfo.attachmentCount = 2;
+		passInfo.pAttachments = attachments;
+		passInfo.subpassCount = 1;
+		passInfo.pSubpasses = &subpass;
+		passInfo.dependencyCount = 2;
+		passInfo.pDependencies = dependencies;
+		if (vkCreateRenderPass(device, &passInfo, nullptr, &renderPass) != VkResult::VK_SUCCESS)
+			return false;
+
+		VkImageView views[2] = { colorView, depthView };
+		VkFramebufferCreateInfo framebufferInfo = {};
+		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferInfo.renderPass = renderPass;
+		framebufferInfo.attachmentCount = 2;
+		framebufferInfo.pAttachments = views;
+		framebufferInfo.width = width;
+		framebufferInfo.height = height;
+		framebufferInfo.layers = 1;
+		if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffer) != VkResult::VK_SUCCESS)
+			return false;
+
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = (VkDeviceSize)width * height * 4;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if (vkCreateBuffer(device, &bufferInfo, nullptr, &readbackBuffer) != VkResult::VK_SUCCESS)
+			return false;
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(device, readbackBuffer, &requirements);
+		VkMemoryAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocateInfo.allocationSize = requirements.size;
+		if (!VkUtils::FindMemoryType(physicalDevice, requirements.memoryTypeBits,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, allocateInfo.memoryTypeIndex))
+			return false;
+		if (vkAllocateMemory(device, &allocateInfo, nullptr, &readbackMemory) != VkResult::VK_SUCCESS)
+			return false;
+		vkBindBufferMemory(device, readbackBuffer, readbackMemory, 0);
+		return vkMapMemory(device, readbackMemory, 0, VK_WHOLE_SIZE, 0, &readbackMapped) == VkResult::VK_SUCCESS;
+	}
+
+	bool CreateFrames()
+	{
+		commandBuffers.resize(OFFSCREEN_FRAME_COUNT);
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.commandPool = commandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = OFFSCREEN_FRAME_COUNT;
+		if (vkAllocateCommandBuffers(device, &allocateInfo, commandBuffers.data()) != VkResult::VK_SUCCESS)
+		{
+			commandBuffers.clear();
+			return false;
+		}
+
+		// Signalled so the first StartFrame of each buffer doesn't wait
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		fences.assign(OFFSCREEN_FRAME_COUNT, nullptr);
+		for (VkFence& fence : fences)
+			if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VkResult::VK_SUCCESS)
+				return false;
+		return true;
+	}
+
+	void RecordReadback(VkCommandBuffer commandBuffer)
+	{
+		VkBufferImageCopy region = {};
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.imageExtent = { width, height, 1 };
+		vkCmdCopyImageToBuffer(commandBuffer, colorImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+
+		VkBufferMemoryBarrier hostBarrier = {};
+		hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		hostBarrier.buffer = readbackBuffer;
+		hostBarrier.offset = 0;
+		hostBarrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+			0, 0, nullptr, 1, &hostBarrier, 0, nullptr);
+	}
+
+	// BGRA in the readback buffer, RGB in the file
+	bool WritePpm(const char* path) const
+	{
+		std::ofstream file(path, std::ios::binary);
+		if (!file.is_open())
+		{
+			std::cerr << "ERROR: OffscreenSurface - Unable to write \"" << path << "\"!\n";
+			return false;
+		}
+		file << "P6\n" << width << " " << height << "\n255\n";
+		const unsigned char* pixels = (const unsigned char*)readbackMapped;
+		std::vector<unsigned char> row(width * 3);
+		for (unsigned y = 0; y < height; y++)
+		{
+			for (unsigned x = 0; x < width; x++)
+			{
+				const unsigned char* pixel = pixels + ((size_t)y * width + x) * 4;
+				row[x * 3 + 0] = pixel[2];
+				row[x * 3 + 1] = pixel[1];
+				row[x * 3 + 2] = pixel[0];
+			}
+			file.write((const char*)row.data(), row.size());
+		}
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef _PIPELINECACHE_H_
+#define _PIPELINECACHE_H_
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#ifdef _WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h> // MoveFileExA
+#endif
+
+/**
+ * VkPipelineCache persisted between runs.
+ * The file is only handed to the driver when its header matches this device (vendor, device &
+ * pipeline cache UUID), otherwise the cache starts empty. Saving writes a temporary file next to
+ * the cache and renames it over the old one so a crash mid-write never leaves a truncated cache.
+ */
+class PipelineCache
+{
+	VkDevice device = nullptr;
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	std::string path;
+	bool warm = false;
+
+public:
+	bool Create(VkDevice _device, VkPhysicalDevice physicalDevice, const char* _path)
+	{
+		device = _device;
+		path = _path;
+		warm = false;
+
+		std::vector<char> data;
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (file.is_open())
+		{
+			data.resize((size_t)file.tellg());
+			file.seekg(0);
+			file.read(data.data(), data.size());
+			if (!file)
+				data.clear();
+		}
+
+		if (!data.empty() && !IsCompatible(physicalDevice, data))
+			data.clear();
+
+		VkPipelineCacheCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		createInfo.initialDataSize = data.size();
+		createInfo.pInitialData = data.empty() ? nullptr : data.data();
+		if (vkCreatePipelineCache(device, &createInfo, nullptr, &cache) != VkResult::VK_SUCCESS)
+		{
+			// A driver may still reject data it wrote itself, retry empty before giving up
+			createInfo.initialDataSize = 0;
+			createInfo.pInitialData = nullptr;
+			data.clear();
+			if (vkCreatePipelineCache(device, &createInfo, nullptr, &cache) != VkResult::VK_SUCCESS)
+			{
+				std::cerr << "ERROR: PipelineCache - Unable to create pipeline cache!\n";
+				cache = VK_NULL_HANDLE;
+				return false;
+			}
+		}
+
+		warm = !data.empty();
+		return true;
+	}
+
+	bool Save()
+	{
+		if (cache == VK_NULL_HANDLE)
+			return false;
+
+		size_t size = 0;
+		if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VkResult::VK_SUCCESS || size == 0)
+			return false;
+		std::vector<char> data(size);
+		if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VkResult::VK_SUCCESS)
+			return false;
+
+		std::string tempPath = path + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+			{
+				std::cerr << "ERROR: PipelineCache - Unable to open \"" << tempPath << "\" for writing!\n";
+				return false;
+			}
+			file.write(data.data(), size);
+			file.flush();
+			if (!file)
+			{
+				std::cerr << "ERROR: PipelineCache - Unable to write \"" << tempPath << "\"!\n";
+				file.close();
+				std::remove(tempPath.c_str());
+				return false;
+			}
+		}
+
+#ifdef _WIN32
+		bool replaced = MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		bool replaced = std::rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+		if (!replaced)
+		{
+			std::cerr << "ERROR: PipelineCache - Unable to replace \"" << path << "\"!\n";
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	void Destroy()
+	{
+		if (device != nullptr && cache != VK_NULL_HANDLE)
+			vkDestroyPipelineCache(device, cache, nullptr);
+		cache = VK_NULL_HANDLE;
+		device = nullptr;
+	}
+
+	inline VkPipelineCache Get() const { return cache; }
+	// True when the cache was seeded from a compatible file on disk
+	inline bool IsWarm() const { return warm; }
+
+private:
+	bool IsCompatible(VkPhysicalDevice physicalDevice, const std::vector<char>& data) const
+	{
+		VkPipelineCacheHeaderVersionOne header;
+		if (data.size() < sizeof(header))
+		{
+			std::cout << "PipelineCache - \"" << path << "\" is truncated, starting cold\n";
+			return false;
+		}
+		std::memcpy(&header, data.data(), sizeof(header));
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+		const char* reason = nullptr;
+		if (header.headerSize < sizeof(header) || header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+			reason = "unknown header";
+		else if (header.vendorID != properties.vendorID)
+			reason = "vendor changed";
+		else if (header.deviceID != properties.deviceID)
+			reason = "device changed";
+		else if (std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+			reason = "driver changed";
+
+		if (reason != nullptr)
+		{
+			std::cout << "PipelineCache - \"" << path << "\" rejected (" << reason << "), starting cold\n";
+			return false;
+		}
+		return true;
+	}
+};
+
+#endif
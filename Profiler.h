@@ -0,0 +1,363 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include "VulkanHelpers.h"
+#include "Trace.h"
+
+// Samples kept per timer, min/avg/p99 are over this window
+#define PROFILER_HISTORY 240
+// GPU scopes a single frame may record
+#define PROFILER_MAX_GPU_SCOPES 16
+
+/**
+ * CPU & GPU frame timing.
+ * CPU timers are scoped (Profiler::Scope) & record when they go out of scope. GPU scopes write a
+ * timestamp query on each side of a pass, into the query range of the frame's ring slot (see
+ * FrameRing). The results are read when the slot comes around again, after its fence, so reading
+ * them never waits on the GPU. The range is then reset on the host (VK_EXT_host_query_reset) or by
+ * a command buffer recorded once per slot & resubmitted each frame. Every timer keeps a rolling
+ * window of samples that WriteCsv & WriteJson summarise as min / avg / p99 / max. With
+ * VK_EXT_debug_utils enabled, GPU scopes are also labelled for RenderDoc & the validation layers.
+ */
+class Profiler
+{
+public:
+	struct STATS
+	{
+		float min, avg, p99, max; // milliseconds
+		unsigned samples;
+	};
+
+	// Also a trace event (see Trace.h) while a capture is running
+	class Scope
+	{
+		Profiler& profiler;
+		unsigned timer;
+		std::chrono::high_resolution_clock::time_point start;
+		Trace::Scope trace;
+
+	public:
+		Scope(Profiler& _profiler, const char* name)
+			: profiler(_profiler), timer(_profiler.FindTimer(name, false)),
+			start(std::chrono::high_resolution_clock::now()), trace(name) {}
+		~Scope()
+		{
+			profiler.AddSample(timer, std::chrono::duration<float, std::milli>(
+				std::chrono::high_resolution_clock::now() - start).count());
+		}
+	};
+
+private:
+	struct TIMER
+	{
+		std::string name;
+		bool gpu;
+		std::vector<float> samples; // ring of the last PROFILER_HISTORY
+		unsigned next = 0;
+	};
+
+	struct GPU_SCOPE
+	{
+		unsigned timer;
+		unsigned query; // begin, end is query + 1
+	};
+
+	VkDevice device = nullptr;
+	VkQueue queue = nullptr;
+	VkCommandPool commandPool = nullptr;
+	VkQueryPool queryPool = nullptr;
+	float timestampPeriod = 1.0f; // nanoseconds per tick
+	uint64_t timestampMask = ~0ull;
+	std::vector<std::vector<GPU_SCOPE>> slotScopes; // recorded into each slot's query range
+	std::vector<VkCommandBuffer> resetCommands; // per slot, recorded once
+	PFN_vkResetQueryPoolEXT hostReset = nullptr;
+	std::vector<unsigned> openScopes;
+	unsigned slot = 0;
+	bool slotReset = false; // the frame's queries may be written
+	PFN_vkCmdBeginDebugUtilsLabelEXT beginLabel = nullptr;
+	PFN_vkCmdEndDebugUtilsLabelEXT endLabel = nullptr;
+	std::vector<TIMER> timers;
+	std::chrono::high_resolution_clock::time_point frameStart;
+	bool frameStarted = false;
+	unsigned long long frames = 0;
+
+public:
+	// GPU timing is skipped (CPU timers still work) if the device can't time graphics work
+	bool Create(VkDevice _device, VkPhysicalDevice physicalDevice, VkQueue _queue, VkCommandPool _commandPool,
+		unsigned framesInFlight)
+	{
+		device = _device;
+		queue = _queue;
+		commandPool = _commandPool;
+		slotScopes.assign(framesInFlight, {});
+		resetCommands.assign(framesInFlight, nullptr);
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		if (!properties.limits.timestampComputeAndGraphics)
+		{
+			std::cout << "GPU timing unavailable, timestamps are not supported on graphics queues\n";
+			return true;
+		}
+		timestampPeriod = properties.limits.timestampPeriod;
+
+		// Ticks wrap at timestampValidBits, differences are masked to match
+		uint32_t familyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> families(familyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+		uint32_t validBits = 64;
+		for (const VkQueueFamilyProperties& family : families)
+			if ((family.queueFlags & VK_QUEUE_GRAPHICS_BIT) && family.timestampValidBits > 0)
+				validBits = std::min(validBits, family.timestampValidBits);
+		timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+		VkQueryPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		poolInfo.queryCount = framesInFlight * PROFILER_MAX_GPU_SCOPES * 2;
+		if (vkCreateQueryPool(device, &poolInfo, nullptr, &queryPool) != VkResult::VK_SUCCESS)
+		{
+			std::cerr << "ERROR: Profiler - Unable to create timestamp query pool!\n";
+			queryPool = nullptr;
+			return false;
+		}
+
+		// Queries can't be reset inside the surface's render pass, so each slot's reset is its own submit
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.commandPool = commandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = framesInFlight;
+		if (vkAllocateCommandBuffers(device, &allocateInfo, resetCommands.data()) != VkResult::VK_SUCCESS)
+		{
+			std::cerr << "ERROR: Profiler - Unable to create the query reset command buffers!\n";
+			resetCommands.assign(framesInFlight, nullptr);
+			return false;
+		}
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		for (unsigned i = 0; i < framesInFlight; i++)
+		{
+			vkBeginCommandBuffer(resetCommands[i], &beginInfo);
+			vkCmdResetQueryPool(resetCommands[i], queryPool, i * PROFILER_MAX_GPU_SCOPES * 2, PROFILER_MAX_GPU_SCOPES * 2);
+			vkEndCommandBuffer(resetCommands[i]);
+		}
+		return true;
+	}
+
+	// Call if the device was created with VK_EXT_host_query_reset's hostQueryReset, saves a submit a frame
+	void EnableHostReset()
+	{
+		hostReset = (PFN_vkResetQueryPoolEXT)vkGetDeviceProcAddr(device, "vkResetQueryPoolEXT");
+	}
+
+	// Call with the instance if it was created with VK_EXT_debug_utils
+	void EnableDebugLabels(VkInstance instance)
+	{
+		beginLabel = (PFN_vkCmdBeginDebugUtilsLabelEXT)vkGetInstanceProcAddr(instance, "vkCmdBeginDebugUtilsLabelEXT");
+		endLabel = (PFN_vkCmdEndDebugUtilsLabelEXT)vkGetInstanceProcAddr(instance, "vkCmdEndDebugUtilsLabelEXT");
+		if (beginLabel == nullptr || endLabel == nullptr)
+		{
+			beginLabel = nullptr;
+			endLabel = nullptr;
+		}
+	}
+
+	// Call once the ring slot's fence has been waited on, before any GPU scope of the frame
+	void BeginFrame(unsigned _slot)
+	{
+		slot = _slot;
+		openScopes.clear();
+		slotReset = false;
+		if (queryPool == nullptr)
+			return;
+
+		// The slot's previous frame is done, its timestamps are ready
+		std::vector<GPU_SCOPE>& scopes = slotScopes[slot];
+		if (!scopes.empty())
+		{
+			uint64_t ticks[PROFILER_MAX_GPU_SCOPES * 2];
+			unsigned first = slot * PROFILER_MAX_GPU_SCOPES * 2;
+			unsigned count = (unsigned)scopes.size() * 2;
+			if (vkGetQueryPoolResults(device, queryPool, first, count, sizeof(ticks), ticks, sizeof(uint64_t),
+				VK_QUERY_RESULT_64_BIT) == VkResult::VK_SUCCESS)
+			{
+				for (const GPU_SCOPE& scope : scopes)
+				{
+					uint64_t elapsed = (ticks[scope.query - first + 1] - ticks[scope.query - first]) & timestampMask;
+					AddSample(scope.timer, (float)(elapsed * timestampPeriod / 1000000.0));
+				}
+			}
+			scopes.clear();
+		}
+
+		// The slot's previous reset submit finished before its fence, so the command buffer can go again
+		if (hostReset != nullptr)
+		{
+			hostReset(device, queryPool, slot * PROFILER_MAX_GPU_SCOPES * 2, PROFILER_MAX_GPU_SCOPES * 2);
+			slotReset = true;
+			return;
+		}
+		if (resetCommands[slot] == nullptr)
+			return;
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &resetCommands[slot];
+		slotReset = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) == VkResult::VK_SUCCESS;
+		if (!slotReset)
+			std::cerr << "ERROR: Profiler - Unable to submit the query reset!\n";
+	}
+
+	// Frame to frame CPU time, call once per frame after present
+	void EndFrame()
+	{
+		auto now = std::chrono::high_resolution_clock::now();
+		if (frameStarted)
+			AddSample(FindTimer("Frame", false), std::chrono::duration<float, std::milli>(now - frameStart).count());
+		frameStart = now;
+		frameStarted = true;
+		frames++;
+	}
+
+	// GPU scopes nest, each BeginGpu needs an EndGpu on the same command buffer
+	void BeginGpu(VkCommandBuffer commandBuffer, const char* name)
+	{
+		if (beginLabel != nullptr)
+		{
+			VkDebugUtilsLabelEXT label = {};
+			label.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+			label.pLabelName = name;
+			beginLabel(commandBuffer, &label);
+		}
+
+		std::vector<GPU_SCOPE>& scopes = slotScopes[slot];
+		if (!slotReset || scopes.size() >= PROFILER_MAX_GPU_SCOPES)
+		{
+			openScopes.push_back(~0u);
+			return;
+		}
+		unsigned query = (slot * PROFILER_MAX_GPU_SCOPES + (unsigned)scopes.size()) * 2;
+		openScopes.push_back((unsigned)scopes.size());
+		scopes.push_back({ FindTimer(name, true), query });
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, query);
+	}
+
+	void EndGpu(VkCommandBuffer commandBuffer)
+	{
+		if (openScopes.empty())
+			return;
+		unsigned scope = openScopes.back();
+		openScopes.pop_back();
+		if (scope != ~0u)
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool,
+				slotScopes[slot][scope].query + 1);
+		if (endLabel != nullptr)
+			endLabel(commandBuffer);
+	}
+
+	STATS GetStats(unsigned timer) const
+	{
+		STATS stats = {};
+		std::vector<float> sorted = timers[timer].samples;
+		if (sorted.empty())
+			return stats;
+		std::sort(sorted.begin(), sorted.end());
+		float total = 0;
+		for (float sample : sorted)
+			total += sample;
+		stats.min = sorted.front();
+		stats.max = sorted.back();
+		stats.avg = total / sorted.size();
+		stats.p99 = sorted[std::min((size_t)(sorted.size() * 0.99f), sorted.size() - 1)];
+		stats.samples = (unsigned)sorted.size();
+		return stats;
+	}
+
+	bool WriteCsv(const char* path) const
+	{
+		std::ofstream file(path);
+		if (!file.is_open())
+		{
+			std::cerr << "ERROR: Profiler - Unable to write \"" << path << "\"!\n";
+			return false;
+		}
+		file << "timer,type,min_ms,avg_ms,p99_ms,max_ms,samples\n";
+		for (unsigned i = 0; i < timers.size(); i++)
+		{
+			STATS stats = GetStats(i);
+			file << timers[i].name << "," << (timers[i].gpu ? "gpu" : "cpu") << "," << stats.min << "," << stats.avg
+				<< "," << stats.p99 << "," << stats.max << "," << stats.samples << "\n";
+		}
+		return true;
+	}
+
+	bool WriteJson(const char* path) const
+	{
+		std::ofstream file(path);
+		if (!file.is_open())
+		{
+			std::cerr << "ERROR: Profiler - Unable to write \"" << path << "\"!\n";
+			return false;
+		}
+		file << "{\n\t\"frames\": " << frames << ",\n\t\"timers\": [";
+		for (unsigned i = 0; i < timers.size(); i++)
+		{
+			STATS stats = GetStats(i);
+			file << (i > 0 ? "," : "") << "\n\t\t{ \"name\": \"" << timers[i].name << "\", \"type\": \""
+				<< (timers[i].gpu ? "gpu" : "cpu") << "\", \"min_ms\": " << stats.min << ", \"avg_ms\": " << stats.avg
+				<< ", \"p99_ms\": " << stats.p99 << ", \"max_ms\": " << stats.max << ", \"samples\": " << stats.samples << " }";
+		}
+		file << "\n\t]\n}\n";
+		return true;
+	}
+
+	// Only once the device is idle
+	void Destroy()
+	{
+		for (VkCommandBuffer& commands : resetCommands)
+			if (commands != nullptr)
+				vkFreeCommandBuffers(device, commandPool, 1, &commands);
+		resetCommands.clear();
+		hostReset = nullptr;
+		if (queryPool != nullptr)
+			vkDestroyQueryPool(device, queryPool, nullptr);
+		queryPool = nullptr;
+	}
+
+	inline unsigned GetTimerCount() const { return (unsigned)timers.size(); }
+	inline const std::string& GetTimerName(unsigned timer) const { return timers[timer].name; }
+
+private:
+	unsigned FindTimer(const char* name, bool gpu)
+	{
+		for (unsigned i = 0; i < timers.size(); i++)
+			if (timers[i].gpu == gpu && timers[i].name == name)
+				return i;
+		TIMER timer;
+		timer.name = name;
+		timer.gpu = gpu;
+		timer.samples.reserve(PROFILER_HISTORY);
+		timers.push_back(timer);
+		return (unsigned)timers.size() - 1;
+	}
+
+	void AddSample(unsigned timer, float milliseconds)
+	{
+		TIMER& entry = timers[timer];
+		if (entry.samples.size() < PROFILER_HISTORY)
+			entry.samples.push_back(milliseconds);
+		else
+			entry.samples[entry.next] = milliseconds;
+		entry.next = (entry.next + 1) % PROFILER_HISTORY;
+	}
+};
+
+#endif
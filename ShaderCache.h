@@ -0,0 +1,209 @@
+#ifndef _SHADERCACHE_H_
+#define _SHADERCACHE_H_
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <sys/stat.h>
+#ifdef _WIN32
+	#include <direct.h> // _mkdir
+#endif
+#include "shaderc/shaderc.h"
+#include "../Gateware/Gateware/Gateware.h"
+
+// Written by the build (see CMakeLists.txt) & by the runtime compile cache
+#define SHADER_SPIRV_DIRECTORY "../Shaders/Compiled/"
+
+/**
+ * SPIR-V loading with three tiers, cheapest first:
+ * 1. Shaders/Compiled/<name>.spv produced at build time, used while it is newer than its HLSL.
+ * 2. Shaders/Compiled/<name>.<hash>.spv, keyed on the HLSL contents & compile options.
+ * 3. shaderc, whose output is written back as tier 2. The compiler is only created when needed.
+ */
+class ShaderCache
+{
+public:
+	struct STATS
+	{
+		unsigned prebuilt = 0;
+		unsigned cached = 0;
+		unsigned compiled = 0;
+	};
+
+private:
+	shaderc_compiler_t compiler = nullptr;
+	shaderc_compile_options_t options = nullptr;
+	STATS stats;
+
+public:
+	// Loads shaderPath (HLSL, "main" entry point) into shaderModule, returns false if no SPIR-V could be produced
+	bool Load(VkDevice device, const char* shaderPath, shaderc_shader_kind shaderKind, const char* inputName,
+		const char* errorLabel, VkShaderModule* shaderModule)
+	{
+		std::string name = BaseName(shaderPath);
+		std::string prebuiltPath = std::string(SHADER_SPIRV_DIRECTORY) + name + ".spv";
+		std::vector<char> spirv;
+
+		if (IsNewer(prebuiltPath.c_str(), shaderPath) && ReadFile(prebuiltPath, spirv))
+		{
+			stats.prebuilt++;
+			return CreateModule(device, spirv, shaderModule);
+		}
+
+		std::string source = ShaderSource(shaderPath);
+		if (source.empty())
+			return false;
+
+		char hash[17];
+		snprintf(hash, sizeof(hash), "%016llx", HashSource(source, shaderKind));
+		std::string cachedPath = std::string(SHADER_SPIRV_DIRECTORY) + name + "." + hash + ".spv";
+		if (ReadFile(cachedPath, spirv))
+		{
+			stats.cached++;
+			return CreateModule(device, spirv, shaderModule);
+		}
+
+		if (!Compile(source, shaderKind, inputName, errorLabel, spirv))
+			return false;
+		stats.compiled++;
+		if (!WriteFile(cachedPath, spirv))
+			std::cerr << "ERROR: ShaderCache - Unable to write \"" << cachedPath << "\"!\n";
+		return CreateModule(device, spirv, shaderModule);
+	}
+
+	// Frees the runtime compiler if any shader needed it
+	void Release()
+	{
+		if (options != nullptr)
+			shaderc_compile_options_release(options);
+		if (compiler != nullptr)
+			shaderc_compiler_release(compiler);
+		options = nullptr;
+		compiler = nullptr;
+	}
+
+	inline const STATS& GetStats() const { return stats; }
+
+private:
+	bool Compile(const std::string& source, shaderc_shader_kind shaderKind, const char* inputName,
+		const char* errorLabel, std::vector<char>& spirv)
+	{
+		if (compiler == nullptr)
+		{
+			// Initialize runtime shader compiler HLSL -> SPIRV
+			compiler = shaderc_compiler_initialize();
+			options = shaderc_compile_options_initialize();
+			shaderc_compile_options_set_source_language(options, shaderc_source_language_hlsl);
+			shaderc_compile_options_set_invert_y(options, true);
+#ifndef NDEBUG
+			shaderc_compile_options_set_generate_debug_info(options);
+#endif
+		}
+
+		shaderc_compilation_result_t result = shaderc_compile_into_spv( // compile
+			compiler, source.c_str(), source.length(),
+			shaderKind, inputName, "main", options);
+		bool success = shaderc_result_get_compilation_status(result) == shaderc_compilation_status_success;
+		if (!success) // errors?
+			std::cout << errorLabel << " Errors: " << shaderc_result_get_error_message(result) << std::endl;
+		else
+		{
+			const char* bytes = shaderc_result_get_bytes(result);
+			spirv.assign(bytes, bytes + shaderc_result_get_length(result));
+		}
+		shaderc_result_release(result); // done
+		return success;
+	}
+
+	static bool CreateModule(VkDevice device, std::vector<char>& spirv, VkShaderModule* shaderModule)
+	{
+		// SPIR-V is a stream of 32 bit words
+		if (spirv.empty() || spirv.size() % 4 != 0)
+			return false;
+		return GvkHelper::create_shader_module(device, (unsigned)spirv.size(), spirv.data(), shaderModule) == VkResult::VK_SUCCESS;
+	}
+
+	// FNV-1a over the source plus everything that changes the compiled output
+	static unsigned long long HashSource(const std::string& source, shaderc_shader_kind shaderKind)
+	{
+		unsigned long long hash = 14695981039346656037ull;
+		auto mix = [&hash](const char* bytes, size_t length)
+		{
+			for (size_t i = 0; i < length; i++)
+			{
+				hash ^= (unsigned char)bytes[i];
+				hash *= 1099511628211ull;
+			}
+		};
+		mix(source.data(), source.size());
+		int kind = (int)shaderKind;
+		mix((const char*)&kind, sizeof(kind));
+#ifndef NDEBUG
+		mix("debug", 5);
+#endif
+		return hash;
+	}
+
+	static std::string ShaderSource(const char* shaderPath)
+	{
+		std::vector<char> bytes;
+		if (!ReadFile(shaderPath, bytes))
+		{
+			std::cout << "ERROR: Shader Source File \"" << shaderPath << "\" Not Found!" << std::endl;
+			return std::string();
+		}
+		return std::string(bytes.begin(), bytes.end());
+	}
+
+	// "../Shaders/VertexShader.hlsl" -> "VertexShader"
+	static std::string BaseName(const char* path)
+	{
+		std::string name = path;
+		size_t slash = name.find_last_of("/\\");
+		if (slash != std::string::npos)
+			name = name.substr(slash + 1);
+		size_t dot = name.find_last_of('.');
+		if (dot != std::string::npos)
+			name = name.substr(0, dot);
+		return name;
+	}
+
+	// True when path exists & was modified no earlier than reference
+	static bool IsNewer(const char* path, const char* reference)
+	{
+		struct stat pathInfo, referenceInfo;
+		if (stat(path, &pathInfo) != 0)
+			return false;
+		if (stat(reference, &referenceInfo) != 0)
+			return true; // no source to be stale against
+		return pathInfo.st_mtime >= referenceInfo.st_mtime;
+	}
+
+	static bool ReadFile(const std::string& path, std::vector<char>& bytes)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			return false;
+		bytes.resize((size_t)file.tellg());
+		file.seekg(0);
+		file.read(bytes.data(), bytes.size());
+		return !bytes.empty() && file.good();
+	}
+
+	static bool WriteFile(const std::string& path, const std::vector<char>& bytes)
+	{
+#ifdef _WIN32
+		_mkdir(SHADER_SPIRV_DIRECTORY);
+#else
+		mkdir(SHADER_SPIRV_DIRECTORY, 0755);
+#endif
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return false;
+		file.write(bytes.data(), bytes.size());
+		return file.good();
+	}
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef _SHADERWATCHER_H_
+#define _SHADERWATCHER_H_
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <string>
+#include <ctime>
+#include <sys/stat.h>
+#include "Trace.h"
+
+#define SHADER_WATCH_INTERVAL_MS 500
+
+/**
+ * Polls a set of shader sources on its own thread and runs a callback (on that thread) after any
+ * of them is saved. A change is only reported once the file time has held still for one interval,
+ * so editors that write in several steps trigger a single reload.
+ */
+class ShaderWatcher
+{
+	std::thread thread;
+	std::mutex stopMutex;
+	std::condition_variable stopSignal;
+	bool stopping = false;
+	std::vector<std::string> paths;
+	std::vector<time_t> modifiedTimes;
+	std::function<void()> onChange;
+
+public:
+	~ShaderWatcher()
+	{
+		Stop();
+	}
+
+	void Start(const std::vector<std::string>& _paths, std::function<void()> _onChange)
+	{
+		Stop();
+		paths = _paths;
+		onChange = std::move(_onChange);
+		modifiedTimes.resize(paths.size());
+		for (unsigned i = 0; i < paths.size(); i++)
+			modifiedTimes[i] = ModifiedTime(paths[i]);
+
+		stopping = false;
+		thread = std::thread([this]() { WatchLoop(); });
+	}
+
+	// Joins the watcher, waiting for a callback that is already running
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(stopMutex);
+			stopping = true;
+		}
+		stopSignal.notify_all();
+		if (thread.joinable())
+			thread.join();
+	}
+
+private:
+	void WatchLoop()
+	{
+		Trace::SetThreadName("Shader watcher");
+		bool pending = false;
+		while (!Wait())
+		{
+			bool changed = false;
+			for (unsigned i = 0; i < paths.size(); i++)
+			{
+				time_t modified = ModifiedTime(paths[i]);
+				if (modified != modifiedTimes[i])
+				{
+					modifiedTimes[i] = modified;
+					changed = true;
+				}
+			}
+
+			// Fire on the first quiet interval after a change
+			if (changed)
+				pending = true;
+			else if (pending)
+			{
+				pending = false;
+				onChange();
+			}
+		}
+	}
+
+	// Sleeps one interval, returns true when asked to stop
+	bool Wait()
+	{
+		std::unique_lock<std::mutex> lock(stopMutex);
+		return stopSignal.wait_for(lock, std::chrono::milliseconds(SHADER_WATCH_INTERVAL_MS),
+			[this]() { return stopping; });
+	}
+
+	static time_t ModifiedTime(const std::string& path)
+	{
+		struct stat info;
+		return stat(path.c_str(), &info) == 0 ? info.st_mtime : 0;
+	}
+};
+
+#endif
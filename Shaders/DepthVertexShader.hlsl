@@ -0,0 +1,45 @@
+#pragma pack_matrix(row_major)
+// depth only vertex shader, used when no pixel shading is needed (occlusion & depth passes)
+#define MAX_INSTANCE_PER_DRAW 1024
+struct OBJ_ATTRIBUTES
+{
+    float3 Kd; // diffuse reflectivity
+    float d; // dissolve (transparency) 
+    float3 Ks; // specular reflectivity
+    float Ns; // specular exponent
+    float3 Ka; // ambient reflectivity
+    float sharpness; // local reflection map sharpness
+    float3 Tf; // transmission filter
+    float Ni; // optical density (index of refraction)
+    float3 Ke; // emissive reflectivity
+    int illum; // illumination model
+};
+
+struct SHADER_MODEL_DATA
+{
+    float4 lightDirection;
+    float4 lightColor;
+    float4 ambientColor;
+    float4 cameraPos;
+    matrix viewMatrix;
+    matrix projectionMatrix;
+    matrix matrices[MAX_INSTANCE_PER_DRAW];
+    OBJ_ATTRIBUTES materials[MAX_INSTANCE_PER_DRAW];
+};
+
+[[vk::binding(0, 0)]]
+StructuredBuffer<SHADER_MODEL_DATA> SceneData;
+
+[[vk::push_constant]]
+cbuffer MESH_INDEX
+{
+    uint material_offset;
+    uint matrix_offset;
+};
+
+float4 main(float3 Position : POSITION, uint InstanceID : SV_InstanceID) : SV_POSITION
+{
+    // must match the position math in VertexShader.hlsl exactly (see depth pre-pass)
+    precise float4 posH = mul(mul(mul(float4(Position, 1), SceneData[0].matrices[matrix_offset + InstanceID]), SceneData[0].viewMatrix), SceneData[0].projectionMatrix);
+    return posH;
+}
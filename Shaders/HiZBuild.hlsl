@@ -0,0 +1,32 @@
+// builds one level of the HiZ pyramid, every texel keeps the farthest depth of the 2x2 block below it
+#define HIZ_GROUP_SIZE 8
+
+[[vk::binding(0, 0)]]
+Texture2D<float> srcDepth;
+[[vk::binding(1, 0)]]
+[[vk::image_format("r32f")]]
+RWTexture2D<float> dstDepth;
+
+[[vk::push_constant]]
+cbuffer HIZ_LEVEL
+{
+    uint2 srcSize;
+    uint2 dstSize;
+};
+
+[numthreads(HIZ_GROUP_SIZE, HIZ_GROUP_SIZE, 1)]
+void main(uint3 threadID : SV_DispatchThreadID)
+{
+    if (threadID.x >= dstSize.x || threadID.y >= dstSize.y)
+        return;
+
+    // Clamp so odd sized levels still cover their last row/column
+    uint2 srcCoord = threadID.xy * 2;
+    uint2 maxCoord = srcSize - 1;
+    float d0 = srcDepth.Load(int3(min(srcCoord, maxCoord), 0));
+    float d1 = srcDepth.Load(int3(min(srcCoord + uint2(1, 0), maxCoord), 0));
+    float d2 = srcDepth.Load(int3(min(srcCoord + uint2(0, 1), maxCoord), 0));
+    float d3 = srcDepth.Load(int3(min(srcCoord + uint2(1, 1), maxCoord), 0));
+
+    dstDepth[threadID.xy] = max(max(d0, d1), max(d2, d3));
+}
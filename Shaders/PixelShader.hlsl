@@ -37,6 +37,9 @@ cbuffer MESH_INDEX
 {
     uint material_offset;
     uint matrix_offset;
+    uint diffuse_layer; // every map is a texture array, single textures are layer 0 of their own
+    uint specular_layer;
+    uint normal_layer;
 };
 // an ultra simple hlsl pixel shader
 struct PS_INPUT
@@ -54,18 +57,23 @@ StructuredBuffer<SHADER_MODEL_DATA> SceneData;
 //StructuredBuffer<PIXEL_SHADER_DATA> SceneData;
 
 [[vk::binding(0, 1)]]
-Texture2D diffuseMap;
+Texture2DArray diffuseMap;
 [[vk::binding(0, 1)]]
 SamplerState qualityFilter;
 [[vk::binding(0, 2)]]
-Texture2D specularMap;
+Texture2DArray specularMap;
 [[vk::binding(0, 2)]]
 SamplerState specQualityFilter;
 [[vk::binding(0, 3)]]
-Texture2D normalMap;
+Texture2DArray normalMap;
 [[vk::binding(0, 3)]]
 SamplerState normQualityFilter;
 
+// Which maps the material really has, set per pipeline variant so unused sampling & math compile out
+[[vk::constant_id(0)]] const bool HAS_DIFFUSE_MAP = true;
+[[vk::constant_id(1)]] const bool HAS_SPECULAR_MAP = true;
+[[vk::constant_id(2)]] const bool HAS_NORMAL_MAP = true;
+
 //Tangentless normal mapping (http://www.thetenthplanet.de) - Magic
 float3x3 cotangent_frame(float3 normalVec, float3 pixelVec, float2 uv)
 {
@@ -89,7 +97,7 @@ float3x3 cotangent_frame(float3 normalVec, float3 pixelVec, float2 uv)
 
 float3 perturb_normal(float3 normalVec, float3 viewVec, float2 uv)
 {
-    float3 normMap = normalMap.Sample(normQualityFilter, uv);
+    float3 normMap = normalMap.Sample(normQualityFilter, float3(uv, normal_layer));
     float MAX_CHANNEL_VAL = 255.0f;
     float HALF_CHANNEL_VAL = 127.0f;
     
@@ -104,11 +112,10 @@ float3 perturb_normal(float3 normalVec, float3 viewVec, float2 uv)
 
 float4 main(PS_INPUT psInput) : SV_Target
 {
-    // Sample diffuse texture pixel
-    float4 textureColor = diffuseMap.Sample(qualityFilter, psInput.uvw.xy);
-    
-    // Sample specular texture pixel
-    float4 specularColor = specularMap.Sample(specQualityFilter, psInput.uvw.xy);
+    // Sample diffuse texture pixel (the default diffuse map is white)
+    float4 textureColor = float4(1, 1, 1, 1);
+    if (HAS_DIFFUSE_MAP)
+        textureColor = diffuseMap.Sample(qualityFilter, float3(psInput.uvw.xy, diffuse_layer));
     
     // Get view direction for normal calcs
     float3 viewDirection = normalize(SceneData[0].cameraPos.xyz - psInput.posW);
@@ -116,7 +123,9 @@ float4 main(PS_INPUT psInput) : SV_Target
     float3 worldNormalized = normalize(psInput.nrmW);
     
     // Find perturb normal for tangentless normals
-    float3 normal = perturb_normal(worldNormalized, viewDirection, psInput.uvw.xy);
+    float3 normal = worldNormalized;
+    if (HAS_NORMAL_MAP)
+        normal = perturb_normal(worldNormalized, viewDirection, psInput.uvw.xy);
     
     // Directional Lighting
     float directionalLighting = saturate(dot(-normalize(SceneData[0].lightDirection.xyz), normal));
@@ -124,10 +133,15 @@ float4 main(PS_INPUT psInput) : SV_Target
     // Ambient Lighting
     float3 ambientLighting = saturate(SceneData[0].ambientColor.xyz + directionalLighting);
     
-    // Specular
-    float3 halfVec = normalize(-normalize(SceneData[0].lightDirection.xyz) + viewDirection);
-    float intensity = max(pow(saturate(dot(worldNormalized, halfVec)), SceneData[0].materials[material_offset].Ns), 0);
-    float3 reflectedLight = SceneData[0].lightColor.xyz * SceneData[0].materials[material_offset].Ks * intensity * specularColor.xyz;
+    // Specular (the default specular map is black, so without a map there is nothing to add)
+    float3 reflectedLight = float3(0, 0, 0);
+    if (HAS_SPECULAR_MAP)
+    {
+        float4 specularColor = specularMap.Sample(specQualityFilter, float3(psInput.uvw.xy, specular_layer));
+        float3 halfVec = normalize(-normalize(SceneData[0].lightDirection.xyz) + viewDirection);
+        float intensity = max(pow(saturate(dot(worldNormalized, halfVec)), SceneData[0].materials[material_offset].Ns), 0);
+        reflectedLight = SceneData[0].lightColor.xyz * SceneData[0].materials[material_offset].Ks * intensity * specularColor.xyz;
+    }
 
     float3 diffuseReflectivity = SceneData[0].materials[material_offset].Kd;
     
@@ -67,7 +67,9 @@ VS_OUTPUT main(VSInput inputVertex, uint InstanceID : SV_InstanceID) : SV_TARGET
 {
     VS_OUTPUT vsOut = (VS_OUTPUT) 0;
     vsOut.posW = mul(inputVertex.Position, SceneData[0].matrices[matrix_offset + InstanceID]);
-    vsOut.posH = mul(mul(mul(float4(inputVertex.Position, 1), SceneData[0].matrices[matrix_offset + InstanceID]), SceneData[0].viewMatrix), SceneData[0].projectionMatrix);
+    // precise & identical to DepthVertexShader so the depth pre-pass and the EQUAL test agree bit for bit
+    precise float4 posH = mul(mul(mul(float4(inputVertex.Position, 1), SceneData[0].matrices[matrix_offset + InstanceID]), SceneData[0].viewMatrix), SceneData[0].projectionMatrix);
+    vsOut.posH = posH;
     vsOut.nrmW = mul(inputVertex.Normal, SceneData[0].matrices[matrix_offset + InstanceID]);
     vsOut.uvw = inputVertex.UVW;
     return vsOut;
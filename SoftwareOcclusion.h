@@ -0,0 +1,345 @@
+#ifndef _SOFTWAREOCCLUSION_H_
+#define _SOFTWAREOCCLUSION_H_
+#include <vector>
+#include <string>
+#include <cctype>
+#include "Culling.h"
+#include "ThreadPool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define SW_OCCLUSION_SIMD 1
+#else
+	#define SW_OCCLUSION_SIMD 0
+#endif
+
+// Same size as the HiZ depth target so both feed an identical pyramid
+#define SW_DEPTH_WIDTH 256
+#define SW_DEPTH_HEIGHT 128
+// Tiles are rasterized independently, widths must stay a multiple of 4 for SIMD
+#define SW_TILE_WIDTH 64
+#define SW_TILE_HEIGHT 32
+#define SW_TILES_X (SW_DEPTH_WIDTH / SW_TILE_WIDTH)
+#define SW_TILES_Y (SW_DEPTH_HEIGHT / SW_TILE_HEIGHT)
+// Automatic occluder selection (used when a level has no designated occluders)
+#define SW_AUTO_OCCLUDER_MAX_TRIANGLES 2048
+#define SW_OCCLUDER_TRIANGLE_BUDGET 32768
+
+/**
+ * CPU occlusion culling.
+ * Occluder meshes are rasterized depth-only into a small tiled buffer on worker threads, which is
+ * then reduced into the same max-depth pyramid HiZ uses so instance bounds are tested identically.
+ * Models are designated occluders by having "occluder" in their name, otherwise low poly
+ * instances with the largest bounds are picked automatically. Occluders draw their coarsest LOD.
+ */
+class SoftwareOcclusion
+{
+public:
+	struct OCCLUDER
+	{
+		unsigned model;
+		unsigned instance;
+	};
+
+	struct STATS
+	{
+		unsigned occludersRendered = 0;
+		unsigned trianglesRendered = 0;
+	};
+
+private:
+	struct TRIANGLE
+	{
+		float x[3], y[3], z[3]; // screen space, z in [0, 1]
+		int minX, minY, maxX, maxY; // pixel bounds, clamped to the buffer
+	};
+
+	ThreadPool workers;
+	std::vector<OCCLUDER> occluders;
+	std::vector<unsigned> activeOccluders; // index into occluders, inside the frustum this frame
+	std::vector<std::vector<TRIANGLE>> occluderTriangles; // per active occluder
+	std::vector<TRIANGLE> triangles;
+	std::vector<unsigned> tileBins[SW_TILES_X * SW_TILES_Y];
+	std::vector<float> depthBuffer;
+	Culling::DepthPyramid pyramid;
+	STATS stats;
+
+public:
+	void Start(unsigned workerCount = 0)
+	{
+		workers.Start(workerCount);
+		depthBuffer.assign(SW_DEPTH_WIDTH * SW_DEPTH_HEIGHT, 1.0f);
+		pyramid.Resize(SW_DEPTH_WIDTH / 2, SW_DEPTH_HEIGHT / 2);
+	}
+
+	void Stop()
+	{
+		workers.Stop();
+	}
+
+	void SelectOccluders(const std::vector<graphics::MODEL>& models)
+	{
+		occluders.clear();
+
+		// Designated occluders win
+		for (unsigned i = 0; i < models.size(); i++)
+		{
+			std::string name = models[i].modelName;
+			std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+			if (name.find("occluder") != std::string::npos)
+				for (unsigned j = 0; j < models[i].instanceCount; j++)
+					occluders.push_back({ i, j });
+		}
+		if (!occluders.empty())
+			return;
+
+		// Otherwise pick low poly instances with the largest surface area until the triangle budget runs out
+		std::vector<std::pair<float, OCCLUDER>> candidates;
+		for (unsigned i = 0; i < models.size(); i++)
+		{
+			if (OccluderTriangleCount(models[i]) > SW_AUTO_OCCLUDER_MAX_TRIANGLES)
+				continue;
+			for (unsigned j = 0; j < models[i].instanceCount; j++)
+			{
+				const graphics::AABB& bounds = models[i].instanceBounds[j];
+				float dx = bounds.max.x - bounds.min.x;
+				float dy = bounds.max.y - bounds.min.y;
+				float dz = bounds.max.z - bounds.min.z;
+				candidates.push_back({ dx * dy + dy * dz + dz * dx, { i, j } });
+			}
+		}
+		std::sort(candidates.begin(), candidates.end(),
+			[](const std::pair<float, OCCLUDER>& a, const std::pair<float, OCCLUDER>& b) { return a.first > b.first; });
+
+		unsigned triangleCount = 0;
+		for (const std::pair<float, OCCLUDER>& candidate : candidates)
+		{
+			unsigned modelTriangles = OccluderTriangleCount(models[candidate.second.model]);
+			if (triangleCount + modelTriangles > SW_OCCLUDER_TRIANGLE_BUDGET)
+				continue;
+			triangleCount += modelTriangles;
+			occluders.push_back(candidate.second);
+		}
+	}
+
+	// Rasterizes every occluder inside the frustum and rebuilds the depth pyramid
+	void Render(const std::vector<graphics::MODEL>& models, const GW::MATH::GMATRIXF& viewProjection,
+		const Culling::FRUSTUM& frustum)
+	{
+		stats = {};
+
+		activeOccluders.clear();
+		for (unsigned i = 0; i < occluders.size(); i++)
+			if (Culling::IsAABBInFrustum(frustum, models[occluders[i].model].instanceBounds[occluders[i].instance]))
+				activeOccluders.push_back(i);
+		stats.occludersRendered = (unsigned)activeOccluders.size();
+
+		// Transform & clip each occluder on the workers
+		occluderTriangles.resize(activeOccluders.size());
+		workers.ParallelFor((unsigned)activeOccluders.size(), [&](unsigned i) {
+			const OCCLUDER& occluder = occluders[activeOccluders[i]];
+			TransformOccluder(models[occluder.model], models[occluder.model].worldMatrices[occluder.instance],
+				viewProjection, occluderTriangles[i]);
+		});
+
+		// Bin triangles into every tile their bounds touch
+		triangles.clear();
+		for (std::vector<TRIANGLE>& list : occluderTriangles)
+			triangles.insert(triangles.end(), list.begin(), list.end());
+		stats.trianglesRendered = (unsigned)triangles.size();
+
+		for (std::vector<unsigned>& bin : tileBins)
+			bin.clear();
+		for (unsigned i = 0; i < triangles.size(); i++)
+		{
+			const TRIANGLE& tri = triangles[i];
+			for (int ty = tri.minY / SW_TILE_HEIGHT; ty <= tri.maxY / SW_TILE_HEIGHT; ty++)
+				for (int tx = tri.minX / SW_TILE_WIDTH; tx <= tri.maxX / SW_TILE_WIDTH; tx++)
+					tileBins[ty * SW_TILES_X + tx].push_back(i);
+		}
+
+		workers.ParallelFor(SW_TILES_X * SW_TILES_Y, [&](unsigned tile) { RasterizeTile(tile); });
+
+		pyramid.Build(depthBuffer.data(), SW_DEPTH_WIDTH, SW_DEPTH_HEIGHT);
+	}
+
+	inline bool IsOccluded(const graphics::AABB& bounds, const GW::MATH::GMATRIXF& viewProjection) const
+	{
+		return pyramid.IsOccluded(bounds, viewProjection);
+	}
+
+	inline const Culling::DepthPyramid& GetPyramid() const { return pyramid; }
+	inline const std::vector<float>& GetDepthBuffer() const { return depthBuffer; }
+	inline const std::vector<OCCLUDER>& GetOccluders() const { return occluders; }
+	inline const STATS& GetStats() const { return stats; }
+	inline unsigned GetWorkerCount() const { return workers.GetWorkerCount(); }
+
+private:
+	static const std::vector<graphics::BATCH>* OccluderBatches(const graphics::MODEL& model)
+	{
+		return model.lods.empty() ? nullptr : &model.lods.back();
+	}
+
+	static unsigned OccluderTriangleCount(const graphics::MODEL& model)
+	{
+		const std::vector<graphics::BATCH>* batches = OccluderBatches(model);
+		if (batches == nullptr)
+			return model.indexCount / 3;
+
+		unsigned triangles = 0;
+		for (const graphics::BATCH& batch : *batches)
+			triangles += batch.indexCount / 3;
+		return triangles;
+	}
+
+	void TransformOccluder(const graphics::MODEL& model, const GW::MATH::GMATRIXF& world,
+		const GW::MATH::GMATRIXF& viewProjection, std::vector<TRIANGLE>& out)
+	{
+		out.clear();
+
+		GW::MATH::GMATRIXF worldViewProjection;
+		GW::MATH::GMatrix::MultiplyMatrixF(world, viewProjection, worldViewProjection);
+
+		std::vector<GW::MATH::GVECTORF> clip(model.vertices.size());
+		for (unsigned i = 0; i < model.vertices.size(); i++)
+		{
+			const graphics::VECTOR& pos = model.vertices[i].pos;
+			clip[i] = Culling::TransformPoint(worldViewProjection, pos.x, pos.y, pos.z);
+		}
+
+		const std::vector<graphics::BATCH>* batches = OccluderBatches(model);
+		unsigned batchCount = batches == nullptr ? 1 : (unsigned)batches->size();
+		for (unsigned b = 0; b < batchCount; b++)
+		{
+			graphics::BATCH batch = batches == nullptr ? graphics::BATCH{ model.indexCount, 0 } : (*batches)[b];
+			if (batch.indexCount > 0)
+				AppendTriangles(clip, &model.indices[batch.indexOffset], batch.indexCount, out);
+		}
+	}
+
+	void AppendTriangles(const std::vector<GW::MATH::GVECTORF>& clip, const unsigned* indices, unsigned indexCount,
+		std::vector<TRIANGLE>& out)
+	{
+		for (unsigned i = 0; i + 2 < indexCount; i += 3)
+		{
+			const GW::MATH::GVECTORF* v[3] = {
+				&clip[indices[i]], &clip[indices[i + 1]], &clip[indices[i + 2]] };
+
+			// Dropping triangles that cross the near plane only ever removes occlusion
+			if (v[0]->z < 0 || v[1]->z < 0 || v[2]->z < 0)
+				continue;
+
+			TRIANGLE tri;
+			float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+			for (int k = 0; k < 3; k++)
+			{
+				float invW = 1.0f / v[k]->w;
+				tri.x[k] = (v[k]->x * invW * 0.5f + 0.5f) * SW_DEPTH_WIDTH;
+				tri.y[k] = (0.5f - v[k]->y * invW * 0.5f) * SW_DEPTH_HEIGHT;
+				tri.z[k] = v[k]->z * invW;
+				minX = std::min(minX, tri.x[k]); maxX = std::max(maxX, tri.x[k]);
+				minY = std::min(minY, tri.y[k]); maxY = std::max(maxY, tri.y[k]);
+			}
+
+			// Pixel centers covered by the bounds, skip anything off screen or too small to hit one
+			tri.minX = std::max((int)std::ceil(minX - 0.5f), 0);
+			tri.minY = std::max((int)std::ceil(minY - 0.5f), 0);
+			tri.maxX = std::min((int)std::floor(maxX - 0.5f), SW_DEPTH_WIDTH - 1);
+			tri.maxY = std::min((int)std::floor(maxY - 0.5f), SW_DEPTH_HEIGHT - 1);
+			if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+				continue;
+
+			// Both windings are drawn so mirrored instances need no special casing
+			float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+			if (std::fabs(area) < 1e-6f)
+				continue;
+			if (area < 0)
+			{
+				std::swap(tri.x[1], tri.x[2]);
+				std::swap(tri.y[1], tri.y[2]);
+				std::swap(tri.z[1], tri.z[2]);
+			}
+
+			out.push_back(tri);
+		}
+	}
+
+	void RasterizeTile(unsigned tile)
+	{
+		int tileX = (tile % SW_TILES_X) * SW_TILE_WIDTH;
+		int tileY = (tile / SW_TILES_X) * SW_TILE_HEIGHT;
+
+		for (int y = tileY; y < tileY + SW_TILE_HEIGHT; y++)
+			std::fill(&depthBuffer[y * SW_DEPTH_WIDTH + tileX], &depthBuffer[y * SW_DEPTH_WIDTH + tileX + SW_TILE_WIDTH], 1.0f);
+
+		for (unsigned index : tileBins[tile])
+		{
+			const TRIANGLE& tri = triangles[index];
+
+			// Edge functions E(p) = (b - a) x (p - a), positive inside after the winding fix
+			float e0dx = -(tri.y[1] - tri.y[0]), e0dy = tri.x[1] - tri.x[0];
+			float e1dx = -(tri.y[2] - tri.y[1]), e1dy = tri.x[2] - tri.x[1];
+			float e2dx = -(tri.y[0] - tri.y[2]), e2dy = tri.x[0] - tri.x[2];
+
+			// Depth is affine in screen space
+			float det = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+			float dzdx = ((tri.z[1] - tri.z[0]) * (tri.y[2] - tri.y[0]) - (tri.z[2] - tri.z[0]) * (tri.y[1] - tri.y[0])) / det;
+			float dzdy = ((tri.z[2] - tri.z[0]) * (tri.x[1] - tri.x[0]) - (tri.z[1] - tri.z[0]) * (tri.x[2] - tri.x[0])) / det;
+
+			int minX = std::max(tri.minX, tileX) & ~3; // 4 pixel aligned for SIMD
+			int maxX = std::min(tri.maxX, tileX + SW_TILE_WIDTH - 1);
+			int minY = std::max(tri.minY, tileY);
+			int maxY = std::min(tri.maxY, tileY + SW_TILE_HEIGHT - 1);
+
+			for (int y = minY; y <= maxY; y++)
+			{
+				float py = y + 0.5f;
+				float px = minX + 0.5f;
+				float e0 = e0dy * (py - tri.y[0]) + e0dx * (px - tri.x[0]);
+				float e1 = e1dy * (py - tri.y[1]) + e1dx * (px - tri.x[1]);
+				float e2 = e2dy * (py - tri.y[2]) + e2dx * (px - tri.x[2]);
+				float z = tri.z[0] + dzdx * (px - tri.x[0]) + dzdy * (py - tri.y[0]);
+				float* row = &depthBuffer[y * SW_DEPTH_WIDTH];
+
+#if SW_OCCLUSION_SIMD
+				const __m128 steps = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+				const __m128 zero = _mm_setzero_ps();
+				__m128 ve0 = _mm_add_ps(_mm_set1_ps(e0), _mm_mul_ps(_mm_set1_ps(e0dx), steps));
+				__m128 ve1 = _mm_add_ps(_mm_set1_ps(e1), _mm_mul_ps(_mm_set1_ps(e1dx), steps));
+				__m128 ve2 = _mm_add_ps(_mm_set1_ps(e2), _mm_mul_ps(_mm_set1_ps(e2dx), steps));
+				__m128 vz = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(_mm_set1_ps(dzdx), steps));
+				const __m128 e0step = _mm_set1_ps(e0dx * 4), e1step = _mm_set1_ps(e1dx * 4);
+				const __m128 e2step = _mm_set1_ps(e2dx * 4), zstep = _mm_set1_ps(dzdx * 4);
+
+				for (int x = minX; x <= maxX; x += 4)
+				{
+					__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(ve0, zero), _mm_cmpge_ps(ve1, zero)),
+						_mm_cmpge_ps(ve2, zero));
+					if (_mm_movemask_ps(inside) != 0)
+					{
+						__m128 depth = _mm_loadu_ps(row + x);
+						__m128 nearest = _mm_min_ps(depth, vz);
+						_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, depth)));
+					}
+					ve0 = _mm_add_ps(ve0, e0step);
+					ve1 = _mm_add_ps(ve1, e1step);
+					ve2 = _mm_add_ps(ve2, e2step);
+					vz = _mm_add_ps(vz, zstep);
+				}
+#else
+				for (int x = minX; x <= maxX; x++)
+				{
+					if (e0 >= 0 && e1 >= 0 && e2 >= 0 && z < row[x])
+						row[x] = z;
+					e0 += e0dx;
+					e1 += e1dx;
+					e2 += e2dx;
+					z += dzdx;
+				}
+#endif
+			}
+		}
+	}
+};
+
+#endif
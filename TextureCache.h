@@ -0,0 +1,1727 @@
+#ifndef _TEXTURECACHE_H_
+#define _TEXTURECACHE_H_
+#include <vector>
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include <map>
+#include <tuple>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cctype>
+#include <iostream>
+#include "ktx.h"
+#include <ktxvulkan.h>
+#include "VulkanHelpers.h"
+#include "ThreadPool.h"
+#include "KtxTranscode.h"
+#include "DeletionQueue.h"
+#include "MemoryStats.h"
+
+#define TEXTURE_CACHE_INVALID 0xFFFFFFFFu
+#define TEXTURE_CACHE_POOL_SIZE 64 // descriptor sets per pool, pools are added as needed
+#define TEXTURE_STAGING_RING_MB 64 // persistent staging buffer, batches that do not fit get their own
+#define TEXTURE_ARRAY_MAX_SIZE 256 // textures no larger than this (both sides) are packed into arrays
+#define TEXTURE_ARRAY_MIN_LAYERS 2
+#define TEXTURE_ARRAY_MAX_LAYERS 64
+// Dropping levels & packing arrays copy out of texture images, generating levels blits within them
+#define TEXTURE_IMAGE_USAGE (VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+
+/**
+ * Shares one image, view & descriptor set per unique texture file.
+ * Textures are keyed by their canonical path and reference counted, so materials (and models, and
+ * consecutive levels) naming the same file all use one upload. When its last reference is released
+ * a texture's resources retire like replaced ones, so a level can be swapped while frames using the
+ * old one are still in flight.
+ *
+ * New files are read & parsed on worker threads, packed into a persistent staging ring & copied by
+ * the frame's transfer command buffer, submitted once per frame (SubmitTransfers). Nothing waits on
+ * it: BeginFrame polls each transfer's fence & only once it has passed do new textures stop
+ * uploading (IsUploading) & replacement images get swapped in. AcquireBatch, for load time, waits.
+ *
+ * Plain 2D textures are partially resident: only the mip levels from a base level down are kept,
+ * chosen from the largest on screen size reported since the last UpdateResidency & kept within a
+ * device memory budget by dropping the finest levels of the least recently needed textures first.
+ * Dropping levels is a GPU copy into a smaller image, adding them needs the file read again (the
+ * caller's job, see UpdateResidency & RefineDecoded). Replaced images are kept until every frame
+ * that may still sample them has finished (see BeginFrame).
+ *
+ * Small textures are always whole, and PackArrays moves those sharing a format, size & level count
+ * into 2D texture arrays: one image, view & descriptor set per group, each texture a layer (see
+ * GetLayer). Every view is a 2D array, single textures are one layer arrays.
+ *
+ * Files shipped with a single level get a full mip chain on upload, blitted level by level from the
+ * one above where the format allows linear blits. Views cover exactly the levels an image holds, so
+ * the sampler's LOD range stays open & every texture is clamped to its own chain.
+ */
+class TextureCache
+{
+public:
+	struct STATS
+	{
+		unsigned requests = 0;
+		unsigned loaded = 0; // uploaded from file
+		unsigned duplicatesAvoided = 0; // requests served by an already resident texture
+		VkDeviceSize bytesLoaded = 0;
+		VkDeviceSize bytesSaved = 0; // device memory the duplicates would have taken
+		float decodeMilliseconds = 0.0f; // file reads on the workers
+		float uploadMilliseconds = 0.0f; // staging & recording the copies
+		unsigned levelsRefined = 0; // textures given finer levels
+		unsigned levelsEvicted = 0; // textures that dropped finer levels
+		unsigned packed = 0; // textures moved into texture arrays
+		unsigned levelsGenerated = 0; // single level files given a mip chain on upload
+		unsigned descriptorSets = 0; // allocated for new textures & arrays
+		float descriptorMilliseconds = 0.0f; // those allocations, new pools included
+	};
+
+private:
+	struct ENTRY
+	{
+		std::string path;
+		ktxVulkanTexture texture; // the resident levels only
+		VkImageView view = nullptr;
+		VkDescriptorSet descriptorSet = nullptr;
+		VkDescriptorPool pool = nullptr;
+		VkDeviceSize bytes = 0;
+		unsigned refCount = 0;
+
+		// Residency, partial is false for textures always kept whole (arrays, cubemaps, generated chains)
+		bool partial = false;
+		unsigned fullWidth = 0, fullHeight = 0, fullLevels = 0;
+		VkDeviceSize fullBytes = 0; // estimate with every level resident
+		unsigned baseLevel = 0; // finest resident level
+		unsigned targetLevel = 0; // level residency is heading for
+		float neededPixels = 0.0f; // largest on screen size since the last update
+		unsigned long long lastNeeded = 0; // frame
+		bool refining = false; // waiting on RefineDecoded
+
+		// Transfers only finish at a later BeginFrame
+		unsigned long long id = 0; // unique per upload, tells a reused handle from the one a transfer was for
+		bool uploading = false; // the image is still being filled, its descriptor set must not be bound
+		bool failed = false; // the upload's transfer failed, the image holds nothing
+		bool transferring = false; // a replacement image is being filled
+
+		// Packed textures share their array's image, view & set. For an array, refCount counts its layers
+		unsigned array = TEXTURE_CACHE_INVALID;
+		unsigned layer = 0;
+	};
+
+	// One level of one layer (or cubemap face): rows of rowBytes, sourcePitch apart in the file, packed
+	// at staging in the texture's part of the staging buffer. Compressed images are a single row
+	struct STAGED_IMAGE
+	{
+		VkDeviceSize source = 0;
+		VkDeviceSize staging = 0;
+		VkDeviceSize rowBytes = 0;
+		VkDeviceSize sourcePitch = 0;
+		unsigned rows = 0;
+		VkBufferImageCopy region = {}; // bufferOffset relative to the texture's part
+	};
+
+	// A file new to this batch (or a texture getting finer levels), between decode & becoming an ENTRY
+	struct PENDING
+	{
+		std::string path;
+		std::string key;
+		ktxTexture* kTexture = nullptr;
+		KTX_error_code result = KTX_error_code::KTX_SUCCESS;
+		float screenSize = 0.0f; // 0 loads every level
+		unsigned baseLevel = 0;
+		bool staged = false; // has an image & set, copied by UploadStaged
+		bool generateLevels = false; // single level file, the rest of the chain is blitted
+		VkDeviceSize stagingOffset = 0;
+		std::vector<STAGED_IMAGE> images; // the levels from baseLevel, every layer & face
+		VkDeviceSize stagingBytes = 0;
+		ENTRY entry;
+		unsigned handle = TEXTURE_CACHE_INVALID;
+		unsigned replaces = TEXTURE_CACHE_INVALID; // entry getting these levels
+	};
+
+	// Recorded during a frame, submitted at its end & reused once its fence has passed
+	struct TRANSFER
+	{
+		VkCommandBuffer commandBuffer = nullptr;
+		VkFence fence = nullptr;
+		bool recording = false;
+		bool submitted = false;
+		unsigned long long order = 0; // completions run in submission order
+		VkDeviceSize stagingBytes = 0; // taken from the ring, padding included
+		std::vector<std::function<void(bool)>> completions; // run with whether the work was done
+	};
+
+	VkDevice device = nullptr;
+	VkPhysicalDevice physicalDevice = nullptr;
+	VkQueue queue = nullptr;
+	VkCommandPool commandPool = nullptr;
+	VkDescriptorSetLayout layout = nullptr;
+	VkDeviceSize copyOffsetAlignment = 1; // optimalBufferCopyOffsetAlignment
+	VkSampler sampler = nullptr;
+	ktx_transcode_fmt_e transcodeFormat = KTX_TTF_RGBA32; // target for Basis supercompressed files
+	ThreadPool workers;
+	std::vector<VkDescriptorPool> pools;
+	std::vector<ENTRY> entries;
+	std::vector<unsigned> freeEntries;
+	std::unordered_map<std::string, unsigned> lookup;
+	std::vector<ENTRY> arrays;
+	std::vector<unsigned> freeArrays;
+	DeletionQueue retired; // resources replaced while frames in flight may still use them
+	std::vector<TRANSFER> transfers; // one per frame in flight
+	unsigned currentTransfer = 0;
+	unsigned long long submittedTransfers = 0;
+	VkBuffer stagingRing = nullptr;
+	VkDeviceMemory stagingRingMemory = nullptr;
+	ktx_uint8_t* stagingRingMapped = nullptr;
+	VkDeviceSize stagingRingSize = 0;
+	VkDeviceSize stagingHead = 0; // next free byte
+	VkDeviceSize stagingUsed = 0; // held by transfers not finished yet, ending at stagingHead
+	unsigned long long nextEntryId = 0;
+	unsigned long long currentFrame = 0;
+	unsigned long long retireFrame = 0;
+	VkDeviceSize budget = ~(VkDeviceSize)0;
+	VkDeviceSize residentBytes = 0; // replacement images count from the moment they are created
+	VkDeviceSize retiringBytes = 0; // images a transfer in flight is about to replace
+	unsigned descriptorVersion = 0; // bumped whenever an entry's descriptor set changes
+	STATS stats;
+	MemoryStats* memoryStats = nullptr; // staging buffers are counted here when set
+
+public:
+	// Each transfer command buffer is re-recorded, so commandPool must allow resetting them
+	void Create(VkDevice _device, VkPhysicalDevice _physicalDevice, VkQueue _queue, VkCommandPool _commandPool,
+		VkDescriptorSetLayout _layout, unsigned framesInFlight, ktx_transcode_fmt_e _transcodeFormat = KTX_TTF_RGBA32)
+	{
+		device = _device;
+		physicalDevice = _physicalDevice;
+		queue = _queue;
+		commandPool = _commandPool;
+		layout = _layout;
+		transcodeFormat = _transcodeFormat;
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		copyOffsetAlignment = std::max(properties.limits.optimalBufferCopyOffsetAlignment, (VkDeviceSize)1);
+		workers.Start();
+
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.commandPool = commandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = 1;
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		transfers.resize(std::max(framesInFlight, 1u));
+		for (TRANSFER& transfer : transfers)
+		{
+			if (vkAllocateCommandBuffers(device, &allocateInfo, &transfer.commandBuffer) != VkResult::VK_SUCCESS
+				|| vkCreateFence(device, &fenceInfo, nullptr, &transfer.fence) != VkResult::VK_SUCCESS)
+			{
+				std::cerr << "ERROR: TextureCache - Unable to create transfer command buffers, textures will not load!\n";
+				DestroyTransfers();
+				break;
+			}
+		}
+	}
+
+	// Returns a handle to the texture at path, loading it only if no one holds it yet
+	unsigned Acquire(const std::string& path)
+	{
+		std::vector<unsigned> handles;
+		AcquireBatch({ path }, handles);
+		return handles[0];
+	}
+
+	// One handle per path (TEXTURE_CACHE_INVALID where loading failed), returns false if any failed.
+	// Waits for the upload, so every handle can be bound right away. Nothing to upload, nothing to wait for
+	bool AcquireBatch(const std::vector<std::string>& paths, std::vector<unsigned>& handles)
+	{
+		bool success = AcquireFiles(paths, nullptr, nullptr, handles);
+		bool waiting = !transfers.empty() && transfers[currentTransfer].recording;
+		for (unsigned handle : handles)
+			waiting = waiting || (handle != TEXTURE_CACHE_INVALID && entries[handle].uploading);
+		if (waiting)
+			FinishTransfers();
+		for (unsigned& handle : handles)
+		{
+			if (handle == TEXTURE_CACHE_INVALID || !entries[handle].failed)
+				continue;
+			Release(handle);
+			handle = TEXTURE_CACHE_INVALID;
+			success = false;
+		}
+		return success;
+	}
+
+	// AcquireBatch for files already read elsewhere (see TextureStreamer), takes ownership of kTextures.
+	// A null kTexture is a file that could not be read. screenSizes (pixels, optional) pick the
+	// finest level loaded. Nothing waits: a handle can be bound once IsUploading is false (& IsFailed is not)
+	bool AcquireDecoded(const std::vector<std::string>& paths, std::vector<ktxTexture*>& kTextures,
+		std::vector<unsigned>& handles, const std::vector<float>* screenSizes = nullptr)
+	{
+		return AcquireFiles(paths, &kTextures, screenSizes, handles);
+	}
+
+	// A new reference to path if it is already resident & uploaded, TEXTURE_CACHE_INVALID otherwise
+	unsigned AcquireResident(const std::string& path)
+	{
+		auto found = lookup.find(CanonicalPath(path));
+		if (found == lookup.end() || entries[found->second].uploading || entries[found->second].failed)
+			return TEXTURE_CACHE_INVALID;
+		stats.requests++;
+		AddReference(found->second);
+		return found->second;
+	}
+
+	// One more reference to a texture the caller already holds
+	inline void Retain(unsigned handle) { entries[handle].refCount++; }
+
+	void Release(unsigned handle)
+	{
+		if (handle >= entries.size() || entries[handle].refCount == 0)
+			return;
+		ENTRY& entry = entries[handle];
+		if (--entry.refCount > 0)
+			return;
+
+		lookup.erase(entry.path);
+		RetireEntry(entry);
+		freeEntries.push_back(handle);
+	}
+
+	// Points every resident texture's descriptor set at its view & the given sampler.
+	// Textures loaded afterwards are written with the same sampler as they arrive
+	void WriteDescriptors(VkSampler _sampler)
+	{
+		sampler = _sampler;
+		for (ENTRY& entry : entries)
+			if (entry.refCount > 0 && entry.array == TEXTURE_CACHE_INVALID)
+				WriteDescriptor(entry);
+		for (ENTRY& array : arrays)
+			if (array.refCount > 0)
+				WriteDescriptor(array);
+	}
+
+	// Call before recording a frame: finishes the transfers the GPU is done with, frees what no frame
+	// in flight can still use
+	void BeginFrame(unsigned long long frame, unsigned framesInFlight)
+	{
+		SubmitTransfers(); // anything recorded outside a frame
+		currentFrame = frame;
+		retireFrame = frame + framesInFlight;
+		if (!transfers.empty())
+			currentTransfer = (unsigned)(frame % transfers.size());
+		PollTransfers();
+		retired.Flush(frame);
+	}
+
+	// Submits what was recorded since BeginFrame, call once per frame (after the frame's own submit)
+	void SubmitTransfers()
+	{
+		if (transfers.empty() || !transfers[currentTransfer].recording)
+			return;
+		TRANSFER& transfer = transfers[currentTransfer];
+		transfer.recording = false;
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &transfer.commandBuffer;
+		if (vkEndCommandBuffer(transfer.commandBuffer) == VkResult::VK_SUCCESS
+			&& vkQueueSubmit(queue, 1, &submitInfo, transfer.fence) == VkResult::VK_SUCCESS)
+		{
+			transfer.submitted = true;
+			transfer.order = ++submittedTransfers;
+			return;
+		}
+
+		// Its staging was the last taken from the ring
+		std::cerr << "ERROR: TextureCache - Texture upload failed!\n";
+		if (stagingRingSize > 0)
+			stagingHead = (stagingHead + stagingRingSize - transfer.stagingBytes % stagingRingSize) % stagingRingSize;
+		stagingUsed -= std::min(stagingUsed, transfer.stagingBytes);
+		transfer.stagingBytes = 0;
+		RunCompletions(transfer, false);
+	}
+
+	// Submits & waits for every transfer, for load time & shutdown
+	void FinishTransfers()
+	{
+		SubmitTransfers();
+		WaitTransfers();
+	}
+
+	// False while this frame's transfer is still running, work for it should wait a frame
+	inline bool CanTransfer() const { return !transfers.empty() && !transfers[currentTransfer].submitted; }
+	inline void SetBudget(VkDeviceSize bytes) { budget = bytes; }
+
+	// The texture covers about pixels on screen this frame
+	inline void RequestSize(unsigned handle, float pixels)
+	{
+		entries[handle].neededPixels = std::max(entries[handle].neededPixels, pixels);
+	}
+
+	// Moves every partial texture toward the levels its requested size needs within the budget.
+	// Level drops are recorded into the frame's transfer, textures needing finer levels are returned in
+	// refinePaths and get them when the caller hands the file back to RefineDecoded
+	void UpdateResidency(std::vector<std::string>& refinePaths)
+	{
+		VkDeviceSize total = 0;
+		std::vector<unsigned> partial;
+		std::vector<unsigned> wanted(entries.size());
+		for (unsigned i = 0; i < entries.size(); i++)
+		{
+			ENTRY& entry = entries[i];
+			if (entry.refCount == 0)
+				continue;
+			if (!entry.partial || entry.uploading || entry.transferring)
+			{
+				total += entry.bytes;
+				continue;
+			}
+			if (entry.neededPixels > 0.0f)
+			{
+				entry.targetLevel = BaseLevelForSize(entry.fullWidth, entry.fullHeight, entry.fullLevels, entry.neededPixels);
+				entry.lastNeeded = currentFrame;
+			}
+			entry.neededPixels = 0.0f;
+			wanted[i] = entry.targetLevel;
+			total += LevelBytes(entry, entry.targetLevel);
+			partial.push_back(i);
+		}
+
+		// Over budget: the least recently needed (then largest) textures lose their finest levels first
+		if (total > budget)
+		{
+			std::sort(partial.begin(), partial.end(), [this](unsigned a, unsigned b)
+			{
+				if (entries[a].lastNeeded != entries[b].lastNeeded)
+					return entries[a].lastNeeded < entries[b].lastNeeded;
+				return entries[a].fullBytes > entries[b].fullBytes;
+			});
+			for (unsigned i = 0; i < partial.size() && total > budget; i++)
+			{
+				ENTRY& entry = entries[partial[i]];
+				while (total > budget && entry.targetLevel + 1 < entry.fullLevels)
+				{
+					total -= LevelBytes(entry, entry.targetLevel) - LevelBytes(entry, entry.targetLevel + 1);
+					entry.targetLevel++;
+				}
+			}
+		}
+
+		// Levels more than one step finer than needed, or over budget, are dropped now
+		std::vector<std::pair<unsigned, unsigned>> evictions;
+		for (unsigned handle : partial)
+		{
+			ENTRY& entry = entries[handle];
+			bool forced = entry.targetLevel > wanted[handle];
+			if (entry.targetLevel > entry.baseLevel && (forced || entry.targetLevel > entry.baseLevel + 1))
+				evictions.push_back({ handle, entry.targetLevel });
+			else if (entry.targetLevel < entry.baseLevel && !entry.refining)
+			{
+				entry.refining = true;
+				refinePaths.push_back(entry.path);
+			}
+		}
+		// While the frame's transfer is busy the evictions wait for the next update rather than the GPU
+		if (!evictions.empty() && CanTransfer())
+			DropLevels(evictions);
+	}
+
+	// Uploads finer levels for textures UpdateResidency asked for, takes ownership of kTextures
+	void RefineDecoded(const std::vector<std::string>& paths, std::vector<ktxTexture*>& kTextures)
+	{
+		std::vector<PENDING> pending;
+		for (unsigned i = 0; i < paths.size(); i++)
+		{
+			auto found = lookup.find(CanonicalPath(paths[i]));
+			ENTRY* entry = found != lookup.end() ? &entries[found->second] : nullptr;
+			if (entry != nullptr)
+				entry->refining = false;
+			if (entry == nullptr || kTextures[i] == nullptr || entry->targetLevel >= entry->baseLevel || entry->transferring)
+			{
+				if (kTextures[i] != nullptr)
+					ktxTexture_Destroy(kTextures[i]);
+				continue;
+			}
+
+			pending.emplace_back();
+			pending.back().path = paths[i];
+			pending.back().key = entry->path;
+			pending.back().kTexture = kTextures[i];
+			pending.back().baseLevel = entry->targetLevel;
+			pending.back().replaces = found->second;
+		}
+		kTextures.clear();
+		if (!pending.empty())
+			LoadPending(pending, false);
+	}
+
+	// Packs every group of whole, small, unpacked textures with the same format, size & level count
+	// into texture arrays. Returns how many textures are being packed: they move to their arrays (&
+	// their own images retire) once the frame's transfer has finished
+	unsigned PackArrays()
+	{
+		TRACE_SCOPE("PackArrays");
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		unsigned maxLayers = std::min((unsigned)TEXTURE_ARRAY_MAX_LAYERS, properties.limits.maxImageArrayLayers);
+
+		std::map<std::tuple<VkFormat, unsigned, unsigned, unsigned>, std::vector<unsigned>> groups;
+		for (unsigned i = 0; i < entries.size(); i++)
+		{
+			if (!IsPackable(entries[i]))
+				continue;
+			const ktxVulkanTexture& texture = entries[i].texture;
+			groups[std::make_tuple(texture.imageFormat, texture.width, texture.height, texture.levelCount)].push_back(i);
+		}
+
+		unsigned packed = 0;
+		for (auto& group : groups)
+		{
+			const std::vector<unsigned>& members = group.second;
+			for (unsigned first = 0; first + TEXTURE_ARRAY_MIN_LAYERS <= members.size(); first += maxLayers)
+			{
+				unsigned count = std::min(maxLayers, (unsigned)members.size() - first);
+				if (PackArray(std::vector<unsigned>(members.begin() + first, members.begin() + first + count)))
+					packed += count;
+			}
+		}
+		return packed;
+	}
+
+	// Forget outstanding refine requests, their files will not arrive (the streamer was cleared)
+	void CancelRefines()
+	{
+		for (ENTRY& entry : entries)
+			entry.refining = false;
+	}
+
+	// Forget the refine requests for paths only, ones UpdateResidency asked for but nobody queued
+	void CancelRefines(const std::vector<std::string>& paths)
+	{
+		for (const std::string& path : paths)
+		{
+			auto found = lookup.find(CanonicalPath(path));
+			if (found != lookup.end())
+				entries[found->second].refining = false;
+		}
+	}
+
+	// Frees everything, references included
+	void Destroy()
+	{
+		FinishTransfers();
+		workers.Stop();
+		retired.FlushAll();
+		for (ENTRY& entry : entries)
+			if (entry.refCount > 0)
+				DestroyEntry(entry);
+		arrays.clear();
+		freeArrays.clear();
+		for (VkDescriptorPool pool : pools)
+			vkDestroyDescriptorPool(device, pool, nullptr);
+		pools.clear();
+		sampler = nullptr;
+		entries.clear();
+		freeEntries.clear();
+		lookup.clear();
+		residentBytes = 0;
+		retiringBytes = 0;
+		DestroyTransfers();
+		if (stagingRing != nullptr)
+		{
+			vkUnmapMemory(device, stagingRingMemory);
+			DestroyStaging(stagingRing, stagingRingMemory, stagingRingSize);
+		}
+		stagingRing = nullptr;
+		stagingRingMemory = nullptr;
+		stagingRingMapped = nullptr;
+		stagingRingSize = stagingHead = stagingUsed = 0;
+	}
+
+	inline VkDescriptorSet GetDescriptorSet(unsigned handle) const { return entries[handle].descriptorSet; }
+	inline const ktxVulkanTexture& GetTexture(unsigned handle) const { return entries[handle].texture; }
+	inline unsigned GetLayer(unsigned handle) const { return entries[handle].layer; }
+	inline bool IsUploading(unsigned handle) const { return entries[handle].uploading; }
+	inline bool IsFailed(unsigned handle) const { return entries[handle].failed; }
+	inline unsigned GetArrayCount() const { return (unsigned)(arrays.size() - freeArrays.size()); }
+	inline unsigned GetResidentCount() const { return (unsigned)(entries.size() - freeEntries.size()); }
+	inline unsigned GetWorkerCount() const { return workers.GetWorkerCount(); }
+	inline VkDeviceSize GetResidentBytes() const { return residentBytes; }
+	inline VkDeviceSize GetBytes(unsigned handle) const { return entries[handle].bytes; }
+	inline unsigned GetPoolCount() const { return (unsigned)pools.size(); }
+	inline void SetMemoryStats(MemoryStats* _memoryStats) { memoryStats = _memoryStats; }
+	inline VkDeviceSize GetBudget() const { return budget; }
+	inline unsigned GetDescriptorVersion() const { return descriptorVersion; }
+	inline const STATS& GetStats() const { return stats; }
+	inline void ResetStats() { stats = {}; }
+
+	// Partially resident textures & how many of them are missing levels they want
+	void GetResidencyCounts(unsigned& partialCount, unsigned& refiningCount) const
+	{
+		partialCount = refiningCount = 0;
+		for (const ENTRY& entry : entries)
+		{
+			if (entry.refCount == 0 || !entry.partial)
+				continue;
+			partialCount += entry.baseLevel > 0 ? 1 : 0;
+			refiningCount += entry.refining ? 1 : 0;
+		}
+	}
+
+	// "../Assets/Textures/./Brick.ktx" & "..\\Assets\\Textures\\brick.ktx" (on windows) name the same file
+	static std::string CanonicalPath(const std::string& path)
+	{
+		std::vector<std::string> parts;
+		std::string part;
+		bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\');
+		for (size_t i = 0; i <= path.size(); i++)
+		{
+			char c = i < path.size() ? path[i] : '/';
+			if (c != '/' && c != '\\')
+			{
+#ifdef _WIN32
+				c = (char)std::tolower((unsigned char)c);
+#endif
+				part += c;
+				continue;
+			}
+			if (part == "..")
+			{
+				if (!parts.empty() && parts.back() != "..")
+					parts.pop_back();
+				else
+					parts.push_back(part);
+			}
+			else if (!part.empty() && part != ".")
+				parts.push_back(part);
+			part.clear();
+		}
+
+		std::string canonical = absolute ? "/" : "";
+		for (size_t i = 0; i < parts.size(); i++)
+			canonical += (i > 0 ? "/" : "") + parts[i];
+		return canonical;
+	}
+
+	// Coarsest level still at least pixels across, so the sampler never has to magnify
+	static unsigned BaseLevelForSize(unsigned width, unsigned height, unsigned levelCount, float pixels)
+	{
+		if (pixels <= 0.0f)
+			return 0;
+		unsigned size = std::max(width, height);
+		unsigned level = 0;
+		while (level + 1 < levelCount && (float)std::max(size >> (level + 1), 1u) >= pixels)
+			level++;
+		return level;
+	}
+
+private:
+	void WriteDescriptor(const ENTRY& entry)
+	{
+		VkDescriptorImageInfo imageInfo = { sampler, entry.view, entry.texture.imageLayout };
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = entry.descriptorSet;
+		write.dstBinding = 0;
+		write.dstArrayElement = 0;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.pImageInfo = &imageInfo;
+		vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+	}
+
+	void AddReference(unsigned handle)
+	{
+		entries[handle].refCount++;
+		stats.duplicatesAvoided++;
+		stats.bytesSaved += entries[handle].bytes;
+	}
+
+	// Device memory estimate of a partial texture holding the levels from baseLevel down
+	static VkDeviceSize LevelBytes(const ENTRY& entry, unsigned baseLevel)
+	{
+		return std::max(entry.fullBytes >> (2 * baseLevel), (VkDeviceSize)1);
+	}
+
+	// kTextures null: read the new files here, otherwise they were read by the caller
+	bool AcquireFiles(const std::vector<std::string>& paths, std::vector<ktxTexture*>* kTextures,
+		const std::vector<float>* screenSizes, std::vector<unsigned>& handles)
+	{
+		handles.assign(paths.size(), TEXTURE_CACHE_INVALID);
+		stats.requests += (unsigned)paths.size();
+
+		// Resident textures are just referenced again, files named twice in the batch load once
+		std::vector<PENDING> pending;
+		std::vector<unsigned> pendingOf(paths.size(), TEXTURE_CACHE_INVALID);
+		std::unordered_map<std::string, unsigned> pendingLookup;
+		for (unsigned i = 0; i < paths.size(); i++)
+		{
+			std::string key = CanonicalPath(paths[i]);
+			auto found = lookup.find(key);
+			if (found != lookup.end())
+			{
+				handles[i] = found->second;
+				AddReference(found->second);
+				if (kTextures != nullptr && (*kTextures)[i] != nullptr)
+					ktxTexture_Destroy((*kTextures)[i]);
+				continue;
+			}
+			auto batched = pendingLookup.emplace(key, (unsigned)pending.size());
+			if (batched.second)
+			{
+				pending.emplace_back();
+				pending.back().path = paths[i];
+				pending.back().key = key;
+				if (screenSizes != nullptr)
+					pending.back().screenSize = (*screenSizes)[i];
+				if (kTextures != nullptr)
+				{
+					pending.back().kTexture = (*kTextures)[i];
+					if (pending.back().kTexture == nullptr)
+						pending.back().result = KTX_error_code::KTX_FILE_OPEN_FAILED;
+				}
+			}
+			else if (kTextures != nullptr && (*kTextures)[i] != nullptr)
+				ktxTexture_Destroy((*kTextures)[i]);
+			pendingOf[i] = batched.first->second;
+		}
+		if (kTextures != nullptr)
+			kTextures->clear();
+
+		if (!pending.empty())
+			LoadPending(pending, kTextures == nullptr);
+
+		bool success = true;
+		for (unsigned i = 0; i < paths.size(); i++)
+		{
+			if (pendingOf[i] == TEXTURE_CACHE_INVALID)
+				continue;
+			PENDING& texture = pending[pendingOf[i]];
+			if (texture.handle == TEXTURE_CACHE_INVALID)
+			{
+				success = false;
+				continue;
+			}
+			// The first request holds the reference the load created
+			if (entries[texture.handle].refCount == 0)
+				entries[texture.handle].refCount = 1;
+			else
+				AddReference(texture.handle);
+			handles[i] = texture.handle;
+		}
+		return success;
+	}
+
+	void LoadPending(std::vector<PENDING>& pending, bool decode)
+	{
+		// File reads, parsing & Basis transcoding, one texture per job
+		auto decodeStart = std::chrono::high_resolution_clock::now();
+		if (decode)
+		{
+			ktx_transcode_fmt_e format = transcodeFormat;
+			workers.ParallelFor((unsigned)pending.size(), [&pending, format](unsigned i)
+			{
+				TRACE_SCOPE("Read texture");
+				pending[i].result = KtxTranscode::ReadTexture(pending[i].path, format, &pending[i].kTexture);
+			});
+		}
+		auto uploadStart = std::chrono::high_resolution_clock::now();
+		stats.decodeMilliseconds += std::chrono::duration<float, std::milli>(uploadStart - decodeStart).count();
+
+		FitBudget(pending);
+
+		// Every texture shares the staging buffer
+		VkDeviceSize stagingSize = 0, stagingAlignment = 1;
+		for (PENDING& texture : pending)
+		{
+			if (texture.result != KTX_error_code::KTX_SUCCESS)
+			{
+				std::cerr << "ERROR: TextureCache - Unable to read \"" << texture.path << "\"!\n";
+				continue;
+			}
+			// The view & set exist before the copies are recorded, so a failure never frees an image in use
+			if (CreateStagedImage(texture) && FinishEntry(texture.entry, texture.path))
+			{
+				texture.staged = true;
+				VkDeviceSize alignment = StagingAlignment(texture.kTexture);
+				texture.stagingOffset = (stagingSize + alignment - 1) / alignment * alignment;
+				stagingSize = texture.stagingOffset + texture.stagingBytes;
+				stagingAlignment = LeastCommonMultiple(stagingAlignment, alignment);
+			}
+			else
+				texture.result = KTX_error_code::KTX_OUT_OF_MEMORY;
+		}
+
+		if (stagingSize > 0 && !UploadStaged(pending, stagingSize, stagingAlignment))
+		{
+			for (PENDING& texture : pending)
+			{
+				if (!texture.staged)
+					continue;
+				DestroyResources(texture.entry);
+				texture.result = KTX_error_code::KTX_OUT_OF_MEMORY;
+			}
+		}
+		stats.uploadMilliseconds += std::chrono::duration<float, std::milli>(
+			std::chrono::high_resolution_clock::now() - uploadStart).count();
+
+		for (PENDING& texture : pending)
+		{
+			if (texture.kTexture != nullptr)
+				ktxTexture_Destroy(texture.kTexture);
+			texture.kTexture = nullptr;
+			if (texture.result != KTX_error_code::KTX_SUCCESS || !texture.staged)
+				continue;
+			residentBytes += texture.entry.bytes;
+
+			// Finer levels for a resident texture: its image is swapped once the transfer is done
+			if (texture.replaces != TEXTURE_CACHE_INVALID)
+			{
+				QueueReplacement(texture.replaces, texture.entry, &STATS::levelsRefined);
+				continue;
+			}
+
+			stats.loaded++;
+			stats.bytesLoaded += texture.entry.bytes;
+			texture.entry.id = ++nextEntryId;
+			texture.entry.uploading = true;
+			if (!freeEntries.empty())
+			{
+				texture.handle = freeEntries.back();
+				freeEntries.pop_back();
+				entries[texture.handle] = texture.entry;
+			}
+			else
+			{
+				texture.handle = (unsigned)entries.size();
+				entries.push_back(texture.entry);
+			}
+			lookup[texture.key] = texture.handle;
+
+			unsigned handle = texture.handle;
+			unsigned long long id = texture.entry.id;
+			transfers[currentTransfer].completions.push_back([this, handle, id](bool done)
+			{
+				ENTRY& entry = entries[handle];
+				if (entry.id != id)
+					return; // released while uploading
+				entry.uploading = false;
+				entry.failed = !done;
+			});
+		}
+	}
+
+	// Swaps replacement's image, view & set into the entry at handle once the frame's transfer has
+	// filled it. counter is the STATS field the swap counts toward
+	void QueueReplacement(unsigned handle, const ENTRY& replacement, unsigned STATS::* counter)
+	{
+		ENTRY& entry = entries[handle];
+		unsigned long long id = entry.id;
+		VkDeviceSize replacedBytes = entry.bytes;
+		entry.transferring = true;
+		retiringBytes += replacedBytes;
+		transfers[currentTransfer].completions.push_back([this, handle, id, replacement, replacedBytes, counter](bool done)
+		{
+			retiringBytes -= std::min(retiringBytes, replacedBytes);
+			ENTRY& entry = entries[handle];
+			bool live = entry.id == id;
+			if (live)
+				entry.transferring = false;
+			if (!done || !live)
+			{
+				// Never bound, so it can go right away
+				residentBytes -= std::min(residentBytes, replacement.bytes);
+				DestroyResources(replacement);
+				return;
+			}
+			ReplaceResources(entry, replacement);
+			stats.*counter += 1;
+		});
+	}
+
+	// The frame's transfer command buffer, begun on first use. Waits for its previous submit only if
+	// the caller did not check CanTransfer first
+	VkCommandBuffer Transfer()
+	{
+		if (transfers.empty())
+			return nullptr;
+		TRANSFER& transfer = transfers[currentTransfer];
+		if (transfer.submitted)
+			WaitTransfers();
+		if (!transfer.recording)
+		{
+			VkCommandBufferBeginInfo beginInfo = {};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			if (vkBeginCommandBuffer(transfer.commandBuffer, &beginInfo) != VkResult::VK_SUCCESS)
+				return nullptr;
+			transfer.recording = true;
+		}
+		return transfer.commandBuffer;
+	}
+
+	// Finishes every transfer whose fence has passed, oldest first, stopping at the first still running
+	void PollTransfers()
+	{
+		while (true)
+		{
+			TRANSFER* oldest = nullptr;
+			for (TRANSFER& transfer : transfers)
+				if (transfer.submitted && (oldest == nullptr || transfer.order < oldest->order))
+					oldest = &transfer;
+			if (oldest == nullptr || vkGetFenceStatus(device, oldest->fence) != VkResult::VK_SUCCESS)
+				return;
+			vkResetFences(device, 1, &oldest->fence);
+			oldest->submitted = false;
+			stagingUsed -= std::min(stagingUsed, oldest->stagingBytes);
+			oldest->stagingBytes = 0;
+			RunCompletions(*oldest, true);
+		}
+	}
+
+	void WaitTransfers()
+	{
+		for (TRANSFER& transfer : transfers)
+			if (transfer.submitted)
+				vkWaitForFences(device, 1, &transfer.fence, VK_TRUE, UINT64_MAX);
+		PollTransfers();
+	}
+
+	static void RunCompletions(TRANSFER& transfer, bool done)
+	{
+		std::vector<std::function<void(bool)>> completions;
+		completions.swap(transfer.completions);
+		for (std::function<void(bool)>& completion : completions)
+			completion(done);
+	}
+
+	void DestroyTransfers()
+	{
+		for (TRANSFER& transfer : transfers)
+		{
+			if (transfer.commandBuffer != nullptr)
+				vkFreeCommandBuffers(device, commandPool, 1, &transfer.commandBuffer);
+			if (transfer.fence != nullptr)
+				vkDestroyFence(device, transfer.fence, nullptr);
+		}
+		transfers.clear();
+		currentTransfer = 0;
+	}
+
+	// size bytes at alignment for the frame's transfer, from the staging ring. While the ring is full
+	// (or for a batch larger than it) the transfer gets a buffer of its own, freed once it is done
+	bool AllocateStaging(VkDeviceSize size, VkDeviceSize alignment, VkBuffer& buffer, VkDeviceSize& offset,
+		ktx_uint8_t*& mapped)
+	{
+		if (stagingRing == nullptr)
+			CreateStagingRing();
+		if (stagingRing != nullptr)
+		{
+			if (stagingUsed == 0)
+				stagingHead = 0;
+			VkDeviceSize start = (stagingHead + alignment - 1) / alignment * alignment;
+			if (start + size > stagingRingSize)
+				start = 0; // wraps, the end of the ring is skipped
+			VkDeviceSize taken = (start >= stagingHead ? start - stagingHead : stagingRingSize - stagingHead + start) + size;
+			if (stagingUsed + taken <= stagingRingSize)
+			{
+				stagingHead = (start + size) % stagingRingSize;
+				stagingUsed += taken;
+				transfers[currentTransfer].stagingBytes += taken;
+				buffer = stagingRing;
+				offset = start;
+				mapped = stagingRingMapped + start;
+				return true;
+			}
+		}
+
+		VkBuffer ownBuffer = nullptr;
+		VkDeviceMemory ownMemory = nullptr;
+		void* data = nullptr;
+		if (GvkHelper::create_buffer(physicalDevice, device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&ownBuffer, &ownMemory) != VkResult::VK_SUCCESS
+			|| vkMapMemory(device, ownMemory, 0, size, 0, &data) != VkResult::VK_SUCCESS)
+		{
+			std::cerr << "ERROR: TextureCache - Unable to create a " << size << " byte staging buffer!\n";
+			vkDestroyBuffer(device, ownBuffer, nullptr);
+			vkFreeMemory(device, ownMemory, nullptr);
+			return false;
+		}
+		if (memoryStats != nullptr)
+			memoryStats->Add(MEMORY_STAGING, size);
+		transfers[currentTransfer].completions.push_back([this, ownBuffer, ownMemory, size](bool)
+		{
+			DestroyStaging(ownBuffer, ownMemory, size);
+		});
+		buffer = ownBuffer;
+		offset = 0;
+		mapped = (ktx_uint8_t*)data;
+		return true;
+	}
+
+	// Host visible & mapped for the cache's lifetime, created with the first upload
+	void CreateStagingRing()
+	{
+		VkDeviceSize size = (VkDeviceSize)TEXTURE_STAGING_RING_MB * 1024 * 1024;
+		void* data = nullptr;
+		if (GvkHelper::create_buffer(physicalDevice, device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&stagingRing, &stagingRingMemory) != VkResult::VK_SUCCESS
+			|| vkMapMemory(device, stagingRingMemory, 0, size, 0, &data) != VkResult::VK_SUCCESS)
+		{
+			vkDestroyBuffer(device, stagingRing, nullptr);
+			vkFreeMemory(device, stagingRingMemory, nullptr);
+			stagingRing = nullptr;
+			stagingRingMemory = nullptr;
+			return;
+		}
+		stagingRingMapped = (ktx_uint8_t*)data;
+		stagingRingSize = size;
+		stagingHead = stagingUsed = 0;
+		if (memoryStats != nullptr)
+			memoryStats->Add(MEMORY_STAGING, size);
+	}
+
+	static bool IsPartialCandidate(ktxTexture* kTexture)
+	{
+		return kTexture->numDimensions == 2 && !kTexture->isArray && !kTexture->isCubemap
+			&& !kTexture->generateMipmaps && !ktxTexture_NeedsTranscoding(kTexture);
+	}
+
+	// Levels down to 1x1
+	static unsigned FullLevelCount(unsigned width, unsigned height)
+	{
+		unsigned levels = 1;
+		for (unsigned size = std::max(width, height); size > 1; size >>= 1)
+			levels++;
+		return levels;
+	}
+
+	// Block compressed formats cannot be blit destinations, neither can formats without linear filtering
+	bool CanGenerateLevels(VkFormat format) const
+	{
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+		VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT
+			| VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+		return (properties.optimalTilingFeatures & needed) == needed;
+	}
+
+	// Small enough to go into a texture array, these always keep every level
+	static inline bool IsArraySized(unsigned width, unsigned height)
+	{
+		return width <= TEXTURE_ARRAY_MAX_SIZE && height <= TEXTURE_ARRAY_MAX_SIZE;
+	}
+
+	bool IsPackable(const ENTRY& entry) const
+	{
+		return entry.refCount > 0 && entry.array == TEXTURE_CACHE_INVALID && !entry.refining
+			&& !entry.uploading && !entry.failed && !entry.transferring
+			&& entry.texture.viewType == VK_IMAGE_VIEW_TYPE_2D_ARRAY && entry.texture.layerCount == 1
+			&& entry.texture.depth == 1 && IsArraySized(entry.texture.width, entry.texture.height)
+			&& (!entry.partial || entry.baseLevel == 0);
+	}
+
+	// Picks each new texture's base level from its screen size, then makes room for the batch:
+	// first by dropping levels of resident textures, then by loading the new ones coarser
+	void FitBudget(std::vector<PENDING>& pending)
+	{
+		VkDeviceSize needed = 0;
+		for (PENDING& texture : pending)
+		{
+			if (texture.result != KTX_error_code::KTX_SUCCESS)
+				continue;
+			ktxTexture* kTexture = texture.kTexture;
+			if (texture.replaces == TEXTURE_CACHE_INVALID)
+			{
+				texture.baseLevel = IsPartialCandidate(kTexture) && !IsArraySized(kTexture->baseWidth, kTexture->baseHeight)
+					? BaseLevelForSize(kTexture->baseWidth, kTexture->baseHeight, kTexture->numLevels, texture.screenSize) : 0;
+			}
+			needed += DataBytes(kTexture, texture.baseLevel);
+		}
+		// Images a transfer is replacing are as good as gone
+		VkDeviceSize resident = residentBytes - std::min(residentBytes, retiringBytes);
+		if (resident + needed <= budget)
+			return;
+
+		std::vector<std::string> ignored;
+		for (ENTRY& entry : entries)
+			entry.neededPixels = 0.0f;
+		VkDeviceSize savedBudget = budget;
+		budget = needed < savedBudget ? savedBudget - needed : 0;
+		UpdateResidency(ignored);
+		budget = savedBudget;
+		CancelRefines(ignored);
+
+		bool lowered = true;
+		resident = residentBytes - std::min(residentBytes, retiringBytes);
+		while (resident + needed > budget && lowered)
+		{
+			lowered = false;
+			for (PENDING& texture : pending)
+			{
+				if (texture.result != KTX_error_code::KTX_SUCCESS || !IsPartialCandidate(texture.kTexture)
+					|| IsArraySized(texture.kTexture->baseWidth, texture.kTexture->baseHeight)
+					|| texture.baseLevel + 1 >= texture.kTexture->numLevels)
+					continue;
+				needed -= DataBytes(texture.kTexture, texture.baseLevel) - DataBytes(texture.kTexture, texture.baseLevel + 1);
+				texture.baseLevel++;
+				lowered = true;
+			}
+		}
+	}
+
+	// Bytes of kTexture's levels from baseLevel down, every layer & face
+	static VkDeviceSize DataBytes(ktxTexture* kTexture, unsigned baseLevel)
+	{
+		VkDeviceSize bytes = 0;
+		for (unsigned level = baseLevel; level < kTexture->numLevels; level++)
+			bytes += ktxTexture_GetImageSize(kTexture, level);
+		return bytes * kTexture->numLayers * kTexture->numFaces;
+	}
+
+	static VkDeviceSize GreatestCommonDivisor(VkDeviceSize a, VkDeviceSize b)
+	{
+		while (b != 0)
+		{
+			VkDeviceSize remainder = a % b;
+			a = b;
+			b = remainder;
+		}
+		return a;
+	}
+
+	static inline VkDeviceSize LeastCommonMultiple(VkDeviceSize a, VkDeviceSize b)
+	{
+		return a / GreatestCommonDivisor(a, b) * b;
+	}
+
+	// Copy offsets must be a multiple of the texel (or block) size, e.g. 3 for RGB8, & of 4. Every
+	// image of a texture starts at this alignment in its part of the staging buffer
+	VkDeviceSize StagingAlignment(ktxTexture* kTexture) const
+	{
+		VkDeviceSize alignment = std::max((VkDeviceSize)ktxTexture_GetElementSize(kTexture), (VkDeviceSize)1);
+		return LeastCommonMultiple(LeastCommonMultiple(alignment, 4), copyOffsetAlignment);
+	}
+
+	// Arrays & cubemaps become one 2D array image, a cubemap's faces its layers (the shaders sample
+	// every map as a Texture2DArray). Volume textures have no such view & are refused
+	bool CreateStagedImage(PENDING& texture)
+	{
+		ktxTexture* kTexture = texture.kTexture;
+		unsigned base = texture.baseLevel;
+		ENTRY& entry = texture.entry;
+		ktxVulkanTexture& vkTexture = entry.texture;
+		vkTexture = {};
+		vkTexture.imageFormat = ktxTexture_GetVkFormat(kTexture);
+		vkTexture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		vkTexture.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		vkTexture.width = std::max(kTexture->baseWidth >> base, 1u);
+		vkTexture.height = std::max(kTexture->baseHeight >> base, 1u);
+		vkTexture.depth = 1;
+		vkTexture.levelCount = kTexture->numLevels - base;
+		vkTexture.layerCount = kTexture->numLayers * kTexture->numFaces;
+		if (kTexture->numDimensions == 3 || ktxTexture_NeedsTranscoding(kTexture))
+		{
+			std::cerr << "ERROR: TextureCache - \"" << texture.path << "\" is a volume or untranscoded texture!\n";
+			return false;
+		}
+		if (vkTexture.imageFormat == VK_FORMAT_UNDEFINED || !KtxTranscode::IsSampleable(physicalDevice, vkTexture.imageFormat))
+		{
+			std::cerr << "ERROR: TextureCache - \"" << texture.path << "\" is in a format the device can not sample!\n";
+			return false;
+		}
+
+		// A generated chain cannot be re-read from the file, so those textures stay whole
+		texture.generateLevels = kTexture->numLevels == 1 && FullLevelCount(vkTexture.width, vkTexture.height) > 1
+			&& CanGenerateLevels(vkTexture.imageFormat);
+		if (texture.generateLevels)
+			vkTexture.levelCount = FullLevelCount(vkTexture.width, vkTexture.height);
+
+		entry.partial = IsPartialCandidate(kTexture) && !IsArraySized(kTexture->baseWidth, kTexture->baseHeight)
+			&& !texture.generateLevels;
+		entry.fullWidth = kTexture->baseWidth;
+		entry.fullHeight = kTexture->baseHeight;
+		entry.fullLevels = texture.generateLevels ? vkTexture.levelCount : kTexture->numLevels;
+		entry.fullBytes = DataBytes(kTexture, 0);
+		entry.baseLevel = entry.targetLevel = base;
+		entry.lastNeeded = currentFrame;
+
+		// One copy region per level, layer & face from base down, each packed at the staging alignment
+		VkDeviceSize alignment = StagingAlignment(kTexture);
+		VkDeviceSize elementSize = ktxTexture_GetElementSize(kTexture);
+		texture.images.clear();
+		texture.stagingBytes = 0;
+		for (unsigned level = base; level < kTexture->numLevels; level++)
+		{
+			STAGED_IMAGE image;
+			unsigned width = std::max(kTexture->baseWidth >> level, 1u);
+			unsigned height = std::max(kTexture->baseHeight >> level, 1u);
+			if (kTexture->isCompressed)
+			{
+				image.rowBytes = image.sourcePitch = ktxTexture_GetImageSize(kTexture, level);
+				image.rows = 1;
+			}
+			else
+			{
+				// KTX1 pads uncompressed rows to 4 bytes, which a copy can not skip, so they are packed here
+				image.rowBytes = width * elementSize;
+				image.sourcePitch = ktxTexture_GetRowPitch(kTexture, level);
+				image.rows = height;
+			}
+			image.region.imageExtent = { width, height, 1 };
+			for (unsigned layer = 0; layer < kTexture->numLayers; layer++)
+			{
+				for (unsigned face = 0; face < kTexture->numFaces; face++)
+				{
+					ktx_size_t offset = 0;
+					ktxTexture_GetImageOffset(kTexture, level, layer, face, &offset);
+					image.source = offset;
+					image.staging = texture.stagingBytes;
+					image.region.bufferOffset = image.staging;
+					image.region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - base,
+						layer * kTexture->numFaces + face, 1 };
+					texture.images.push_back(image);
+					texture.stagingBytes += (image.rowBytes * image.rows + alignment - 1) / alignment * alignment;
+				}
+			}
+		}
+
+		if (VkUtils::CreateImage(device, physicalDevice, vkTexture.width, vkTexture.height, vkTexture.levelCount,
+			vkTexture.imageFormat, TEXTURE_IMAGE_USAGE, &vkTexture.image, &vkTexture.deviceMemory,
+			vkTexture.layerCount) != VkResult::VK_SUCCESS)
+		{
+			ktxVulkanTexture_Destruct(&vkTexture, device, nullptr);
+			return false;
+		}
+		return true;
+	}
+
+	static VkImageMemoryBarrier LevelsBarrier(VkImage image, unsigned baseLevel, unsigned levelCount,
+		VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+		unsigned layerCount = 1)
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, baseLevel, levelCount, 0, layerCount };
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		return barrier;
+	}
+
+	// Copies every staged texture's data into the staging ring, then records all copies & transitions
+	// into the frame's transfer
+	bool UploadStaged(std::vector<PENDING>& pending, VkDeviceSize stagingSize, VkDeviceSize alignment)
+	{
+		TRACE_SCOPE("Upload textures");
+		VkCommandBuffer commandBuffer = Transfer();
+		VkBuffer stagingBuffer = nullptr;
+		VkDeviceSize stagingOffset = 0;
+		ktx_uint8_t* mapped = nullptr;
+		if (commandBuffer == nullptr || !AllocateStaging(stagingSize, alignment, stagingBuffer, stagingOffset, mapped))
+			return false;
+
+		workers.ParallelFor((unsigned)pending.size(), [&pending, mapped](unsigned i)
+		{
+			const PENDING& texture = pending[i];
+			if (!texture.staged)
+				return;
+			const ktx_uint8_t* data = ktxTexture_GetData(texture.kTexture);
+			ktx_uint8_t* destination = mapped + texture.stagingOffset;
+			for (const STAGED_IMAGE& image : texture.images)
+			{
+				if (image.sourcePitch == image.rowBytes)
+				{
+					memcpy(destination + image.staging, data + image.source, (size_t)(image.rowBytes * image.rows));
+					continue;
+				}
+				for (unsigned row = 0; row < image.rows; row++)
+					memcpy(destination + image.staging + row * image.rowBytes, data + image.source + row * image.sourcePitch,
+						(size_t)image.rowBytes);
+			}
+		});
+
+		// Every image goes to TRANSFER_DST in one barrier, is copied, then goes to SHADER_READ in one barrier
+		std::vector<VkImageMemoryBarrier> toTransfer, toShader;
+		for (PENDING& texture : pending)
+		{
+			if (!texture.staged)
+				continue;
+			const ktxVulkanTexture& vkTexture = texture.entry.texture;
+			toTransfer.push_back(LevelsBarrier(vkTexture.image, 0, vkTexture.levelCount, VK_IMAGE_LAYOUT_UNDEFINED,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT, vkTexture.layerCount));
+			if (texture.generateLevels)
+				continue; // GenerateLevels leaves them readable
+			toShader.push_back(LevelsBarrier(vkTexture.image, 0, vkTexture.levelCount, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+				vkTexture.layerCount));
+		}
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 0, nullptr, (uint32_t)toTransfer.size(), toTransfer.data());
+
+		std::vector<VkBufferImageCopy> regions;
+		for (PENDING& texture : pending)
+		{
+			if (!texture.staged)
+				continue;
+			regions.clear();
+			for (const STAGED_IMAGE& image : texture.images)
+			{
+				regions.push_back(image.region);
+				regions.back().bufferOffset += stagingOffset + texture.stagingOffset;
+			}
+			vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, texture.entry.texture.image,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+		}
+
+		for (PENDING& texture : pending)
+		{
+			if (!texture.staged || !texture.generateLevels)
+				continue;
+			GenerateLevels(commandBuffer, texture.entry.texture);
+			stats.levelsGenerated++;
+		}
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, (uint32_t)toShader.size(), toShader.data());
+		return true;
+	}
+
+	void DestroyStaging(VkBuffer buffer, VkDeviceMemory memory, VkDeviceSize size)
+	{
+		vkDestroyBuffer(device, buffer, nullptr);
+		vkFreeMemory(device, memory, nullptr);
+		if (memoryStats != nullptr)
+			memoryStats->Remove(MEMORY_STAGING, size);
+	}
+
+	// Linear blits each level from the one above it, every layer at once. The image starts in
+	// TRANSFER_DST with level 0 written & ends in SHADER_READ
+	static void GenerateLevels(VkCommandBuffer commandBuffer, const ktxVulkanTexture& vkTexture)
+	{
+		VkImage image = vkTexture.image;
+		unsigned layers = vkTexture.layerCount;
+		for (unsigned level = 1; level < vkTexture.levelCount; level++)
+		{
+			VkImageMemoryBarrier toSource = LevelsBarrier(image, level - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, layers);
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				0, 0, nullptr, 0, nullptr, 1, &toSource);
+
+			VkImageBlit blit = {};
+			blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, layers };
+			blit.srcOffsets[1] = { (int32_t)std::max(vkTexture.width >> (level - 1), 1u),
+				(int32_t)std::max(vkTexture.height >> (level - 1), 1u), 1 };
+			blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, layers };
+			blit.dstOffsets[1] = { (int32_t)std::max(vkTexture.width >> level, 1u),
+				(int32_t)std::max(vkTexture.height >> level, 1u), 1 };
+			vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+		}
+
+		// Every level but the last was a blit source
+		VkImageMemoryBarrier toShader[2] = {
+			LevelsBarrier(image, 0, vkTexture.levelCount - 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, layers),
+			LevelsBarrier(image, vkTexture.levelCount - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, layers) };
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 2, toShader);
+	}
+
+	// Copies the coarser levels into smaller images with the frame's transfer, each is swapped in once
+	// it has finished
+	void DropLevels(const std::vector<std::pair<unsigned, unsigned>>& evictions)
+	{
+		VkCommandBuffer commandBuffer = Transfer();
+		if (commandBuffer == nullptr)
+			return;
+
+		std::vector<ENTRY> smaller(evictions.size());
+		std::vector<bool> created(evictions.size(), false);
+		for (unsigned i = 0; i < evictions.size(); i++)
+		{
+			const ENTRY& entry = entries[evictions[i].first];
+			unsigned base = evictions[i].second;
+			ENTRY& replacement = smaller[i];
+			replacement.texture = entry.texture;
+			replacement.texture.image = nullptr;
+			replacement.texture.deviceMemory = nullptr;
+			replacement.texture.width = std::max(entry.fullWidth >> base, 1u);
+			replacement.texture.height = std::max(entry.fullHeight >> base, 1u);
+			replacement.texture.levelCount = entry.fullLevels - base;
+			if (VkUtils::CreateImage(device, physicalDevice, replacement.texture.width,
+				replacement.texture.height, replacement.texture.levelCount, replacement.texture.imageFormat,
+				TEXTURE_IMAGE_USAGE, &replacement.texture.image, &replacement.texture.deviceMemory) != VkResult::VK_SUCCESS)
+			{
+				ktxVulkanTexture_Destruct(&replacement.texture, device, nullptr);
+				continue;
+			}
+			created[i] = FinishEntry(replacement, entry.path);
+		}
+
+		// Frames already submitted may still be sampling the old images
+		std::vector<VkImageMemoryBarrier> before, after;
+		for (unsigned i = 0; i < evictions.size(); i++)
+		{
+			if (!created[i])
+				continue;
+			const ENTRY& entry = entries[evictions[i].first];
+			unsigned skipped = evictions[i].second - entry.baseLevel;
+			unsigned levelCount = smaller[i].texture.levelCount;
+			before.push_back(LevelsBarrier(entry.texture.image, skipped, levelCount, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT));
+			before.push_back(LevelsBarrier(smaller[i].texture.image, 0, levelCount, VK_IMAGE_LAYOUT_UNDEFINED,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT));
+			after.push_back(LevelsBarrier(entry.texture.image, skipped, levelCount, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT));
+			after.push_back(LevelsBarrier(smaller[i].texture.image, 0, levelCount, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT));
+		}
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 0, nullptr, (uint32_t)before.size(), before.data());
+
+		std::vector<VkImageCopy> regions;
+		for (unsigned i = 0; i < evictions.size(); i++)
+		{
+			if (!created[i])
+				continue;
+			const ENTRY& entry = entries[evictions[i].first];
+			unsigned skipped = evictions[i].second - entry.baseLevel;
+			regions.clear();
+			for (unsigned level = 0; level < smaller[i].texture.levelCount; level++)
+			{
+				VkImageCopy region = {};
+				region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, skipped + level, 0, 1 };
+				region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+				region.extent = { std::max(smaller[i].texture.width >> level, 1u),
+					std::max(smaller[i].texture.height >> level, 1u), 1 };
+				regions.push_back(region);
+			}
+			vkCmdCopyImage(commandBuffer, entry.texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				smaller[i].texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+		}
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, (uint32_t)after.size(), after.data());
+
+		for (unsigned i = 0; i < evictions.size(); i++)
+		{
+			if (!created[i])
+				continue;
+			residentBytes += smaller[i].bytes;
+			QueueReplacement(evictions[i].first, smaller[i], &STATS::levelsEvicted);
+		}
+	}
+
+	// Records copying every member (same format, size & levels) into a layer of one new array image
+	bool PackArray(const std::vector<unsigned>& members)
+	{
+		VkCommandBuffer commandBuffer = Transfer();
+		if (commandBuffer == nullptr)
+			return false;
+
+		ENTRY array;
+		array.texture = entries[members[0]].texture;
+		array.texture.image = nullptr;
+		array.texture.deviceMemory = nullptr;
+		array.texture.layerCount = (uint32_t)members.size();
+		array.refCount = (unsigned)members.size();
+		unsigned levelCount = array.texture.levelCount;
+		if (VkUtils::CreateImage(device, physicalDevice, array.texture.width, array.texture.height, levelCount,
+			array.texture.imageFormat, TEXTURE_IMAGE_USAGE, &array.texture.image, &array.texture.deviceMemory, array.texture.layerCount) != VkResult::VK_SUCCESS)
+		{
+			ktxVulkanTexture_Destruct(&array.texture, device, nullptr);
+			return false;
+		}
+		if (!FinishEntry(array, "texture array"))
+			return false;
+
+		// Frames already submitted may still be sampling the single images
+		std::vector<VkImageMemoryBarrier> before, after;
+		for (unsigned member : members)
+		{
+			VkImage image = entries[member].texture.image;
+			before.push_back(LevelsBarrier(image, 0, levelCount, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT));
+			after.push_back(LevelsBarrier(image, 0, levelCount, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT));
+		}
+		before.push_back(LevelsBarrier(array.texture.image, 0, levelCount, VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT, array.texture.layerCount));
+		after.push_back(LevelsBarrier(array.texture.image, 0, levelCount, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+			array.texture.layerCount));
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 0, nullptr, (uint32_t)before.size(), before.data());
+
+		std::vector<VkImageCopy> regions;
+		for (unsigned layer = 0; layer < members.size(); layer++)
+		{
+			regions.clear();
+			for (unsigned level = 0; level < levelCount; level++)
+			{
+				VkImageCopy region = {};
+				region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+				region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, layer, 1 };
+				region.extent = { std::max(array.texture.width >> level, 1u), std::max(array.texture.height >> level, 1u), 1 };
+				regions.push_back(region);
+			}
+			vkCmdCopyImage(commandBuffer, entries[members[layer]].texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				array.texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+		}
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, (uint32_t)after.size(), after.data());
+		residentBytes += array.bytes;
+
+		std::vector<unsigned long long> ids;
+		VkDeviceSize memberBytes = 0;
+		for (unsigned member : members)
+		{
+			entries[member].transferring = true;
+			ids.push_back(entries[member].id);
+			memberBytes += entries[member].bytes;
+		}
+		retiringBytes += memberBytes;
+		transfers[currentTransfer].completions.push_back([this, members, ids, array, memberBytes](bool done)
+		{
+			retiringBytes -= std::min(retiringBytes, memberBytes);
+			ENTRY packed = array;
+			packed.refCount = 0;
+			for (unsigned layer = 0; layer < members.size(); layer++)
+			{
+				ENTRY& entry = entries[members[layer]];
+				if (entry.id != ids[layer])
+					continue; // released while copying, its layer stays unused
+				entry.transferring = false;
+				if (done)
+					packed.refCount++;
+			}
+			if (packed.refCount == 0)
+			{
+				// Never bound, so it can go right away
+				residentBytes -= std::min(residentBytes, packed.bytes);
+				DestroyResources(packed);
+				return;
+			}
+
+			unsigned index;
+			if (!freeArrays.empty())
+			{
+				index = freeArrays.back();
+				freeArrays.pop_back();
+				arrays[index] = packed;
+			}
+			else
+			{
+				index = (unsigned)arrays.size();
+				arrays.push_back(packed);
+			}
+
+			// Members point at the array from now on, their own resources retire
+			for (unsigned layer = 0; layer < members.size(); layer++)
+			{
+				ENTRY& entry = entries[members[layer]];
+				if (entry.id != ids[layer])
+					continue;
+				Retire(entry);
+				residentBytes -= std::min(residentBytes, entry.bytes);
+				entry.texture = packed.texture;
+				entry.view = packed.view;
+				entry.descriptorSet = packed.descriptorSet;
+				entry.pool = nullptr;
+				entry.bytes = packed.bytes / members.size();
+				entry.partial = false;
+				entry.array = index;
+				entry.layer = layer;
+			}
+			stats.packed += packed.refCount;
+			descriptorVersion++;
+		});
+		return true;
+	}
+
+	// Moves replacement's image, view & set into entry, retiring entry's until frames in flight are done
+	void ReplaceResources(ENTRY& entry, const ENTRY& replacement)
+	{
+		Retire(entry);
+		residentBytes -= std::min(residentBytes, entry.bytes);
+
+		unsigned base = entry.fullLevels - replacement.texture.levelCount;
+		entry.texture = replacement.texture;
+		entry.view = replacement.view;
+		entry.descriptorSet = replacement.descriptorSet;
+		entry.pool = replacement.pool;
+		entry.bytes = replacement.bytes;
+		entry.baseLevel = base;
+		descriptorVersion++;
+	}
+
+	// Image view & descriptor set for a freshly uploaded image
+	bool FinishEntry(ENTRY& entry, const std::string& label)
+	{
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(device, entry.texture.image, &requirements);
+		entry.bytes = requirements.size;
+		if (entry.path.empty())
+			entry.path = CanonicalPath(label);
+
+		// The shaders sample every map as a Texture2DArray, so plain 2D textures get a one layer array view
+		if (entry.texture.viewType == VK_IMAGE_VIEW_TYPE_2D)
+			entry.texture.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+
+		// Textures are not directly accessed by the shaders and are abstracted
+		// by image views containing additional information and sub resource ranges.
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = entry.texture.image;
+		viewInfo.format = entry.texture.imageFormat;
+		viewInfo.viewType = entry.texture.viewType;
+		viewInfo.components = {
+			VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G,
+			VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A
+		};
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = entry.texture.levelCount;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = entry.texture.layerCount;
+		if (vkCreateImageView(device, &viewInfo, nullptr, &entry.view) != VkResult::VK_SUCCESS)
+		{
+			std::cerr << "ERROR: TextureCache - Failed to create image view (" << label << ")\n";
+			ktxVulkanTexture_Destruct(&entry.texture, device, nullptr);
+			return false;
+		}
+
+		if (!AllocateDescriptorSet(entry))
+		{
+			std::cerr << "ERROR: TextureCache - Failed to allocate descriptor set (" << label << ")\n";
+			vkDestroyImageView(device, entry.view, nullptr);
+			ktxVulkanTexture_Destruct(&entry.texture, device, nullptr);
+			return false;
+		}
+		if (sampler != nullptr)
+			WriteDescriptor(entry);
+		return true;
+	}
+
+	bool AllocateDescriptorSet(ENTRY& entry)
+	{
+		auto allocateStart = std::chrono::high_resolution_clock::now();
+		bool allocated = AllocateFromPools(entry);
+		stats.descriptorMilliseconds += std::chrono::duration<float, std::milli>(
+			std::chrono::high_resolution_clock::now() - allocateStart).count();
+		if (allocated)
+			stats.descriptorSets++;
+		return allocated;
+	}
+
+	bool AllocateFromPools(ENTRY& entry)
+	{
+		VkDescriptorSetAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocateInfo.descriptorSetCount = 1;
+		allocateInfo.pSetLayouts = &layout;
+
+		// Newest pool first, it is the one most likely to have room
+		for (auto pool = pools.rbegin(); pool != pools.rend(); ++pool)
+		{
+			allocateInfo.descriptorPool = *pool;
+			if (vkAllocateDescriptorSets(device, &allocateInfo, &entry.descriptorSet) == VkResult::VK_SUCCESS)
+			{
+				entry.pool = *pool;
+				return true;
+			}
+		}
+
+		VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, TEXTURE_CACHE_POOL_SIZE };
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+		poolInfo.maxSets = TEXTURE_CACHE_POOL_SIZE;
+		poolInfo.poolSizeCount = 1;
+		poolInfo.pPoolSizes = &poolSize;
+		VkDescriptorPool pool;
+		if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VkResult::VK_SUCCESS)
+			return false;
+		pools.push_back(pool);
+
+		allocateInfo.descriptorPool = pool;
+		if (vkAllocateDescriptorSets(device, &allocateInfo, &entry.descriptorSet) != VkResult::VK_SUCCESS)
+			return false;
+		entry.pool = pool;
+		return true;
+	}
+
+	// Queues entry's image, view & set for destruction once frames in flight are done with them
+	void Retire(const ENTRY& entry)
+	{
+		VkDevice owner = device;
+		ktxVulkanTexture texture = entry.texture;
+		VkImageView view = entry.view;
+		VkDescriptorSet descriptorSet = entry.descriptorSet;
+		VkDescriptorPool pool = entry.pool;
+		retired.Push(retireFrame, [owner, texture, view, descriptorSet, pool]() mutable
+		{
+			vkFreeDescriptorSets(owner, pool, 1, &descriptorSet);
+			vkDestroyImageView(owner, view, nullptr);
+			ktxVulkanTexture_Destruct(&texture, owner, nullptr);
+		});
+	}
+
+	// DestroyEntry, deferred until frames in flight are done with the resources
+	void RetireEntry(ENTRY& entry)
+	{
+		if (entry.array != TEXTURE_CACHE_INVALID)
+		{
+			unsigned index = entry.array;
+			entry = ENTRY();
+			if (--arrays[index].refCount == 0)
+			{
+				RetireEntry(arrays[index]);
+				freeArrays.push_back(index);
+			}
+			return;
+		}
+
+		residentBytes -= std::min(residentBytes, entry.bytes);
+		Retire(entry);
+		entry = ENTRY();
+	}
+
+	void DestroyEntry(ENTRY& entry)
+	{
+		// Packed textures share their array's resources, the last layer released destroys them
+		if (entry.array != TEXTURE_CACHE_INVALID)
+		{
+			unsigned index = entry.array;
+			entry = ENTRY();
+			if (--arrays[index].refCount == 0)
+			{
+				DestroyEntry(arrays[index]);
+				freeArrays.push_back(index);
+			}
+			return;
+		}
+
+		residentBytes -= std::min(residentBytes, entry.bytes);
+		DestroyResources(entry);
+		entry = ENTRY();
+	}
+
+	// Right away, for resources no frame in flight can be using
+	void DestroyResources(ENTRY entry)
+	{
+		vkFreeDescriptorSets(device, entry.pool, 1, &entry.descriptorSet);
+		vkDestroyImageView(device, entry.view, nullptr);
+		ktxVulkanTexture_Destruct(&entry.texture, device, nullptr);
+	}
+};
+
+#endif
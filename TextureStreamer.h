@@ -0,0 +1,206 @@
+#ifndef _TEXTURESTREAMER_H_
+#define _TEXTURESTREAMER_H_
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include "ktx.h"
+#include "KtxTranscode.h"
+#include "Trace.h"
+
+/**
+ * Reads texture files on a background thread, nearest to the viewer first.
+ * Requests carry the world positions that use the texture; every time the thread picks its next
+ * file it takes the request closest to the latest viewer position. Finished files wait in a ready
+ * list until the render thread takes them at a frame boundary & uploads them (see TextureCache).
+ * Queueing a new set of requests (a level change) drops everything from the previous set.
+ */
+class TextureStreamer
+{
+public:
+	struct POSITION
+	{
+		float x, y, z;
+	};
+
+	struct REQUEST
+	{
+		unsigned id; // the caller's, handed back with the result
+		std::string path;
+		std::vector<POSITION> positions;
+	};
+
+	struct DECODED
+	{
+		unsigned id;
+		std::string path;
+		ktxTexture* kTexture; // null if the file could not be read, owned by whoever takes it
+		float milliseconds; // the read & transcode
+	};
+
+private:
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+	bool busy = false; // a file is being read
+	unsigned generation = 0; // bumped by Queue, stale reads are dropped
+	POSITION viewer = {};
+	ktx_transcode_fmt_e transcodeFormat = KTX_TTF_RGBA32;
+	std::vector<REQUEST> requests;
+	std::vector<DECODED> ready;
+
+public:
+	~TextureStreamer()
+	{
+		Stop();
+	}
+
+	// Basis supercompressed files are transcoded to format on the streaming thread
+	void Start(ktx_transcode_fmt_e format = KTX_TTF_RGBA32)
+	{
+		Stop();
+		transcodeFormat = format;
+		stopping = false;
+		thread = std::thread([this]() { StreamLoop(); });
+	}
+
+	// Joins the thread & frees anything read but not taken
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		if (thread.joinable())
+			thread.join();
+		DropReady();
+		requests.clear();
+	}
+
+	// Replaces the outstanding requests, results of the old ones are discarded
+	void Queue(std::vector<REQUEST> _requests)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			generation++;
+			DropReady();
+			requests = std::move(_requests);
+		}
+		wake.notify_all();
+	}
+
+	inline void Cancel() { Queue({}); }
+
+	// Adds to the outstanding requests
+	void Add(REQUEST request)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			requests.push_back(std::move(request));
+		}
+		wake.notify_all();
+	}
+
+	void SetViewer(float x, float y, float z)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		viewer = { x, y, z };
+	}
+
+	// Moves up to maxCount finished files into decoded, the caller now owns their kTextures
+	void TakeReady(std::vector<DECODED>& decoded, unsigned maxCount)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		unsigned count = std::min((unsigned)ready.size(), maxCount);
+		decoded.insert(decoded.end(), ready.begin(), ready.begin() + count);
+		ready.erase(ready.begin(), ready.begin() + count);
+	}
+
+	// Requests not yet taken by TakeReady
+	unsigned GetOutstandingCount()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return (unsigned)(requests.size() + ready.size()) + (busy ? 1 : 0);
+	}
+
+private:
+	void StreamLoop()
+	{
+		Trace::SetThreadName("Texture streamer");
+		while (true)
+		{
+			REQUEST request;
+			unsigned requestGeneration;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !requests.empty(); });
+				if (stopping)
+					return;
+
+				unsigned nearest = NearestRequest();
+				request = std::move(requests[nearest]);
+				requests[nearest] = std::move(requests.back());
+				requests.pop_back();
+				requestGeneration = generation;
+				busy = true;
+			}
+
+			ktxTexture* kTexture = nullptr;
+			auto readStart = std::chrono::high_resolution_clock::now();
+			{
+				TRACE_SCOPE("Stream texture");
+				KtxTranscode::ReadTexture(request.path, transcodeFormat, &kTexture);
+			}
+			float readTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - readStart).count();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			busy = false;
+			if (requestGeneration != generation || stopping)
+			{
+				if (kTexture != nullptr)
+					ktxTexture_Destroy(kTexture);
+				continue;
+			}
+			ready.push_back({ request.id, request.path, kTexture, readTime });
+		}
+	}
+
+	// Call with the mutex held
+	unsigned NearestRequest() const
+	{
+		unsigned nearest = 0;
+		float nearestDistance = FLT_MAX;
+		for (unsigned i = 0; i < requests.size(); i++)
+		{
+			float distance = FLT_MAX;
+			for (const POSITION& position : requests[i].positions)
+			{
+				float x = position.x - viewer.x, y = position.y - viewer.y, z = position.z - viewer.z;
+				distance = std::min(distance, x * x + y * y + z * z);
+			}
+			if (distance < nearestDistance || i == 0)
+			{
+				nearest = i;
+				nearestDistance = distance;
+			}
+		}
+		return nearest;
+	}
+
+	// Call with the mutex held (or the thread joined)
+	void DropReady()
+	{
+		for (DECODED& decoded : ready)
+			if (decoded.kTexture != nullptr)
+				ktxTexture_Destroy(decoded.kTexture);
+		ready.clear();
+	}
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <queue>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include "Trace.h"
+
+// Fixed set of worker threads pulling jobs from a shared queue
+class ThreadPool
+{
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+	std::mutex jobMutex;
+	std::condition_variable jobAvailable;
+	bool stopping = false;
+
+public:
+	~ThreadPool()
+	{
+		Stop();
+	}
+
+	// workerCount of 0 leaves one hardware thread for the caller
+	void Start(unsigned workerCount = 0)
+	{
+		Stop();
+		if (workerCount == 0)
+			workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+		stopping = false;
+		for (unsigned i = 0; i < workerCount; i++)
+			workers.emplace_back([this]() { WorkerLoop(); });
+	}
+
+	// Finishes the queued jobs then joins every worker
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			stopping = true;
+		}
+		jobAvailable.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+		workers.clear();
+	}
+
+	void Enqueue(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			jobs.push(std::move(job));
+		}
+		jobAvailable.notify_one();
+	}
+
+	// Runs job(i) for every i in [0, count) on the workers and the calling thread, returns once all are done
+	void ParallelFor(unsigned count, const std::function<void(unsigned)>& job)
+	{
+		if (count == 0)
+			return;
+
+		std::atomic<unsigned> next(0);
+		auto run = [&]() {
+			for (unsigned i = next++; i < count; i = next++)
+				job(i);
+		};
+
+		unsigned helperCount = std::min((unsigned)workers.size(), count - 1);
+		std::mutex doneMutex;
+		std::condition_variable doneCondition;
+		unsigned helpersDone = 0;
+		for (unsigned i = 0; i < helperCount; i++)
+		{
+			Enqueue([&]() {
+				run();
+				// notify under the lock, the condition variable dies with this stack frame
+				std::lock_guard<std::mutex> lock(doneMutex);
+				++helpersDone;
+				doneCondition.notify_one();
+			});
+		}
+
+		run();
+
+		std::unique_lock<std::mutex> lock(doneMutex);
+		doneCondition.wait(lock, [&]() { return helpersDone == helperCount; });
+	}
+
+	inline unsigned GetWorkerCount() const { return (unsigned)workers.size(); }
+
+private:
+	void WorkerLoop()
+	{
+		Trace::SetThreadName("Worker");
+		while (true)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(jobMutex);
+				jobAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop();
+			}
+			job();
+		}
+	}
+};
+
+#endif
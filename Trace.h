@@ -0,0 +1,225 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+
+// Events a thread can record per capture, later ones are dropped
+#define TRACE_BUFFER_EVENTS 16384
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// Times the rest of the enclosing block, name must outlive the capture (a string literal)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+/**
+ * Scoped timeline events, written as Chrome trace JSON (opens in Perfetto & chrome://tracing).
+ * Each thread appends to its own fixed buffer with no locks: only the owner writes a buffer & it
+ * publishes each event with a release store of the count, so Write can read while threads still
+ * run. Buffers of finished threads are kept until the next Start, then reused. When no capture is
+ * running a scope is a single relaxed atomic load.
+ */
+namespace Trace
+{
+	struct EVENT
+	{
+		const char* name;
+		uint64_t start; // nanoseconds since the trace epoch
+		uint64_t duration;
+	};
+
+	struct BUFFER
+	{
+		EVENT events[TRACE_BUFFER_EVENTS];
+		std::atomic<unsigned> count{ 0 };
+		std::atomic<unsigned> dropped{ 0 };
+		std::atomic<unsigned> generation{ 0 }; // capture the events belong to
+		unsigned id = 0;
+		const char* threadName = nullptr;
+		bool owned = true; // a live thread writes to it
+	};
+
+	struct STATE
+	{
+		std::atomic<bool> enabled{ false };
+		std::atomic<unsigned> generation{ 0 };
+		std::mutex mutex; // buffer registry only, never taken per event
+		std::vector<std::unique_ptr<BUFFER>> buffers;
+		std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	};
+
+	inline STATE& GetState()
+	{
+		static STATE state;
+		return state;
+	}
+
+	inline bool IsEnabled()
+	{
+		return GetState().enabled.load(std::memory_order_relaxed);
+	}
+
+	inline uint64_t Now()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - GetState().epoch).count();
+	}
+
+	// Hands a finished thread's buffer back, its events stay until the next capture
+	struct THREAD
+	{
+		BUFFER* buffer = nullptr;
+		const char* name = nullptr;
+		~THREAD()
+		{
+			if (buffer == nullptr)
+				return;
+			std::lock_guard<std::mutex> lock(GetState().mutex);
+			buffer->owned = false;
+		}
+	};
+
+	inline THREAD& GetThread()
+	{
+		static thread_local THREAD thread;
+		return thread;
+	}
+
+	// Call at the top of a thread, before it records anything
+	inline void SetThreadName(const char* name)
+	{
+		GetThread().name = name;
+	}
+
+	inline BUFFER* ThreadBuffer()
+	{
+		THREAD& thread = GetThread();
+		if (thread.buffer != nullptr)
+			return thread.buffer;
+
+		STATE& state = GetState();
+		std::lock_guard<std::mutex> lock(state.mutex);
+		unsigned generation = state.generation.load();
+		for (std::unique_ptr<BUFFER>& buffer : state.buffers)
+		{
+			if (!buffer->owned && buffer->generation.load() != generation)
+			{
+				thread.buffer = buffer.get();
+				break;
+			}
+		}
+		if (thread.buffer == nullptr)
+		{
+			state.buffers.emplace_back(new BUFFER());
+			thread.buffer = state.buffers.back().get();
+			thread.buffer->id = (unsigned)state.buffers.size();
+		}
+		thread.buffer->owned = true;
+		thread.buffer->threadName = thread.name;
+		return thread.buffer;
+	}
+
+	inline void Record(const char* name, uint64_t start, uint64_t end)
+	{
+		BUFFER* buffer = ThreadBuffer();
+		unsigned generation = GetState().generation.load(std::memory_order_acquire);
+		if (buffer->generation.load(std::memory_order_relaxed) != generation)
+		{
+			buffer->count.store(0, std::memory_order_relaxed);
+			buffer->dropped.store(0, std::memory_order_relaxed);
+			buffer->generation.store(generation, std::memory_order_release);
+		}
+
+		unsigned count = buffer->count.load(std::memory_order_relaxed);
+		if (count >= TRACE_BUFFER_EVENTS)
+		{
+			buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		buffer->events[count] = { name, start, end - start };
+		buffer->count.store(count + 1, std::memory_order_release);
+	}
+
+	class Scope
+	{
+		const char* name;
+		uint64_t start;
+
+	public:
+		explicit Scope(const char* _name)
+			: name(IsEnabled() ? _name : nullptr), start(name != nullptr ? Now() : 0) {}
+		~Scope()
+		{
+			if (name != nullptr)
+				Record(name, start, Now());
+		}
+	};
+
+	// Drops the previous capture's events & starts recording
+	inline void Start()
+	{
+		STATE& state = GetState();
+		state.generation.fetch_add(1, std::memory_order_release);
+		state.enabled.store(true, std::memory_order_relaxed);
+	}
+
+	inline void Stop()
+	{
+		GetState().enabled.store(false, std::memory_order_relaxed);
+	}
+
+	// The current (or last) capture's events, scopes still open are left out
+	inline bool Write(const char* path)
+	{
+		std::ofstream file(path);
+		if (!file.is_open())
+		{
+			std::cerr << "ERROR: Trace - Unable to write \"" << path << "\"!\n";
+			return false;
+		}
+
+		STATE& state = GetState();
+		std::lock_guard<std::mutex> lock(state.mutex);
+		unsigned generation = state.generation.load(std::memory_order_acquire);
+		unsigned eventCount = 0, dropped = 0;
+		bool first = true;
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		file.setf(std::ios::fixed);
+		file.precision(3);
+		for (std::unique_ptr<BUFFER>& buffer : state.buffers)
+		{
+			if (buffer->generation.load(std::memory_order_acquire) != generation)
+				continue;
+			unsigned count = buffer->count.load(std::memory_order_acquire);
+			if (buffer->threadName != nullptr)
+			{
+				file << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+					<< ",\"args\":{\"name\":\"" << buffer->threadName << "\"}}";
+				first = false;
+			}
+			for (unsigned i = 0; i < count; i++)
+			{
+				const EVENT& event = buffer->events[i];
+				file << (first ? "" : ",") << "\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+					<< buffer->id << ",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << event.duration / 1000.0 << "}";
+				first = false;
+			}
+			eventCount += count;
+			dropped += buffer->dropped.load(std::memory_order_relaxed);
+		}
+		file << "\n]}\n";
+
+		std::cout << "Trace written to " << path << " (" << eventCount << " events";
+		if (dropped > 0)
+			std::cout << ", " << dropped << " dropped";
+		std::cout << ")\n";
+		return true;
+	}
+}
+
+#endif
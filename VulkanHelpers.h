@@ -0,0 +1,160 @@
+#ifndef _VULKANHELPERS_H_
+#define _VULKANHELPERS_H_
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include "../Gateware/Gateware/Gateware.h"
+
+// Small Vulkan helpers that GvkHelper does not cover (images, views & barriers)
+namespace VkUtils
+{
+	// Finds a memory type allowed by typeFilter that has every requested property
+	inline bool FindMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter,
+		VkMemoryPropertyFlags properties, uint32_t& memoryTypeIndex)
+	{
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+		{
+			if ((typeFilter & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			{
+				memoryTypeIndex = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Creates a 2D image (or 2D array) backed by its own device local allocation
+	inline VkResult CreateImage(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t width, uint32_t height,
+		uint32_t mipLevels, VkFormat format, VkImageUsageFlags usage, VkImage* image, VkDeviceMemory* memory,
+		uint32_t arrayLayers = 1)
+	{
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = format;
+		imageInfo.extent = { width, height, 1 };
+		imageInfo.mipLevels = mipLevels;
+		imageInfo.arrayLayers = arrayLayers;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = usage;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		VkResult res = vkCreateImage(device, &imageInfo, nullptr, image);
+		if (res != VkResult::VK_SUCCESS)
+			return res;
+
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(device, *image, &requirements);
+
+		VkMemoryAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocateInfo.allocationSize = requirements.size;
+		if (!FindMemoryType(physicalDevice, requirements.memoryTypeBits,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocateInfo.memoryTypeIndex))
+			return VkResult::VK_ERROR_OUT_OF_DEVICE_MEMORY;
+
+		res = vkAllocateMemory(device, &allocateInfo, nullptr, memory);
+		if (res != VkResult::VK_SUCCESS)
+			return res;
+
+		return vkBindImageMemory(device, *image, *memory, 0);
+	}
+
+	// Creates a 2D view over a range of mip levels
+	inline VkResult CreateImageView(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspectMask,
+		uint32_t baseMipLevel, uint32_t levelCount, VkImageView* view)
+	{
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = format;
+		viewInfo.components = {
+			VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G,
+			VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A
+		};
+		viewInfo.subresourceRange.aspectMask = aspectMask;
+		viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+		viewInfo.subresourceRange.levelCount = levelCount;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+		return vkCreateImageView(device, &viewInfo, nullptr, view);
+	}
+
+	// Records a layout transition / memory dependency for a range of mip levels
+	inline void ImageBarrier(VkCommandBuffer commandBuffer, VkImage image, VkImageAspectFlags aspectMask,
+		uint32_t baseMipLevel, uint32_t levelCount, VkImageLayout oldLayout, VkImageLayout newLayout,
+		VkAccessFlags srcAccess, VkAccessFlags dstAccess, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = aspectMask;
+		barrier.subresourceRange.baseMipLevel = baseMipLevel;
+		barrier.subresourceRange.levelCount = levelCount;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	inline bool SupportsDeviceExtension(VkPhysicalDevice physicalDevice, const char* extensionName)
+	{
+		uint32_t count = 0;
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, nullptr);
+		std::vector<VkExtensionProperties> extensions(count);
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, extensions.data());
+		for (const VkExtensionProperties& extension : extensions)
+			if (strcmp(extension.extensionName, extensionName) == 0)
+				return true;
+		return false;
+	}
+
+	inline bool SupportsInstanceExtension(const char* extensionName)
+	{
+		uint32_t count = 0;
+		vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
+		std::vector<VkExtensionProperties> extensions(count);
+		vkEnumerateInstanceExtensionProperties(nullptr, &count, extensions.data());
+		for (const VkExtensionProperties& extension : extensions)
+			if (strcmp(extension.extensionName, extensionName) == 0)
+				return true;
+		return false;
+	}
+
+	// Device local memory this process may use & is using. With VK_EXT_memory_budget the driver's
+	// live numbers are returned, otherwise budget is the size of the device local heaps & usage is 0
+	inline bool QueryDeviceLocalBudget(VkPhysicalDevice physicalDevice, bool memoryBudgetSupported,
+		VkDeviceSize& budget, VkDeviceSize& usage)
+	{
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+		budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+		VkPhysicalDeviceMemoryProperties2 memoryProperties = {};
+		memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		memoryProperties.pNext = memoryBudgetSupported ? &budgetProperties : nullptr;
+		vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &memoryProperties);
+
+		budget = 0;
+		usage = 0;
+		const VkPhysicalDeviceMemoryProperties& properties = memoryProperties.memoryProperties;
+		for (uint32_t i = 0; i < properties.memoryHeapCount; i++)
+		{
+			if ((properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) == 0)
+				continue;
+			budget += memoryBudgetSupported ? budgetProperties.heapBudget[i] : properties.memoryHeaps[i].size;
+			usage += memoryBudgetSupported ? budgetProperties.heapUsage[i] : 0;
+		}
+		return memoryBudgetSupported;
+	}
+}
+
+#endif
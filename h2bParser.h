@@ -4,6 +4,7 @@
 #include <vector>
 #include <set>
 #include "GraphicsObjects.h"
+#include "Trace.h"
 
 namespace H2B {
 	class Parser
@@ -14,6 +15,7 @@ namespace H2B {
 		graphics::MODEL model;
 		bool Parse(const char* h2bPath)
 		{
+			TRACE_SCOPE("H2B::Parser::Parse");
 			Clear();
 			std::ifstream file;
 			char buffer[260] = { 0, };
@@ -13,15 +13,206 @@
 // With what we want & what we don't defined we can include the API
 #include "../Gateware/Gateware/Gateware.h"
 #include "renderer.h"
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
 
 // open some namespaces to compact the code a bit
 using namespace GW;
 using namespace CORE;
 using namespace SYSTEM;
 using namespace GRAPHICS;
+
+// Longest a --load-report run waits for the level's textures before reporting a failed load
+#define LOAD_REPORT_TIMEOUT_SECONDS 600
+
+// --headless defaults, the size matches the window's
+#define HEADLESS_FRAMES 600
+#define HEADLESS_WIDTH 800
+#define HEADLESS_HEIGHT 600
+#define HEADLESS_CAPTURE_PATH "headless_%05u.ppm" // frame number
+
+// Frame times, draw counts & phase timings of a --replay run
+#define REPLAY_REPORT_PATH "replay_report.json"
+
+// One recorded frame per rendered frame, whatever the frame took to record or to render
+void ApplyReplayFrame(Renderer& renderer, const CameraPath::FRAME& frame)
+{
+	renderer.SetCameraWorld(frame.camera);
+	renderer.SetLightDirection(frame.lightDirection);
+}
+
+void FinishReplay(Renderer& renderer, const ReplayStats& stats)
+{
+	stats.Print(std::cout);
+	if (stats.Write(REPLAY_REPORT_PATH, renderer.GetProfiler()))
+		std::cout << "Replay report written to " << REPLAY_REPORT_PATH << "\n";
+}
+
+// Renders level offscreen for frameCount frames while the level's first camera turns a full circle in
+// place (or every frame of path when replaying), after its textures are in so every run (& every
+// capture) sees the same residency. Every captureInterval frames (& the last) is written as a PPM.
+// Frame timings go to frame_profile.csv/json
+int RunHeadless(const std::string& level, unsigned frameCount, unsigned width, unsigned height, unsigned captureInterval,
+	const CameraPath* path)
+{
+#ifndef NDEBUG
+	const char* debugLayers[] = { "VK_LAYER_KHRONOS_validation" };
+	unsigned int debugLayerCount = 1;
+#else
+	const char** debugLayers = nullptr;
+	unsigned int debugLayerCount = 0;
+#endif
+	OffscreenSurface surface;
+	if (!surface.Create(width, height, debugLayerCount, debugLayers))
+	{
+		surface.Destroy();
+		return 1;
+	}
+
+	int exitCode = 0;
+	{
+		VkClearValue clrAndDepth[2];
+		clrAndDepth[0].color = { {0.25f, 0.06f, 0.09f, 1} };
+		clrAndDepth[1].depthStencil = { 1.0f, 0u };
+		Renderer renderer(surface, level);
+		Profiler& profiler = renderer.GetProfiler();
+		GW::MATH::GMATRIXF start = renderer.GetLevelCamera();
+		ReplayStats replayStats;
+		if (path != nullptr)
+		{
+			frameCount = path->GetFrameCount();
+			start = path->GetFrame(0).camera;
+		}
+
+		auto loadStart = std::chrono::steady_clock::now();
+		while (!renderer.GetLoadReport().IsFinished())
+		{
+			if (std::chrono::steady_clock::now() - loadStart > std::chrono::seconds(LOAD_REPORT_TIMEOUT_SECONDS))
+			{
+				std::cerr << "ERROR: Level textures still loading after " << LOAD_REPORT_TIMEOUT_SECONDS << "s\n";
+				exitCode = 1;
+				break;
+			}
+			renderer.SetCameraWorld(start);
+			if (!surface.StartFrame(2, clrAndDepth))
+				break;
+			renderer.Render();
+			surface.EndFrame();
+			renderer.EndFrame();
+		}
+		if (!renderer.GetLoadReport().IsSucceeded())
+			exitCode = 1;
+
+		for (unsigned frame = 0; frame < frameCount && exitCode == 0; frame++)
+		{
+			auto frameStart = std::chrono::high_resolution_clock::now();
+			if (path != nullptr)
+				ApplyReplayFrame(renderer, path->GetFrame(frame));
+			else
+			{
+				GW::MATH::GMATRIXF camera;
+				GW::MATH::GMatrix::RotateYLocalF(start, (float)(G_PI * 2.0 * frame / frameCount), camera);
+				renderer.SetCameraWorld(camera);
+			}
+			if (!surface.StartFrame(2, clrAndDepth))
+			{
+				exitCode = 1;
+				break;
+			}
+			{
+				Profiler::Scope timer(profiler, "Render");
+				renderer.Render();
+			}
+			bool capture = captureInterval > 0 && (frame % captureInterval == 0 || frame + 1 == frameCount);
+			char capturePath[64];
+			if (capture)
+				snprintf(capturePath, sizeof(capturePath), HEADLESS_CAPTURE_PATH, frame);
+			{
+				Profiler::Scope timer(profiler, "Submit");
+				if (!surface.EndFrame(capture ? capturePath : nullptr))
+					exitCode = 1;
+			}
+			renderer.EndFrame();
+			if (path != nullptr)
+				replayStats.AddFrame(std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count(),
+					path->GetFrame(frame).delta, renderer.GetCullingStats(), renderer.GetDrawStats());
+		}
+
+		if (path != nullptr)
+			FinishReplay(renderer, replayStats);
+		if (profiler.WriteCsv(PROFILE_CSV_PATH) && profiler.WriteJson(PROFILE_JSON_PATH))
+			std::cout << "Frame timings written to " << PROFILE_CSV_PATH << " & " << PROFILE_JSON_PATH << "\n";
+	}
+	surface.Destroy();
+	return exitCode;
+}
+
 // lets pop a window and use Vulkan to clear to a red screen
-int main()
+int main(int argc, char** argv)
 {
+	Trace::SetThreadName("Main");
+
+	// --load-report <level> [report.json]: loads the level with no prompt, writes its load report once the
+	// textures are in & exits, non zero if the load failed. For catching load time regressions in CI
+	// --headless [level] [--frames n] [--size WxH] [--capture n]: no window, see RunHeadless
+	// --replay <camera_path.bin>: the camera & light follow a path recorded with F7 in the level it was
+	// recorded in, once its textures are in, then the replay report is written & the run exits
+	std::string reportLevel, reportPath, levelPath, replayPath;
+	bool headless = false;
+	unsigned headlessFrames = HEADLESS_FRAMES, headlessWidth = HEADLESS_WIDTH, headlessHeight = HEADLESS_HEIGHT;
+	unsigned captureInterval = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--load-report") == 0 && i + 1 < argc)
+		{
+			reportLevel = argv[++i];
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				reportPath = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--headless") == 0)
+		{
+			headless = true;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				levelPath = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+			replayPath = argv[++i];
+		else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			headlessFrames = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+		else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+		{
+			if (sscanf(argv[++i], "%ux%u", &headlessWidth, &headlessHeight) != 2 || headlessWidth == 0 || headlessHeight == 0)
+			{
+				std::cerr << "ERROR: --size expects WIDTHxHEIGHT\n";
+				return 1;
+			}
+		}
+		else if (std::strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+			captureInterval = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+	}
+	CameraPath replay;
+	if (!replayPath.empty())
+	{
+		if (!replay.Load(replayPath.c_str()) || replay.GetFrameCount() == 0)
+			return 1;
+		if (levelPath.empty())
+			levelPath = replay.GetLevel();
+		else if (levelPath != replay.GetLevel())
+			std::cout << "Replaying a path recorded in " << replay.GetLevel() << " in " << levelPath << "\n";
+	}
+	if (headless)
+	{
+		if (levelPath.empty())
+		{
+			std::cerr << "ERROR: --headless needs a level (or a --replay path)\n";
+			return 1;
+		}
+		return RunHeadless(levelPath, headlessFrames, headlessWidth, headlessHeight, captureInterval,
+			replayPath.empty() ? nullptr : &replay);
+	}
+	int exitCode = reportLevel.empty() ? 0 : 1; // a report run only succeeds once its report does
+
 	GWindow win;
 	GEventResponder msgs;
 	GVulkanSurface vulkan;
@@ -43,26 +234,93 @@ int main()
 			//"VK_LAYER_LUNARG_standard_validation", // add if not on MacOS
 			"VK_LAYER_RENDERDOC_Capture" // add this if you have installed RenderDoc
 		};
+		// Labels the profiler's GPU scopes for RenderDoc & the validation layers
+		const char* debugExtensions[] = { VK_EXT_DEBUG_UTILS_EXTENSION_NAME };
+		unsigned int debugExtensionCount = VkUtils::SupportsInstanceExtension(debugExtensions[0]) ? 1 : 0;
 		if (+vulkan.Create(	win, GW::GRAPHICS::DEPTH_BUFFER_SUPPORT, 
 							sizeof(debugLayers)/sizeof(debugLayers[0]),
-							debugLayers, 0, nullptr, 0, nullptr, false))
+							debugLayers, debugExtensionCount, debugExtensions, 0, nullptr, false))
 #else
 		if (+vulkan.Create(win, GW::GRAPHICS::DEPTH_BUFFER_SUPPORT))
 #endif
 		{
-			Renderer renderer(win, vulkan);
+			Renderer renderer(win, vulkan, REND_DEFAULT_LIGHT, reportLevel.empty() ? levelPath : reportLevel);
+			Profiler& profiler = renderer.GetProfiler();
+			auto reportStart = std::chrono::steady_clock::now();
+			ReplayStats replayStats;
+			unsigned replayFrame = 0;
 			while (+win.ProcessWindowEvents())
 			{
-				if (+vulkan.StartFrame(2, clrAndDepth))
+				// Frames before the level's textures are in hold the path's first frame & aren't counted
+				bool replaying = !replayPath.empty();
+				bool replayCounted = replaying && renderer.GetLoadReport().IsFinished();
+				if (replaying && replayFrame == replay.GetFrameCount())
+				{
+					FinishReplay(renderer, replayStats);
+					break;
+				}
+				auto frameStart = std::chrono::high_resolution_clock::now();
+
+				if (!reportLevel.empty())
+				{
+					const LoadReport& report = renderer.GetLoadReport();
+					if (report.IsFinished())
+					{
+						if (!reportPath.empty() && !report.Write(reportPath.c_str()))
+							std::cerr << "ERROR: Unable to write the load report to " << reportPath << "\n";
+						exitCode = report.IsSucceeded() ? 0 : 1;
+						break;
+					}
+					if (std::chrono::steady_clock::now() - reportStart > std::chrono::seconds(LOAD_REPORT_TIMEOUT_SECONDS))
+					{
+						std::cerr << "ERROR: Level textures still loading after " << LOAD_REPORT_TIMEOUT_SECONDS << "s\n";
+						exitCode = 1;
+						break;
+					}
+				}
+
+				bool started;
+				{
+					Profiler::Scope timer(profiler, "Acquire");
+					started = +vulkan.StartFrame(2, clrAndDepth);
+				}
+				if (started)
 				{
-					renderer.CheckCommands();
-					renderer.UpdateLight();
-					renderer.UpdateCamera();
-					renderer.Render();
-					vulkan.EndFrame(true);
+					{
+						Profiler::Scope timer(profiler, "CheckCommands");
+						renderer.CheckCommands();
+					}
+					if (replaying)
+						ApplyReplayFrame(renderer, replay.GetFrame(replayFrame));
+					else
+					{
+						{
+							Profiler::Scope timer(profiler, "UpdateLight");
+							renderer.UpdateLight();
+						}
+						{
+							Profiler::Scope timer(profiler, "UpdateCamera");
+							renderer.UpdateCamera();
+						}
+					}
+					{
+						Profiler::Scope timer(profiler, "Render");
+						renderer.Render();
+					}
+					{
+						Profiler::Scope timer(profiler, "Present");
+						vulkan.EndFrame(true);
+					}
+					renderer.EndFrame();
+					if (replayCounted)
+					{
+						replayStats.AddFrame(std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count(),
+							replay.GetFrame(replayFrame).delta, renderer.GetCullingStats(), renderer.GetDrawStats());
+						replayFrame++;
+					}
 				}
 			}
 		}
 	}
-	return 0; // that's all folks
+	return exitCode; // that's all folks
 }
@@ -5,29 +5,40 @@
 #define KHRONOS_STATIC 
 #include "ktx.h"
 #include <ktxvulkan.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include "HiZOcclusion.h"
+#include "SoftwareOcclusion.h"
+#include "MeshLod.h"
+#include "DrawSort.h"
+#include "PipelineCache.h"
+#include "ShaderCache.h"
+#include "ShaderWatcher.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
+#include "FrameRing.h"
+#include "DeletionQueue.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "LoadReport.h"
+#include "MemoryStats.h"
+#include "OffscreenSurface.h"
+#include "CameraPath.h"
 
 #ifdef _WIN32 // must use MT platform DLL libraries on windows
 	#pragma comment(lib, "shaderc_combined.lib") 
 #endif
 
 /**********************************/
-/*  Shader Loader (Shader2String) */
+/*  Shader Sources (see ShaderCache) */
 /**********************************/
 const char* PIXEL_SHADER_PATH = "../Shaders/PixelShader.hlsl";
 const char* VERTEX_SHADER_PATH = "../Shaders/VertexShader.hlsl";
-std::string ShaderAsString(const char* shaderFilePath) {
-	std::string output;
-	unsigned int stringLength = 0;
-	GW::SYSTEM::GFile file; file.Create();
-	file.GetFileSize(shaderFilePath, stringLength);
-	if (stringLength && +file.OpenBinaryRead(shaderFilePath)) {
-		output.resize(stringLength);
-		file.Read(&output[0], stringLength);
-	}
-	else
-		std::cout << "ERROR: Shader Source File \"" << shaderFilePath << "\" Not Found!" << std::endl;
-	return output;
-}
+const char* DEPTH_VERTEX_SHADER_PATH = "../Shaders/DepthVertexShader.hlsl";
+const char* HIZ_BUILD_SHADER_PATH = "../Shaders/HiZBuild.hlsl";
 
 // Creation, Rendering & Cleanup
 class Renderer
@@ -37,6 +48,9 @@ private:
 	{
 		unsigned int material_offset;
 		unsigned int matrix_offset;
+		unsigned int diffuse_layer; // texture array layers, 0 for textures that are not packed
+		unsigned int specular_layer;
+		unsigned int normal_layer;
 	};
 
 	// Public Structures
@@ -70,7 +84,21 @@ private:
 		VkDeviceMemory vertexData;
 		VkBuffer indexHandle;
 		VkDeviceMemory indexData;
+		VkBuffer positionHandle; // positions only, for the depth pre-pass
+		VkDeviceMemory positionData;
 	};
+
+	// A parsed level with its culling bounds, LODs & model buffers, ready to become the current one
+	struct LEVEL_DATA
+	{
+		std::vector<graphics::MODEL> objects;
+		std::vector<graphics::CAMERA> cameras;
+		graphics::LEVEL_INFO levelInfo = {};
+		std::vector<vkObject> vkObjects;
+		LoadReport report; // parse & buffer timings, finished by the render thread
+		bool valid = false; // parsed & prepared
+	};
+
 	
 #define MAX_SUBMESH_PER_DRAW 1024
 	struct VERTEX_SHADER_DATA
@@ -107,14 +135,46 @@ private:
 	// proxy handles
 	GW::SYSTEM::GWindow win;
 	GW::GRAPHICS::GVulkanSurface vlk;
+	OffscreenSurface* offscreen = nullptr; // replaces win & vlk when running headless
 	GW::CORE::GEventReceiver shutdown;
+	bool gCleanedUp = false; // by the surface's release event or the destructor, whichever is first
 	
 	// what we need at a minimum to draw a triangle
 	std::vector<vkObject> vkObjects;
 	VkDevice device = nullptr;
 	VkPhysicalDevice physicalDevice = nullptr;
 
-	// Matrix Storage Buffers
+	// Frames the CPU may record ahead of the GPU, each with its own matrix buffer & descriptor set.
+	// 2 keeps latency low, 3 gives the CPU more slack
+	#define FRAMES_IN_FLIGHT 2
+	FrameRing gFrameRing;
+	DeletionQueue gDeletionQueue; // objects retired while frames in flight may still use them
+
+	// CPU timers & per pass GPU timestamps, F5 writes their summaries to these files
+	Profiler gProfiler;
+	#define PROFILE_CSV_PATH "frame_profile.csv"
+	#define PROFILE_JSON_PATH "frame_profile.json"
+
+	// Timeline events of every thread as Chrome trace JSON, F6 starts a capture & writes it when pressed
+	// again (or at exit). 1 captures from launch, the first level load included
+	#define TRACE_PATH "trace.json"
+	#define TRACE_STARTUP 0
+
+	// Phase timings of the current level's load, printed & written here once its textures are all in
+	#define LOAD_REPORT_PATH "load_report.json"
+	LoadReport gLoadReport;
+
+	// Live & peak bytes per category, logged every MEMORY_STATS_LOG_INTERVAL frames & after level swaps
+	#define MEMORY_STATS_LOG_INTERVAL 600 // frames
+	MemoryStats gMemoryStats;
+
+	// F7 records the camera & light every frame until pressed again (or exit), for --replay
+	#define CAMERA_PATH_PATH "camera_path.bin"
+	CameraPath gCameraRecording;
+	bool gRecordingCamera = false;
+	std::chrono::high_resolution_clock::time_point gLastRecordedFrame;
+
+	// Matrix Storage Buffers, one per frame in flight
 	std::vector<VkBuffer> gMatrixBuffers;
 	std::vector<VkDeviceMemory> gMatrixData;
 	std::vector<VkDescriptorSet> gMatrixDescriptorSets;
@@ -125,19 +185,54 @@ private:
 	#define DEFAULT_SPECULAR_MAP "../Assets/Textures/defaultSpecular.ktx"
 	#define DEFAULT_NORMAL_MAP "../Assets/Textures/defaultNormal.ktx"
 
-	std::vector<ktxVulkanTexture> gDiffuseTextures; // one per texture
-	std::vector<VkImageView> gDiffuseTextureViews; // one per texture
-	std::vector<ktxVulkanTexture> gSpecularTextures; // one per texture
-	std::vector<VkImageView> gSpecularTextureViews; // one per texture
-	std::vector<ktxVulkanTexture> gNormalTextures; // one per texture
-	std::vector<VkImageView> gNormalTextureViews; // one per texture
+	// images, views & descriptor sets are shared by every material slot naming the same file
+	TextureCache gTextureCache;
+	std::vector<unsigned int> gDiffuseTextureHandles; // one per material slot
+	std::vector<unsigned int> gSpecularTextureHandles; // one per material slot
+	std::vector<unsigned int> gNormalTextureHandles; // one per material slot
 
 	VkSampler gTextureSampler = nullptr; // can be shared, effects quality & addressing mode
 
+	// Material slots start on the default maps, their own textures are read by gTextureStreamer
+	// (nearest first), uploaded by the cache's transfer & swapped in at the start of the first frame
+	// after it has finished
+	#define TEXTURE_STREAM_UPLOADS_PER_FRAME 4
+	enum TEXTURE_MAP { TEXTURE_MAP_DIFFUSE, TEXTURE_MAP_SPECULAR, TEXTURE_MAP_NORMAL, TEXTURE_MAP_COUNT };
+	struct TEXTURE_SLOT
+	{
+		TEXTURE_MAP map;
+		unsigned int slot;
+	};
+	TextureStreamer gTextureStreamer;
+	std::vector<std::vector<TEXTURE_SLOT>> gStreamedTextureSlots; // by stream request id
+	struct UPLOADING_TEXTURE
+	{
+		unsigned int id; // stream request
+		unsigned int handle; // holds the acquire's reference
+		std::string path;
+	};
+	std::vector<UPLOADING_TEXTURE> gUploadingTextures;
+	unsigned int gTexturesStreaming = 0;
+	std::chrono::steady_clock::time_point gTextureStreamStart;
+
+	// Mip residency: every interval the visible instances report their on screen size to the
+	// textures they use, which keep only the levels that size needs within the VRAM budget
+	#define TEXTURE_RESIDENCY_INTERVAL 16 // frames
+	#define TEXTURE_VRAM_BUDGET_MB 0 // 0: derived from VK_EXT_memory_budget, or half the device local heaps
+	#define TEXTURE_VRAM_BUDGET_SHARE 0.9f // of the driver's budget left after everything else
+	#define TEXTURE_STREAM_REFINE 0xFFFFFFFFu // stream request id of a residency refine
+	bool gMemoryBudgetSupported = false;
+	ktx_transcode_fmt_e gTextureTranscodeFormat = KTX_TTF_RGBA32; // what .ktx2/Basis files become on this device
+	bool gTextureResidencyDue = true;
+	unsigned int gTextureDescriptorVersion = 0;
+	std::vector<float> gTextureSlotSizes[TEXTURE_MAP_COUNT]; // largest on screen size per material slot
+
 	// note that unlike uniform buffers, we don't need one for each "in-flight" frame
+	// one per material slot, owned by gTextureCache so slots sharing a texture share the set
 	std::vector<VkDescriptorSet> gDiffuseTextureDescriptorSets;
 	std::vector<VkDescriptorSet> gSpecularTextureDescriptorSets;
 	std::vector<VkDescriptorSet> gNormalTextureDescriptorSets;
+	std::vector<unsigned int> gTextureLayers[TEXTURE_MAP_COUNT]; // array layer per material slot
 
 	// textures can optionally share descriptor sets/pools/layouts with uniform & storage buffers	
 	VkDescriptorPool gDescriptorPool = nullptr;
@@ -146,9 +241,44 @@ private:
 
 	VkShaderModule vertexShader = nullptr;
 	VkShaderModule pixelShader = nullptr;
+	VkShaderModule depthVertexShader = nullptr;
+	VkShaderModule hizBuildShader = nullptr;
+	// Pixel shader variants, one bit per map a material really has (specialization constants 0, 1 & 2)
+	enum MATERIAL_VARIANT
+	{
+		MATERIAL_HAS_DIFFUSE = 1, MATERIAL_HAS_SPECULAR = 2, MATERIAL_HAS_NORMAL = 4,
+		MATERIAL_VARIANT_ALL = 7, MATERIAL_VARIANT_COUNT = 8
+	};
+	struct GRAPHICS_PIPELINES
+	{
+		VkPipeline main[MATERIAL_VARIANT_COUNT] = {};
+		// depth pre-pass, then the main pass shading only fragments that match the pre-pass depth
+		VkPipeline depthPrepass = nullptr; // null if the pre-pass pipelines failed
+		VkPipeline depthEqual[MATERIAL_VARIANT_COUNT] = {};
+	};
 	// pipeline settings for drawing (also required)
-	VkPipeline pipeline = nullptr;
+	GRAPHICS_PIPELINES gPipelines;
 	VkPipelineLayout pipelineLayout = nullptr;
+	// driver compiled pipelines kept between runs, every pipeline is created through it
+	#define PIPELINE_CACHE_PATH "pipeline_cache.bin"
+	PipelineCache gPipelineCache;
+
+	/***************** SHADER HOT RELOAD VARIABLES ******************/
+	// Shaders & the pipelines built from them, swapped & retired as one
+	struct SHADER_SET
+	{
+		VkShaderModule vertex = nullptr;
+		VkShaderModule pixel = nullptr;
+		VkShaderModule depthVertex = nullptr;
+		GRAPHICS_PIPELINES pipelines;
+	};
+
+	ShaderWatcher gShaderWatcher;
+	std::mutex gReloadMutex;
+	std::atomic<bool> gReloadReady{ false };
+	SHADER_SET gReloadedShaders; // built by the watcher, swapped in by Render
+
+	/***************** ****************************** ******************/
 
 	// Descriptor Set Layout
 	VkDescriptorSetLayout descriptorSetLayout_Vertex = nullptr;
@@ -171,16 +301,69 @@ private:
 	Light gLight;
 
 	std::vector<graphics::MODEL> gObjects;
+	graphics::LEVEL_INFO gLevelInfo = {};
 	LevelSelector::Selector gLevelSelector;
 
+	// Background level loading: F1 parses & prepares the next level on its own thread while the current
+	// one keeps rendering, Render swaps it in at a frame boundary & retires the old model buffers
+	std::thread gLevelLoadThread;
+	std::atomic<bool> gLevelLoading{ false };
+	std::atomic<bool> gLevelReady{ false };
+	LEVEL_DATA gLoadedLevel; // written by the loader thread until gLevelReady
+	std::chrono::steady_clock::time_point gLevelLoadStart;
+
 	// Shader Model Data sent to GPU
 	SHADER_MODEL_DATA gShaderModelData;
 	//VERTEX_SHADER_DATA gVertexShaderData;
 
+	/***************** OCCLUSION CULLING VARIABLES ******************/
+	#define CULLING_STATS_LOG_INTERVAL 300 // frames
+
+	enum OCCLUSION_MODE { OCCLUSION_OFF = 0, OCCLUSION_HIZ, OCCLUSION_SOFTWARE, OCCLUSION_MODE_COUNT };
+	const char* OCCLUSION_MODE_NAMES[OCCLUSION_MODE_COUNT] = { "off", "HiZ", "software" };
+
+	HiZOcclusion gHiZ;
+	SoftwareOcclusion gSoftwareOcclusion;
+	OCCLUSION_MODE gOcclusionMode = OCCLUSION_HIZ;
+	Culling::FRUSTUM gFrustum;
+	Culling::CULLING_STATS gCullingStats;
+	std::vector<std::vector<unsigned>> gVisibleInstances; // per model, instances drawn this frame
+	std::vector<std::vector<unsigned>> gPhaseTwoInstances; // per model, instances waiting on the HiZ test
+	std::vector<std::vector<bool>> gInstanceVisibility; // per model, HiZ result from the previous frame
+	unsigned long long gFrameCount = 0;
+
+	bool gLodEnabled = true;
+	std::vector<std::vector<unsigned>> gLodInstanceCounts; // per model, visible instances per LOD (packed in LOD order)
+
+	/***************** ****************************** ******************/
+
+	/***************** DRAW SORTING VARIABLES ******************/
+	std::vector<std::vector<DrawSort::DRAW_STATE>> gMeshDrawStates; // per model, per mesh
+	DrawSort::DrawList gDrawList;
+	DrawSort::DRAW_STATS gDrawStats;
+	unsigned int gUnsortedBindCount = 0; // binds the model ordered loop would have issued this frame
+
+	/***************** ****************************** ******************/
+
+	/***************** DEPTH PRE-PASS VARIABLES ******************/
+	// Estimated overdraw (summed screen coverage of visible instances) that turns the auto pre-pass on/off
+	#define DEPTH_PREPASS_ENABLE_OVERDRAW 3.0f
+	#define DEPTH_PREPASS_DISABLE_OVERDRAW 2.0f
+
+	enum DEPTH_PREPASS_MODE { DEPTH_PREPASS_AUTO = 0, DEPTH_PREPASS_ON, DEPTH_PREPASS_OFF, DEPTH_PREPASS_MODE_COUNT };
+	const char* DEPTH_PREPASS_MODE_NAMES[DEPTH_PREPASS_MODE_COUNT] = { "auto", "on", "off" };
+
+	DEPTH_PREPASS_MODE gDepthPrepassMode = DEPTH_PREPASS_AUTO;
+	bool gDepthPrepassActive = false;
+	float gEstimatedOverdraw = 0.0f;
+
+	/***************** ****************************** ******************/
+
 	// Input Controls
 	GW::INPUT::GInput gInputProxy;
 	GW::INPUT::GController gControllerProxy;
 	GW::INPUT::GBufferedInput gBufferedInputProxy;
+	std::unordered_map<int, bool> gKeyStates; // used to detect key presses
 
 public:
 	struct InputModifiers
@@ -194,99 +377,109 @@ public:
 	float maxSensitivity, minSensitivity;
 	float maxLightMovementSpeed, minLightMovementSpeed;
 
+	// levelPath skips the level selection prompt
 	Renderer(GW::SYSTEM::GWindow _win, GW::GRAPHICS::GVulkanSurface _vlk,
-		Light _light = REND_DEFAULT_LIGHT) 
+		Light _light = REND_DEFAULT_LIGHT, const std::string& levelPath = "") 
 			: win(_win), vlk(_vlk), gLight(_light)
 	{
-		ConstructRenderer();
+		if (!levelPath.empty())
+			gLevelSelector.SetSelectedFile(levelPath);
+		ConstructRenderer(levelPath.empty());
 	}
 
-
-	void CreateVertexShader(shaderc_compiler_t& compiler, shaderc_compile_options_t& options)
+	// Headless: no window, input or level prompt, frames are recorded into the offscreen surface
+	Renderer(OffscreenSurface& _offscreen, const std::string& levelPath, Light _light = REND_DEFAULT_LIGHT)
+		: offscreen(&_offscreen), gLight(_light)
 	{
-		// Create Vertex Shader
-		std::string vertexShaderStr = ShaderAsString(VERTEX_SHADER_PATH);
-		shaderc_compilation_result_t result = shaderc_compile_into_spv( // compile
-			compiler, vertexShaderStr.c_str(), vertexShaderStr.length(),
-			shaderc_vertex_shader, "main.vert", "main", options);
-		if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) // errors?
-			std::cout << "Vertex Shader Errors: " << shaderc_result_get_error_message(result) << std::endl;
-		GvkHelper::create_shader_module(device, shaderc_result_get_length(result), // load into Vulkan
-			(char*)shaderc_result_get_bytes(result), &vertexShader);
-		shaderc_result_release(result); // done
+		gLevelSelector.SetSelectedFile(levelPath);
+		ConstructRenderer(false);
 	}
 
-	void CreatePixelShader(shaderc_compiler_t& compiler, shaderc_compile_options_t& options)
+	// Leaving the frame loop early (--load-report) destroys the renderer before the surface
+	~Renderer()
 	{
-		// Create Pixel Shader
-		std::string pixelShaderStr = ShaderAsString(PIXEL_SHADER_PATH);
-		shaderc_compilation_result_t result = shaderc_compile_into_spv( // compile
-			compiler, pixelShaderStr.c_str(), pixelShaderStr.length(),
-			shaderc_fragment_shader, "main.frag", "main", options);
-		if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) // errors?
-			std::cout << "Pixel Shader Errors: " << shaderc_result_get_error_message(result) << std::endl;
-		GvkHelper::create_shader_module(device, shaderc_result_get_length(result), // load into Vulkan
-			(char*)shaderc_result_get_bytes(result), &pixelShader);
-		shaderc_result_release(result); // done
-		// Free runtime shader compiler resources
-		shaderc_compile_options_release(options);
-		shaderc_compiler_release(compiler);
+		CleanUp();
 	}
 
-	void ConstructRenderer(bool showLevelSelect = true)
+	// The current level's, finished once its textures are all in
+	inline const LoadReport& GetLoadReport() const { return gLoadReport; }
+
+	// Texture & descriptor pool figures are refreshed whenever the level's texture slots change
+	inline const MemoryStats& GetMemoryStats() const { return gMemoryStats; }
+
+	// For timers around the surface's acquire & present (see main.cpp)
+	inline Profiler& GetProfiler() { return gProfiler; }
+
+	// The level's first camera (or the default), where scripted headless runs start from
+	inline const GW::MATH::GMATRIXF& GetLevelCamera() const
 	{
-		VkResult res;
-		unsigned int width, height;
-		win.GetClientWidth(width);
-		win.GetClientHeight(height);
+		return gCameras.size() == 0 ? DefaultCamera.worldMatrix : gCameras[0].worldMatrix;
+	}
 
-		// Setup input controllers
-		gInputProxy.Create(win);
-		gControllerProxy.Create();
-		gBufferedInputProxy.Create(win);
+	inline const Culling::CULLING_STATS& GetCullingStats() const { return gCullingStats; }
+	inline const DrawSort::DRAW_STATS& GetDrawStats() const { return gDrawStats; }
 
-		// Select initial level
-		if (showLevelSelect)
-			while (!gLevelSelector.SelectNewLevel(true))
-				;
-		gLevelSelector.ParseSelectedLevel();
+	// Replaces UpdateLight when the light is replayed
+	inline void SetLightDirection(const GW::MATH::GVECTORF& direction) { gLight.Direction = direction; }
 
-		/***************** GEOMETRY INTIALIZATION ******************/
-		// Grab the device & physical device so we can allocate some stuff
-		vlk.GetDevice((void**)&device);
-		vlk.GetPhysicalDevice((void**)&physicalDevice);
+	// Replaces UpdateCamera when the camera is scripted rather than driven by input
+	void SetCameraWorld(const GW::MATH::GMATRIXF& world)
+	{
+		gCamera.worldMatrix = world;
+		GW::MATH::GMatrix::InverseF(world, gMatrices.view);
+		gShaderModelData.viewMatrix = gMatrices.view;
+		gShaderModelData.cameraPos.x = world.row4.x;
+		gShaderModelData.cameraPos.y = world.row4.z;
+		gShaderModelData.cameraPos.z = world.row4.y;
+		gShaderModelData.cameraPos.w = world.row4.w;
+	}
 
-		ChangeLevel(gLevelSelector.levelParser.ModelsToVector(), gLevelSelector.levelParser.CamerasToVector());
 
-		InitializeGeometry();
+	void CreateVertexShader(ShaderCache& shaderCache)
+	{
+		// Create Vertex Shader
+		if (!shaderCache.Load(device, VERTEX_SHADER_PATH, shaderc_vertex_shader,
+			"main.vert", "Vertex Shader", &vertexShader))
+			std::cerr << "ERROR: Unable to load vertex shader!\n";
+	}
 
-		/***************** SHADER INTIALIZATION ******************/
-		// Initialize runtime shader compiler HLSL -> SPIRV
-		shaderc_compiler_t compiler = shaderc_compiler_initialize();
-		shaderc_compile_options_t options = shaderc_compile_options_initialize();
-		shaderc_compile_options_set_source_language(options, shaderc_source_language_hlsl);
-		shaderc_compile_options_set_invert_y(options, true);
-#ifndef NDEBUG
-		shaderc_compile_options_set_generate_debug_info(options);
-#endif
-		CreateVertexShader(compiler, options);
+	void CreatePixelShader(ShaderCache& shaderCache)
+	{
+		// Create Pixel Shader
+		if (!shaderCache.Load(device, PIXEL_SHADER_PATH, shaderc_fragment_shader,
+			"main.frag", "Pixel Shader", &pixelShader))
+			std::cerr << "ERROR: Unable to load pixel shader!\n";
+	}
 
-		CreatePixelShader(compiler, options);
+	void CreateOcclusionShaders(ShaderCache& shaderCache)
+	{
+		// Depth only vertex shader for phase one & the pyramid reduction
+		if (!shaderCache.Load(device, DEPTH_VERTEX_SHADER_PATH, shaderc_vertex_shader,
+			"depth.vert", "Depth Vertex Shader", &depthVertexShader))
+			std::cerr << "ERROR: Unable to load depth vertex shader!\n";
+		if (!shaderCache.Load(device, HIZ_BUILD_SHADER_PATH, shaderc_compute_shader,
+			"hiz.comp", "HiZ Build Shader", &hizBuildShader))
+			std::cerr << "ERROR: Unable to load HiZ build shader!\n";
+	}
 
-		/***************** PIPELINE INTIALIZATION ******************/
-		// Create Pipeline & Layout (Thanks Tiny!)
-		VkRenderPass renderPass;
-		vlk.GetRenderPass((void**)&renderPass);
+	// Builds the main & depth pre-pass pipelines from the given shaders. Touches no renderer state
+	// besides the pipeline layout, so shader hot reload can call it from its watcher thread
+	bool CreateGraphicsPipelines(VkPipelineCache pipelineCache, VkRenderPass renderPass, VkExtent2D extent,
+		VkShaderModule vertexShaderModule, VkShaderModule pixelShaderModule, VkShaderModule depthVertexShaderModule,
+		GRAPHICS_PIPELINES& pipelines)
+	{
+		TRACE_SCOPE("CreateGraphicsPipelines");
+		pipelines = {};
 		VkPipelineShaderStageCreateInfo stage_create_info[2] = {};
 		// Create Stage Info for Vertex Shader
 		stage_create_info[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		stage_create_info[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-		stage_create_info[0].module = vertexShader;
+		stage_create_info[0].module = vertexShaderModule;
 		stage_create_info[0].pName = "main";
 		// Create Stage Info for Fragment Shader
 		stage_create_info[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		stage_create_info[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		stage_create_info[1].module = pixelShader;
+		stage_create_info[1].module = pixelShaderModule;
 		stage_create_info[1].pName = "main";
 		// Assembly State
 		VkPipelineInputAssemblyStateCreateInfo assembly_create_info = {};
@@ -312,9 +505,9 @@ public:
 		input_vertex_info.pVertexAttributeDescriptions = vertex_attribute_description;
 		// Viewport State (we still need to set this up even though we will overwrite the values)
 		VkViewport viewport = {
-			0, 0, static_cast<float>(width), static_cast<float>(height), 0, 1
+			0, 0, static_cast<float>(extent.width), static_cast<float>(extent.height), 0, 1
 		};
-		VkRect2D scissor = { {0, 0}, {width, height} };
+		VkRect2D scissor = { {0, 0}, extent };
 		VkPipelineViewportStateCreateInfo viewport_create_info = {};
 		viewport_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 		viewport_create_info.viewportCount = 1;
@@ -383,6 +576,343 @@ public:
 		dynamic_create_info.dynamicStateCount = 2;
 		dynamic_create_info.pDynamicStates = dynamic_state;
 
+		// Pipeline State... (FINALLY) 
+		VkGraphicsPipelineCreateInfo pipeline_create_info = {};
+		pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipeline_create_info.stageCount = 2;
+		pipeline_create_info.pStages = stage_create_info;
+		pipeline_create_info.pInputAssemblyState = &assembly_create_info;
+		pipeline_create_info.pVertexInputState = &input_vertex_info;
+		pipeline_create_info.pViewportState = &viewport_create_info;
+		pipeline_create_info.pRasterizationState = &rasterization_create_info;
+		pipeline_create_info.pMultisampleState = &multisample_create_info;
+		pipeline_create_info.pDepthStencilState = &depth_stencil_create_info;
+		pipeline_create_info.pColorBlendState = &color_blend_create_info;
+		pipeline_create_info.pDynamicState = &dynamic_create_info;
+		pipeline_create_info.layout = pipelineLayout;
+		pipeline_create_info.renderPass = renderPass;
+		pipeline_create_info.subpass = 0;
+		pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+
+		// One pipeline per material variant, the pixel shader's map flags are specialization constants
+		VkBool32 specialization_data[3];
+		VkSpecializationMapEntry specialization_entries[3] = {
+			{ 0, 0 * sizeof(VkBool32), sizeof(VkBool32) },
+			{ 1, 1 * sizeof(VkBool32), sizeof(VkBool32) },
+			{ 2, 2 * sizeof(VkBool32), sizeof(VkBool32) }
+		};
+		VkSpecializationInfo specialization_info = {};
+		specialization_info.mapEntryCount = 3;
+		specialization_info.pMapEntries = specialization_entries;
+		specialization_info.dataSize = sizeof(specialization_data);
+		specialization_info.pData = specialization_data;
+		stage_create_info[1].pSpecializationInfo = &specialization_info;
+		auto createVariants = [&](VkPipeline* variants)
+		{
+			for (unsigned int v = 0; v < MATERIAL_VARIANT_COUNT; v++)
+			{
+				specialization_data[0] = (v & MATERIAL_HAS_DIFFUSE) ? VK_TRUE : VK_FALSE;
+				specialization_data[1] = (v & MATERIAL_HAS_SPECULAR) ? VK_TRUE : VK_FALSE;
+				specialization_data[2] = (v & MATERIAL_HAS_NORMAL) ? VK_TRUE : VK_FALSE;
+				if (vkCreateGraphicsPipelines(device, pipelineCache, 1,
+					&pipeline_create_info, nullptr, &variants[v]) != VkResult::VK_SUCCESS)
+					return false;
+			}
+			return true;
+		};
+		if (!createVariants(pipelines.main))
+		{
+			DestroyGraphicsPipelines(pipelines);
+			return false;
+		}
+
+		// Depth pre-pass: position only stream, no fragment shader & no color writes
+		VkPipelineShaderStageCreateInfo prepass_stage_create_info = stage_create_info[0];
+		prepass_stage_create_info.module = depthVertexShaderModule;
+		VkVertexInputBindingDescription position_binding_description = {};
+		position_binding_description.binding = 0;
+		position_binding_description.stride = sizeof(graphics::VECTOR);
+		position_binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		VkPipelineVertexInputStateCreateInfo position_vertex_info = input_vertex_info;
+		position_vertex_info.pVertexBindingDescriptions = &position_binding_description;
+		position_vertex_info.vertexAttributeDescriptionCount = 1;
+		VkPipelineColorBlendAttachmentState prepass_blend_attachment_state = color_blend_attachment_state;
+		prepass_blend_attachment_state.colorWriteMask = 0;
+		VkPipelineColorBlendStateCreateInfo prepass_blend_create_info = color_blend_create_info;
+		prepass_blend_create_info.pAttachments = &prepass_blend_attachment_state;
+		pipeline_create_info.stageCount = 1;
+		pipeline_create_info.pStages = &prepass_stage_create_info;
+		pipeline_create_info.pVertexInputState = &position_vertex_info;
+		pipeline_create_info.pColorBlendState = &prepass_blend_create_info;
+		VkResult prepassResult = vkCreateGraphicsPipelines(device, pipelineCache, 1,
+			&pipeline_create_info, nullptr, &pipelines.depthPrepass);
+
+		// Main pass after the pre-pass: depth is final, so only the visible fragment passes EQUAL
+		depth_stencil_create_info.depthWriteEnable = VK_FALSE;
+		depth_stencil_create_info.depthCompareOp = VK_COMPARE_OP_EQUAL;
+		pipeline_create_info.stageCount = 2;
+		pipeline_create_info.pStages = stage_create_info;
+		pipeline_create_info.pVertexInputState = &input_vertex_info;
+		pipeline_create_info.pColorBlendState = &color_blend_create_info;
+		if (prepassResult != VkResult::VK_SUCCESS || !createVariants(pipelines.depthEqual))
+		{
+			// the pre-pass is optional, leave it all null so it is never turned on
+			GRAPHICS_PIPELINES prepass = pipelines;
+			std::fill(prepass.main, prepass.main + MATERIAL_VARIANT_COUNT, nullptr);
+			DestroyGraphicsPipelines(prepass);
+			pipelines.depthPrepass = nullptr;
+			std::fill(pipelines.depthEqual, pipelines.depthEqual + MATERIAL_VARIANT_COUNT, nullptr);
+		}
+		return true;
+	}
+
+	void DestroyGraphicsPipelines(GRAPHICS_PIPELINES& pipelines)
+	{
+		for (unsigned int v = 0; v < MATERIAL_VARIANT_COUNT; v++)
+		{
+			if (pipelines.main[v] != nullptr)
+				vkDestroyPipeline(device, pipelines.main[v], nullptr);
+			if (pipelines.depthEqual[v] != nullptr)
+				vkDestroyPipeline(device, pipelines.depthEqual[v], nullptr);
+		}
+		if (pipelines.depthPrepass != nullptr)
+			vkDestroyPipeline(device, pipelines.depthPrepass, nullptr);
+		pipelines = {};
+	}
+
+	void DestroyShaderSet(SHADER_SET& set)
+	{
+		DestroyGraphicsPipelines(set.pipelines);
+		VkShaderModule modules[3] = { set.vertex, set.pixel, set.depthVertex };
+		for (VkShaderModule module : modules)
+			if (module != nullptr)
+				vkDestroyShaderModule(device, module, nullptr);
+		set = {};
+	}
+
+	// Watcher thread: recompiles the draw shaders & builds their pipelines, any failure keeps the current set
+	void ReloadShaders(VkRenderPass renderPass)
+	{
+		TRACE_SCOPE("ReloadShaders");
+		SHADER_SET set;
+		ShaderCache shaderCache;
+		bool loaded = shaderCache.Load(device, VERTEX_SHADER_PATH, shaderc_vertex_shader, "main.vert", "Vertex Shader", &set.vertex)
+			&& shaderCache.Load(device, PIXEL_SHADER_PATH, shaderc_fragment_shader, "main.frag", "Pixel Shader", &set.pixel)
+			&& shaderCache.Load(device, DEPTH_VERTEX_SHADER_PATH, shaderc_vertex_shader, "depth.vert", "Depth Vertex Shader", &set.depthVertex);
+		shaderCache.Release();
+
+		// Viewport & scissor are dynamic, the extent baked into the pipeline is never used
+		if (!loaded || !CreateGraphicsPipelines(gPipelineCache.Get(), renderPass, { 1, 1 },
+			set.vertex, set.pixel, set.depthVertex, set.pipelines))
+		{
+			std::cerr << "ERROR: Shader reload failed, keeping the current shaders!\n";
+			DestroyShaderSet(set);
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(gReloadMutex);
+		if (gReloadReady)
+			DestroyShaderSet(gReloadedShaders); // superseded before a frame ever used it
+		gReloadedShaders = set;
+		gReloadReady = true;
+	}
+
+	// Parses & prepares the level at path on the loader thread, ApplyLevelSwap picks it up when done
+	void StartLevelLoad(const std::string& path)
+	{
+		if (gLevelLoadThread.joinable())
+			gLevelLoadThread.join();
+		gLevelLoading = true;
+		gLevelLoadStart = std::chrono::high_resolution_clock::now();
+		std::cout << "Loading level " << path << " in the background\n";
+		gLevelLoadThread = std::thread([this, path]()
+		{
+			Trace::SetThreadName("Level loader");
+			TRACE_SCOPE("Load level");
+			LevelSelector::Parser parser;
+			LEVEL_DATA level;
+			std::string levelPath = path;
+			level.report.Begin(path);
+			parser.report = &level.report;
+			if (parser.ParseGameLevel(levelPath) == LevelSelector::OK)
+			{
+				level.objects = parser.ModelsToVector();
+				level.cameras = parser.CamerasToVector();
+				level.levelInfo = parser.levelInfo;
+				PrepareLevel(level);
+			}
+			gLoadedLevel = std::move(level);
+			gLevelReady = true;
+		});
+	}
+
+	// Frame boundary: swaps in a level the loader finished. The old level's model buffers go to the
+	// deletion queue, its textures are released by LoadTextures & retired by the cache
+	void ApplyLevelSwap()
+	{
+		if (!gLevelReady)
+			return;
+		TRACE_SCOPE("ApplyLevelSwap");
+		gLevelLoadThread.join();
+		gLevelReady = false;
+		gLevelLoading = false;
+		if (!gLoadedLevel.valid)
+		{
+			gLoadedLevel = LEVEL_DATA();
+#ifdef _WIN32
+			// Headless runs never pop a modal dialog
+			if (offscreen == nullptr)
+				MessageBox(NULL, L"Unable to parse level!",
+					L"Error (Parsing Level)",
+					MB_OK);
+			else
+				std::cerr << "ERROR: Unable to parse level!\n";
+#else
+			std::cerr << "ERROR: Unable to parse level!\n";
+#endif
+			return;
+		}
+
+		std::vector<vkObject> retired;
+		retired.swap(vkObjects);
+		gDeletionQueue.Push(gFrameCount + gFrameRing.GetCount(),
+			[this, retired]() mutable { DestroyModelBuffers(retired); });
+		ChangeLevel(gLoadedLevel);
+		gLoadedLevel = LEVEL_DATA();
+		WriteModelsToShaderData();
+		LoadTextures();
+		std::cout << "Level swapped in after " << std::chrono::duration<float, std::milli>(
+			std::chrono::high_resolution_clock::now() - gLevelLoadStart).count() << "ms of background loading\n";
+		gMemoryStats.Print(std::cout);
+	}
+
+	void DestroyModelBuffers(std::vector<vkObject>& objects)
+	{
+		for (vkObject& vkObj : objects)
+		{
+			gMemoryStats.Remove(MEMORY_GPU_VERTEX, BufferBytes(vkObj.vertexHandle) + BufferBytes(vkObj.positionHandle));
+			gMemoryStats.Remove(MEMORY_GPU_INDEX, BufferBytes(vkObj.indexHandle));
+			vkDestroyBuffer(device, vkObj.indexHandle, nullptr);
+			vkFreeMemory(device, vkObj.indexData, nullptr);
+			vkDestroyBuffer(device, vkObj.vertexHandle, nullptr);
+			vkFreeMemory(device, vkObj.vertexData, nullptr);
+			vkDestroyBuffer(device, vkObj.positionHandle, nullptr);
+			vkFreeMemory(device, vkObj.positionData, nullptr);
+		}
+		objects.clear();
+	}
+
+	// Frame boundary: swaps in reloaded shaders, the replaced set goes to the deletion queue
+	void ApplyShaderReload()
+	{
+		if (!gReloadReady)
+			return;
+		std::unique_lock<std::mutex> lock(gReloadMutex, std::try_to_lock);
+		if (!lock.owns_lock())
+			return; // watcher is publishing, pick it up next frame
+
+		// Frames already recorded may still be using the current set on the GPU
+		SHADER_SET retired;
+		retired.vertex = vertexShader;
+		retired.pixel = pixelShader;
+		retired.depthVertex = depthVertexShader;
+		retired.pipelines = gPipelines;
+		gDeletionQueue.Push(gFrameCount + gFrameRing.GetCount(),
+			[this, retired]() mutable { DestroyShaderSet(retired); });
+
+		vertexShader = gReloadedShaders.vertex;
+		pixelShader = gReloadedShaders.pixel;
+		depthVertexShader = gReloadedShaders.depthVertex;
+		gPipelines = gReloadedShaders.pipelines;
+		if (gPipelines.depthPrepass == nullptr && gDepthPrepassMode != DEPTH_PREPASS_OFF)
+		{
+			std::cerr << "ERROR: Unable to create depth pre-pass pipelines!\n";
+			gDepthPrepassMode = DEPTH_PREPASS_OFF;
+		}
+		gReloadedShaders = {};
+		gReloadReady = false;
+		std::cout << "Shaders reloaded\n";
+	}
+
+	void ConstructRenderer(bool showLevelSelect = true)
+	{
+		if (TRACE_STARTUP)
+			Trace::Start();
+		TRACE_SCOPE("ConstructRenderer");
+		VkResult res;
+		unsigned int width, height;
+		GetClientSize(width, height);
+
+		// Occluder rasterization workers, started before the first level is loaded
+		gSoftwareOcclusion.Start();
+
+		// Setup input controllers
+		if (offscreen == nullptr)
+		{
+			gInputProxy.Create(win);
+			gControllerProxy.Create();
+			gBufferedInputProxy.Create(win);
+		}
+
+		// Select initial level
+		if (showLevelSelect)
+			while (!gLevelSelector.SelectNewLevel(true))
+				;
+
+		/***************** GEOMETRY INTIALIZATION ******************/
+		// Grab the device & physical device so we can allocate some stuff
+		if (offscreen != nullptr)
+		{
+			device = offscreen->GetDevice();
+			physicalDevice = offscreen->GetPhysicalDevice();
+		}
+		else
+		{
+			vlk.GetDevice((void**)&device);
+			vlk.GetPhysicalDevice((void**)&physicalDevice);
+		}
+
+		// Without a cache pipelines are still created, just compiled from scratch every run
+		if (!gPipelineCache.Create(device, physicalDevice, PIPELINE_CACHE_PATH))
+			std::cerr << "ERROR: Unable to create pipeline cache, pipelines will not be cached!\n";
+
+		if (!gFrameRing.Create(device, FRAMES_IN_FLIGHT))
+			return;
+
+		// The first level loads inline, there is nothing to render yet
+		LEVEL_DATA level;
+		level.report.Begin(gLevelSelector.GetSelectedFile());
+		gLevelSelector.levelParser.report = &level.report;
+		if (gLevelSelector.ParseSelectedLevel() != LevelSelector::OK)
+			std::cerr << "ERROR: Unable to parse level " << gLevelSelector.GetSelectedFile() << "\n";
+		gLevelSelector.levelParser.report = nullptr;
+		level.objects = gLevelSelector.levelParser.ModelsToVector();
+		level.cameras = gLevelSelector.levelParser.CamerasToVector();
+		level.levelInfo = gLevelSelector.levelParser.levelInfo;
+		gLevelSelector.levelParser.models.clear(); // the level has its own copy now
+		PrepareLevel(level);
+		ChangeLevel(level);
+
+		InitializeGeometry();
+
+		/***************** SHADER INTIALIZATION ******************/
+		// Build time SPIR-V first, then the content hashed cache, shaderc only for edited sources
+		auto shaderStartTime = std::chrono::high_resolution_clock::now();
+		ShaderCache shaderCache;
+		CreateVertexShader(shaderCache);
+
+		CreatePixelShader(shaderCache);
+
+		CreateOcclusionShaders(shaderCache);
+
+		// Free runtime shader compiler resources (if it was needed at all)
+		shaderCache.Release();
+		float shaderTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - shaderStartTime).count();
+		std::cout << "Shaders loaded in " << shaderTime << "ms (" << shaderCache.GetStats().prebuilt << " prebuilt, "
+			<< shaderCache.GetStats().cached << " cached, " << shaderCache.GetStats().compiled << " compiled)\n";
+
+		/***************** PIPELINE INTIALIZATION ******************/
+		// Create Pipeline & Layout (Thanks Tiny!)
 		// Describes the order and type of resources bound to the vertex shader
 
 		descriptorLayoutBinding_Vertex = {};
@@ -425,8 +955,46 @@ public:
 			return;
 		}
 
-		// Descriptor Sets for Textures 
+		// Texture descriptor sets come from the texture cache, matrix sets from our own pool
+		VkQueue graphicsQueue = GetGraphicsQueue();
+		VkCommandPool commandPool;
+		if (offscreen != nullptr)
+			commandPool = offscreen->GetCommandPool();
+		else
+			vlk.GetCommandPool((void**)&commandPool);
+		// Gateware's surface creates its device with no features enabled, so windowed runs transcode to RGBA
+		VkPhysicalDeviceFeatures enabledFeatures = {};
+		if (offscreen != nullptr)
+			enabledFeatures = offscreen->GetEnabledFeatures();
+		gTextureTranscodeFormat = KtxTranscode::ChooseFormat(physicalDevice, enabledFeatures);
+		std::cout << "Texture transcode target: " << ktxTranscodeFormatString(gTextureTranscodeFormat) << "\n";
+		if (!gProfiler.Create(device, physicalDevice, graphicsQueue, commandPool, gFrameRing.GetCount()))
+			std::cerr << "ERROR: Unable to create GPU timers, only CPU time will be profiled!\n";
+		else if (offscreen != nullptr && offscreen->HasHostQueryReset())
+			gProfiler.EnableHostReset();
+#ifndef NDEBUG
+		// main.cpp enables VK_EXT_debug_utils on debug builds when the loader has it
+		if (VkUtils::SupportsInstanceExtension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME))
+		{
+			VkInstance instance;
+			if (offscreen != nullptr)
+				instance = offscreen->GetInstance();
+			else
+				vlk.GetInstance((void**)&instance);
+			gProfiler.EnableDebugLabels(instance);
+		}
+#endif
+		gTextureCache.Create(device, physicalDevice, graphicsQueue, commandPool, descriptorSetLayout_Pixel,
+			gFrameRing.GetCount(), gTextureTranscodeFormat);
+		gTextureCache.SetMemoryStats(&gMemoryStats);
+		gMemoryBudgetSupported = VkUtils::SupportsDeviceExtension(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		UpdateTextureBudget();
+		std::cout << "Texture budget: " << gTextureCache.GetBudget() / (1024 * 1024) << "MB ("
+			<< (TEXTURE_VRAM_BUDGET_MB > 0 ? "fixed" : gMemoryBudgetSupported ? "VK_EXT_memory_budget" : "heap size") << ")\n";
+		auto descriptorStart = std::chrono::high_resolution_clock::now();
 		AllocateDescriptorSets();
+		gLoadReport.AddPhase(LOAD_PHASE_DESCRIPTORS, std::chrono::duration<double, std::milli>(
+			std::chrono::high_resolution_clock::now() - descriptorStart).count(), 0, 0, gFrameRing.GetCount());
 
 		// Descriptor pipeline layout
 		VkPipelineLayoutCreateInfo pipeline_layout_create_info = {};
@@ -448,30 +1016,52 @@ public:
 		vkCreatePipelineLayout(device, &pipeline_layout_create_info, nullptr, &pipelineLayout);
 
 		// Pipeline State... (FINALLY) 
-		VkGraphicsPipelineCreateInfo pipeline_create_info = {};
-		pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		pipeline_create_info.stageCount = 2;
-		pipeline_create_info.pStages = stage_create_info;
-		pipeline_create_info.pInputAssemblyState = &assembly_create_info;
-		pipeline_create_info.pVertexInputState = &input_vertex_info;
-		pipeline_create_info.pViewportState = &viewport_create_info;
-		pipeline_create_info.pRasterizationState = &rasterization_create_info;
-		pipeline_create_info.pMultisampleState = &multisample_create_info;
-		pipeline_create_info.pDepthStencilState = &depth_stencil_create_info;
-		pipeline_create_info.pColorBlendState = &color_blend_create_info;
-		pipeline_create_info.pDynamicState = &dynamic_create_info;
-		pipeline_create_info.layout = pipelineLayout;
-		pipeline_create_info.renderPass = renderPass;
-		pipeline_create_info.subpass = 0;
-		pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
-		vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
-			&pipeline_create_info, nullptr, &pipeline);
+		VkRenderPass renderPass;
+		if (offscreen != nullptr)
+			renderPass = offscreen->GetRenderPass();
+		else
+			vlk.GetRenderPass((void**)&renderPass);
+		auto pipelineStartTime = std::chrono::high_resolution_clock::now();
+		if (!CreateGraphicsPipelines(gPipelineCache.Get(), renderPass, { width, height },
+			vertexShader, pixelShader, depthVertexShader, gPipelines))
+			std::cerr << "ERROR: Unable to create graphics pipeline!\n";
+		if (gPipelines.depthPrepass == nullptr)
+		{
+			std::cerr << "ERROR: Unable to create depth pre-pass pipelines!\n";
+			gDepthPrepassMode = DEPTH_PREPASS_OFF;
+		}
+
+		// Two-phase occlusion culling, falls back to frustum culling only if unavailable
+		if (!gHiZ.Create(device, physicalDevice, graphicsQueue, commandPool,
+			pipelineLayout, depthVertexShader, hizBuildShader, gFrameRing.GetCount(), gPipelineCache.Get()))
+		{
+			std::cerr << "ERROR: Unable to create HiZ occlusion culling resources!\n";
+			gHiZ.Destroy();
+			if (gOcclusionMode == OCCLUSION_HIZ)
+				gOcclusionMode = OCCLUSION_SOFTWARE;
+		}
+		float pipelineTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - pipelineStartTime).count();
+		std::cout << "Pipelines created in " << pipelineTime << "ms ("
+			<< (gPipelineCache.IsWarm() ? "warm" : "cold") << " pipeline cache)\n";
+		unsigned int pipelineCount = gPipelines.depthPrepass != nullptr ? 1 : 0;
+		for (unsigned int i = 0; i < MATERIAL_VARIANT_COUNT; i++)
+			pipelineCount += (gPipelines.main[i] != nullptr ? 1 : 0) + (gPipelines.depthEqual[i] != nullptr ? 1 : 0);
+		gLoadReport.AddPhase(LOAD_PHASE_PIPELINES, pipelineTime, 0, 0, pipelineCount);
 
 		// With pipeline created, lets load in our texture and bind it to our descriptor set
+		gTextureStreamer.Start(gTextureTranscodeFormat);
+		if (!CreateTextureSampler())
+			return;
 		LoadTextures();
 
+		// Rebuild the draw pipelines in the background whenever their shaders are saved
+		gShaderWatcher.Start({ VERTEX_SHADER_PATH, PIXEL_SHADER_PATH, DEPTH_VERTEX_SHADER_PATH },
+			[this, renderPass]() { ReloadShaders(renderPass); });
+
 		/***************** CLEANUP / SHUTDOWN ******************/
-		// GVulkanSurface will inform us when to release any allocated resources
+		// GVulkanSurface will inform us when to release any allocated resources, headless runs rely on the destructor
+		if (offscreen != nullptr)
+			return;
 		shutdown.Create(vlk, [&]() {
 			if (+shutdown.Find(GW::GRAPHICS::GVulkanSurface::Events::RELEASE_RESOURCES, true)) {
 				CleanUp(); // unlike D3D we must be careful about destroy timing
@@ -653,15 +1243,23 @@ public:
 
 	void Render()
 	{
+		// Once this slot's last frame is done, so is every frame before it: retired resources can go
+		unsigned int frameIndex = gFrameRing.Begin();
+		gProfiler.BeginFrame(frameIndex);
+		gHiZ.BeginFrame(frameIndex);
+		gDeletionQueue.Flush(gFrameCount);
+		ApplyLevelSwap();
+		ApplyShaderReload();
+		gTextureCache.BeginFrame(gFrameCount, gFrameRing.GetCount());
+		StreamTextures();
+
 		// grab the current Vulkan commandBuffer
-		unsigned int currentBuffer;
-		vlk.GetSwapchainCurrentImage(currentBuffer);
-		VkCommandBuffer commandBuffer;
-		vlk.GetCommandBuffer(currentBuffer, (void**)&commandBuffer);
+		VkCommandBuffer commandBuffer = GetCommandBuffer();
+		// Only what is recorded into the surface's command buffer, the HiZ depth pass is submitted on its own
+		gProfiler.BeginGpu(commandBuffer, "Surface commands");
 		// what is the current client area dimensions?
 		unsigned int width, height;
-		win.GetClientWidth(width);
-		win.GetClientHeight(height);
+		GetClientSize(width, height);
 		// setup the pipeline's dynamic settings
 		VkViewport viewport = {
             0, 0, static_cast<float>(width), static_cast<float>(height), 0, 1
@@ -669,10 +1267,11 @@ public:
         VkRect2D scissor = { {0, 0}, {width, height} };
 		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+		RecordCameraFrame();
 
 		// Update Camera
-		vlk.GetAspectRatio(gCamera.aspectRatio);
+		GetAspectRatio(gCamera.aspectRatio);
 		GW::MATH::GMatrix::ProjectionDirectXLHF(gCamera.FOV, gCamera.aspectRatio,
 			gCamera.nearPlane, gCamera.farPlane, gMatrices.projection);
 		gShaderModelData.projectionMatrix = gMatrices.projection;
@@ -681,111 +1280,251 @@ public:
 		gShaderModelData.lightDirection = gLight.Direction;
 		gShaderModelData.lightColor = gLight.Color;
 		
-		// Bind Matrix Descriptor Sets to Vertex Shader
-		unsigned int currentImageIndex;
-		vlk.GetSwapchainCurrentImage(currentImageIndex);
+		// Bind this frame's Matrix Descriptor Set to Vertex Shader
 		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
-			0, 1, &gMatrixDescriptorSets[currentImageIndex], 0, nullptr);
-		GvkHelper::write_to_buffer(device, gMatrixData[currentImageIndex], &gShaderModelData, sizeof(SHADER_MODEL_DATA));
+			0, 1, &gMatrixDescriptorSets[frameIndex], 0, nullptr);
+
+		// Frustum & occlusion culling, then LOD selection. Visible matrices are packed per model by LOD
+		GW::MATH::GMATRIXF viewProjection;
+		GW::MATH::GMatrix::MultiplyMatrixF(gMatrices.view, gMatrices.projection, viewProjection);
+		CullInstances(viewProjection);
+		AssignLods();
+		WriteVisibleMatrices(gMatrixData[frameIndex]);
+		BuildOcclusionPyramid(viewProjection, gMatrixDescriptorSets[frameIndex]);
+		UpdateTextureResidency();
+
+		// Build, sort & merge this frame's draws, then submit them with redundant binds skipped
+		BuildDrawList();
+		UpdateDepthPrepass(viewProjection);
+		if (gDepthPrepassActive)
+		{
+			gProfiler.BeginGpu(commandBuffer, "Depth pre-pass");
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, gPipelines.depthPrepass);
+			SubmitDepthPrepass(commandBuffer);
+			gProfiler.EndGpu(commandBuffer);
+		}
+		gProfiler.BeginGpu(commandBuffer, "Main pass");
+		SubmitDrawList(commandBuffer, gDepthPrepassActive ? gPipelines.depthEqual : gPipelines.main);
+		gProfiler.EndGpu(commandBuffer);
+		gProfiler.EndGpu(commandBuffer);
+
+		LogCullingStats();
+		LogMemoryStats();
+		++gFrameCount;
+	}
 
-		VkDeviceSize offsets[] = { 0 };
-		PushConstants pushConstants = { 0, 0};
+	// After the surface has submitted the frame Render recorded: submits the texture uploads it recorded
+	// & fences the frame's ring slot
+	void EndFrame()
+	{
+		gTextureCache.SubmitTransfers();
+		gFrameRing.End(GetGraphicsQueue());
+		gProfiler.EndFrame();
+	}
 
-		unsigned int diffuseOffset = 1;
-		unsigned int specularOffset = 1;
-		unsigned int normalOffset = 1;
-		for (int i = 0; i < gObjects.size(); i++)
+	void CheckCommands()
+	{
+		// Cycle occlusion culling mode (off -> HiZ -> software), HiZ is skipped when unavailable
+		if (KeyPressed(G_KEY_F2))
 		{
-			graphics::MODEL obj = gObjects[i];
-			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &(vkObjects[i].vertexHandle), offsets);
-			vkCmdBindIndexBuffer(commandBuffer, vkObjects[i].indexHandle, 0, VkIndexType::VK_INDEX_TYPE_UINT32);
-			
-			// Reset offset counters
-			unsigned int tDiffuseCount = 0;
-			unsigned int tSpecularCount = 0;
-			unsigned int tNormalCount = 0;
-
-			// Loop through each submesh and bind textures/offsets
-			for (int j = 0; j < obj.meshCount; j++)
-			{
-				// Bind Diffuse Texture Descriptor Sets to Pixel Shader
-				if (obj.materialInfo.diffuseCount > tDiffuseCount)
-				{
-					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-						pipelineLayout, 1, 1,
-						&(gDiffuseTextureDescriptorSets[diffuseOffset++]), 0, nullptr);
-					++tDiffuseCount;
-				}
-				else
-					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-						pipelineLayout, 1, 1,
-						&(gDiffuseTextureDescriptorSets[0]), 0, nullptr);
+			gOcclusionMode = (OCCLUSION_MODE)((gOcclusionMode + 1) % OCCLUSION_MODE_COUNT);
+			if (gOcclusionMode == OCCLUSION_HIZ && !gHiZ.IsValid())
+				gOcclusionMode = OCCLUSION_SOFTWARE;
+			ResetCullingState();
+			std::cout << "Occlusion culling: " << OCCLUSION_MODE_NAMES[gOcclusionMode] << "\n";
+		}
 
-				// Bind Specular Texture Descriptor Sets to Pixel Shader
-				if (obj.materialInfo.specularCount > tSpecularCount)
-				{
-					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-						pipelineLayout, 2, 1,
-						&(gSpecularTextureDescriptorSets[specularOffset++]), 0, nullptr);
-					++tSpecularCount;
-				}
-				else
-					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-						pipelineLayout, 2, 1,
-						&(gSpecularTextureDescriptorSets[0]), 0, nullptr);
+		// Cycle depth pre-pass (auto -> on -> off)
+		if (KeyPressed(G_KEY_F4) && gPipelines.depthPrepass != nullptr)
+		{
+			gDepthPrepassMode = (DEPTH_PREPASS_MODE)((gDepthPrepassMode + 1) % DEPTH_PREPASS_MODE_COUNT);
+			std::cout << "Depth pre-pass: " << DEPTH_PREPASS_MODE_NAMES[gDepthPrepassMode] << "\n";
+		}
 
-				// Bind Normal Texture Descriptor Sets to Pixel Shader
-				if (obj.materialInfo.normalCount > tNormalCount)
-				{
-					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-						pipelineLayout, 3, 1,
-						&(gNormalTextureDescriptorSets[normalOffset++]), 0, nullptr);
-					++tNormalCount;
-				}
-				else
-					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-						pipelineLayout, 3, 1,
-						&(gNormalTextureDescriptorSets[0]), 0, nullptr);
+		// Write the timers' rolling min / avg / p99 to CSV & JSON
+		if (KeyPressed(G_KEY_F5))
+		{
+			if (gProfiler.WriteCsv(PROFILE_CSV_PATH) && gProfiler.WriteJson(PROFILE_JSON_PATH))
+				std::cout << "Frame timings written to " << PROFILE_CSV_PATH << " & " << PROFILE_JSON_PATH << "\n";
+		}
 
-				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-					0, sizeof(PushConstants), &pushConstants);
-				vkCmdDrawIndexed(commandBuffer, obj.meshes[j].drawInfo.indexCount, obj.instanceCount, 
-					obj.meshes[j].drawInfo.indexOffset, 0, 0);
-				pushConstants.material_offset += 1;
+		// Start a timeline capture, or stop & write the running one
+		if (KeyPressed(G_KEY_F6))
+		{
+			if (Trace::IsEnabled())
+			{
+				Trace::Stop();
+				Trace::Write(TRACE_PATH);
+			}
+			else
+			{
+				Trace::Start();
+				std::cout << "Trace capture started, F6 again to write " << TRACE_PATH << "\n";
 			}
+		}
 
-			pushConstants.matrix_offset += obj.instanceCount;
+		// Start recording a camera path, or stop & save the running one
+		if (KeyPressed(G_KEY_F7))
+		{
+			if (gRecordingCamera)
+				StopCameraRecording();
+			else
+			{
+				gCameraRecording.Begin(gLevelSelector.GetSelectedFile());
+				gLastRecordedFrame = std::chrono::high_resolution_clock::now();
+				gRecordingCamera = true;
+				std::cout << "Camera path recording started, F7 again to write " << CAMERA_PATH_PATH << "\n";
+			}
 		}
-	}
 
-	void CheckCommands()
-	{
+		// Toggle distance based mesh LODs
+		if (KeyPressed(G_KEY_F3))
+		{
+			gLodEnabled = !gLodEnabled;
+			std::cout << "Mesh LODs " << (gLodEnabled ? "enabled" : "disabled") << "\n";
+		}
+
+		// Pick a level, then keep rendering the current one while the new one loads (see ApplyLevelSwap)
 		float keyState;
 		gInputProxy.GetState(G_KEY_F1, keyState);
-		if (keyState > 0 && !gLevelSelector.IsCurrentlySelectingFile())
+		if (keyState > 0 && !gLevelLoading && !gLevelSelector.IsCurrentlySelectingFile())
 		{
 			while (!gLevelSelector.SelectNewLevel(true))
 				;
-			CleanUpLevel();
-			while (gLevelSelector.ParseSelectedLevel() != LevelSelector::OK)
-			{
-				MessageBox(NULL, L"Unable to parse level!",
-					L"Error (Parsing Level)",
-					MB_OK);
-			}
-			
-			ChangeLevel(gLevelSelector.levelParser.ModelsToVector(), gLevelSelector.levelParser.CamerasToVector());
-			InitializeGeometry();
-			AllocateDescriptorSets();
-			LoadTextures();
+			StartLevelLoad(gLevelSelector.GetSelectedFile());
 		}
 	}
 
 private:
-	void ChangeLevel(std::vector<graphics::MODEL> _objects, std::vector<graphics::CAMERA> _cameras)
+	// True only on the frame the key goes down
+	bool KeyPressed(int key)
+	{
+		float keyState;
+		gInputProxy.GetState(key, keyState);
+		bool isDown = keyState > 0;
+		bool wasDown = gKeyStates[key];
+		gKeyStates[key] = isDown;
+		return isDown && !wasDown;
+	}
+
+	// The window & surface, or the offscreen surface when headless
+	void GetClientSize(unsigned int& width, unsigned int& height)
+	{
+		if (offscreen != nullptr)
+		{
+			width = offscreen->GetWidth();
+			height = offscreen->GetHeight();
+			return;
+		}
+		win.GetClientWidth(width);
+		win.GetClientHeight(height);
+	}
+
+	void GetAspectRatio(float& aspectRatio)
 	{
-		gObjects = _objects;
-		gCameras = _cameras;
+		if (offscreen != nullptr)
+			aspectRatio = offscreen->GetAspectRatio();
+		else
+			vlk.GetAspectRatio(aspectRatio);
+	}
+
+	VkCommandBuffer GetCommandBuffer()
+	{
+		if (offscreen != nullptr)
+			return offscreen->GetCommandBuffer();
+		unsigned int currentBuffer;
+		vlk.GetSwapchainCurrentImage(currentBuffer);
+		VkCommandBuffer commandBuffer;
+		vlk.GetCommandBuffer(currentBuffer, (void**)&commandBuffer);
+		return commandBuffer;
+	}
+
+	VkQueue GetGraphicsQueue()
+	{
+		if (offscreen != nullptr)
+			return offscreen->GetGraphicsQueue();
+		VkQueue graphicsQueue;
+		vlk.GetGraphicsQueue((void**)&graphicsQueue);
+		return graphicsQueue;
+	}
+
+	// Culling bounds, LOD chains & model buffers for a parsed level. Touches nothing the render loop
+	// uses, so it runs on the level loader thread (or inline at startup)
+	void PrepareLevel(LEVEL_DATA& level)
+	{
+		TRACE_SCOPE("PrepareLevel");
+		// Bounds for culling, instances never move so world bounds are computed once
+		auto boundsStart = std::chrono::high_resolution_clock::now();
+		for (graphics::MODEL& obj : level.objects)
+		{
+			obj.bounds = Culling::ComputeBounds(obj.vertices);
+			obj.instanceBounds.resize(obj.worldMatrices.size());
+			for (int i = 0; i < obj.worldMatrices.size(); i++)
+				obj.instanceBounds[i] = Culling::TransformBounds(obj.bounds, obj.worldMatrices[i]);
+
+			// Coarser LODs are appended to the model's indices before the index buffer is created
+			MeshLod::BuildLodChain(obj);
+		}
+		level.report.AddPhase(LOAD_PHASE_BOUNDS_LODS, std::chrono::duration<double, std::milli>(
+			std::chrono::high_resolution_clock::now() - boundsStart).count(), 0, 0, (unsigned int)level.objects.size());
+
+		// Create Vertex/Index Buffers
+		level.vkObjects.resize(level.objects.size());
+		for (int i = 0; i < level.objects.size(); i++)
+		{
+			const graphics::MODEL& obj = level.objects[i];
+			vkObject& vkObj = level.vkObjects[i];
+			auto bufferStart = std::chrono::high_resolution_clock::now();
+			uint64_t uploaded = 0;
+
+			// Create Vertex Buffer
+			unsigned int numBytes = sizeof(graphics::VERTEX) * obj.vertexCount;
+			GvkHelper::create_buffer(physicalDevice, device, numBytes,
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &(vkObj.vertexHandle), &(vkObj.vertexData));
+			GvkHelper::write_to_buffer(device, vkObj.vertexData, &(obj.vertices.front()), numBytes);
+			uploaded += numBytes;
+
+			// Create Index Buffer (original indices followed by every LOD)
+			numBytes = sizeof(unsigned int) * obj.indices.size();
+			GvkHelper::create_buffer(physicalDevice, device, numBytes,
+				VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &(vkObj.indexHandle), &(vkObj.indexData));
+			GvkHelper::write_to_buffer(device, vkObj.indexData, &(obj.indices.front()), numBytes);
+			uploaded += numBytes;
+
+			// Create Position Buffer (depth pre-pass reads 12 bytes per vertex instead of 36)
+			std::vector<graphics::VECTOR> positions(obj.vertexCount);
+			for (unsigned int j = 0; j < obj.vertexCount; j++)
+				positions[j] = obj.vertices[j].pos;
+			numBytes = sizeof(graphics::VECTOR) * obj.vertexCount;
+			GvkHelper::create_buffer(physicalDevice, device, numBytes,
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &(vkObj.positionHandle), &(vkObj.positionData));
+			GvkHelper::write_to_buffer(device, vkObj.positionData, positions.data(), numBytes);
+			uploaded += numBytes;
+
+			gMemoryStats.Add(MEMORY_GPU_VERTEX, BufferBytes(vkObj.vertexHandle) + BufferBytes(vkObj.positionHandle));
+			gMemoryStats.Add(MEMORY_GPU_INDEX, BufferBytes(vkObj.indexHandle));
+
+			double bufferTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - bufferStart).count();
+			level.report.AddPhase(LOAD_PHASE_BUFFERS, bufferTime, 0, uploaded, 3);
+			level.report.AddMesh(obj.modelName, bufferTime, 0);
+		}
+		level.valid = true;
+	}
+
+	// Makes a prepared level the current one, its model buffers included
+	void ChangeLevel(LEVEL_DATA& level)
+	{
+		TRACE_SCOPE("ChangeLevel");
+		gMemoryStats.Remove(MEMORY_CPU_GEOMETRY, GeometryBytes(gObjects));
+		gMemoryStats.Add(MEMORY_CPU_GEOMETRY, GeometryBytes(level.objects));
+		gObjects = std::move(level.objects);
+		gCameras = std::move(level.cameras);
+		gLevelInfo = level.levelInfo;
+		vkObjects = std::move(level.vkObjects);
+		gLoadReport = std::move(level.report);
 
 		maxCameraSpeed = 13.0f;
 		minCameraSpeed = 0.1f;
@@ -806,12 +1545,16 @@ private:
 
 		gCamera = gCameras.size() == 0 ? DefaultCamera : gCameras[0];
 
+		gSoftwareOcclusion.SelectOccluders(gObjects);
+		ResetCullingState();
+		BuildDrawStates();
+
 		// Set Up Matrices
 		{
 			GW::MATH::GMatrix::IdentityF(gMatrices.world);
 			GW::MATH::GMatrix::InverseF(gCamera.worldMatrix, gMatrices.view);
 
-			vlk.GetAspectRatio(gCamera.aspectRatio);
+			GetAspectRatio(gCamera.aspectRatio);
 			GW::MATH::GMatrix::ProjectionDirectXLHF(gCamera.FOV, gCamera.aspectRatio,
 				gCamera.nearPlane, gCamera.farPlane, gMatrices.projection);
 		}
@@ -832,40 +1575,18 @@ private:
 			gShaderModelData.cameraPos.z = gCamera.worldMatrix.row4.y;
 			gShaderModelData.cameraPos.w = gCamera.worldMatrix.row4.w;
 		}
-
-		// Create Vertex/Index Buffers
-
-		unsigned int totalNumVerts = 0;
-		vkObjects.resize(gObjects.size());
-		for (int i = 0; i < gObjects.size(); i++)
-		{
-			// Create Vertex Buffer
-			unsigned int numBytes = sizeof(graphics::VERTEX) * gObjects[i].vertexCount;
-			GvkHelper::create_buffer(physicalDevice, device, numBytes,
-				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &(vkObjects[i].vertexHandle), &(vkObjects[i].vertexData));
-			GvkHelper::write_to_buffer(device, vkObjects[i].vertexData, &(gObjects[i].vertices.front()), numBytes);
-
-			// Create Index Buffer
-			numBytes = sizeof(unsigned int) * gObjects[i].indexCount;
-			GvkHelper::create_buffer(physicalDevice, device, numBytes,
-				VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &(vkObjects[i].indexHandle), &(vkObjects[i].indexData));
-			GvkHelper::write_to_buffer(device, vkObjects[i].indexData, &(gObjects[i].indices.front()), numBytes);
-		}
 	}
 
 	void InitializeGeometry()
 	{
-		unsigned int chainSwapCount;
-		vlk.GetSwapchainImageCount(chainSwapCount);
-		gMatrixBuffers.resize(chainSwapCount);
-		gMatrixData.resize(chainSwapCount);
-		for (unsigned int i = 0; i < chainSwapCount; i++)
+		gMatrixBuffers.resize(gFrameRing.GetCount());
+		gMatrixData.resize(gFrameRing.GetCount());
+		for (unsigned int i = 0; i < gFrameRing.GetCount(); i++)
 		{
 			GvkHelper::create_buffer(physicalDevice, device, sizeof(SHADER_MODEL_DATA),
 				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
 				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &gMatrixBuffers[i], &gMatrixData[i]);
+			gMemoryStats.Add(MEMORY_STORAGE_BUFFERS, BufferBytes(gMatrixBuffers[i]));
 		}
 		WriteModelsToShaderData();
 	}
@@ -876,24 +1597,17 @@ private:
 
 		// Create a descriptor pool!
 		// this is how many unique descriptor sets you want to allocate 
-		// we need one for each uniform buffer and one for each unique texture
-		unsigned int diffuseDescriptorCount = gLevelSelector.levelParser.levelInfo.totalDiffuseCount + 1;
-		unsigned int specularDescriptorCount = gLevelSelector.levelParser.levelInfo.totalSpecularCount + 1;
-		unsigned int normalDescriptorCount = gLevelSelector.levelParser.levelInfo.totalNormalCount + 1;
-		unsigned int total_descriptorsets = gMatrixBuffers.size()
-			+ diffuseDescriptorCount + specularDescriptorCount + normalDescriptorCount;
-		VkDescriptorPoolSize descriptorPoolSize[4] = {
-			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, gMatrixBuffers.size() },
-			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, diffuseDescriptorCount},
-			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, specularDescriptorCount},
-			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, normalDescriptorCount}
+		// we need one for each uniform buffer, texture sets come from gTextureCache
+		unsigned int total_descriptorsets = gMatrixBuffers.size();
+		VkDescriptorPoolSize descriptorPoolSize[1] = {
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, gMatrixBuffers.size() }
 		};
 
 		descPoolCreateInfo = {};
 		descPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 		descPoolCreateInfo.flags = 0;
 		descPoolCreateInfo.maxSets = total_descriptorsets;
-		descPoolCreateInfo.poolSizeCount = 4;
+		descPoolCreateInfo.poolSizeCount = 1;
 		descPoolCreateInfo.pPoolSizes = descriptorPoolSize;
 		descPoolCreateInfo.pNext = nullptr;
 		res = vkCreateDescriptorPool(device, &descPoolCreateInfo, nullptr, &descPool);
@@ -903,50 +1617,13 @@ private:
 			return;
 		}
 
-		// Create a descriptor sets for our diffuse textures!
-		gDiffuseTextureDescriptorSets.resize(diffuseDescriptorCount);
+		// Create descriptor sets for matrix Buffers
 		VkDescriptorSetAllocateInfo descriptorsetAllocateInfo = {};
 		descriptorsetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 		descriptorsetAllocateInfo.descriptorSetCount = 1;
-		descriptorsetAllocateInfo.pSetLayouts = &descriptorSetLayout_Pixel;
+		descriptorsetAllocateInfo.pSetLayouts = &descriptorSetLayout_Vertex;
 		descriptorsetAllocateInfo.descriptorPool = descPool;
 		descriptorsetAllocateInfo.pNext = nullptr;
-		for (int i = 0; i < diffuseDescriptorCount; i++)
-		{
-			res = vkAllocateDescriptorSets(device, &descriptorsetAllocateInfo, &gDiffuseTextureDescriptorSets[i]);
-			if (res != VkResult::VK_SUCCESS)
-			{
-				std::cerr << "ERROR: Unable to allocate diffuse descriptorSets!\n";
-				return;
-			}
-		}
-
-		// Create a descriptor sets for our specular textures!
-		gSpecularTextureDescriptorSets.resize(specularDescriptorCount);
-		for (int i = 0; i < specularDescriptorCount; i++)
-		{
-			res = vkAllocateDescriptorSets(device, &descriptorsetAllocateInfo, &gSpecularTextureDescriptorSets[i]);
-			if (res != VkResult::VK_SUCCESS)
-			{
-				std::cerr << "ERROR: Unable to allocate specular descriptorSets!\n";
-				return;
-			}
-		}
-
-		// Create a descriptor sets for our normal textures!
-		gNormalTextureDescriptorSets.resize(normalDescriptorCount);
-		for (int i = 0; i < normalDescriptorCount; i++)
-		{
-			res = vkAllocateDescriptorSets(device, &descriptorsetAllocateInfo, &gNormalTextureDescriptorSets[i]);
-			if (res != VkResult::VK_SUCCESS)
-			{
-				std::cerr << "ERROR: Unable to allocate normal descriptorSets!\n";
-				return;
-			}
-		}
-
-		// Create descriptor sets for matrix Buffers
-		descriptorsetAllocateInfo.pSetLayouts = &descriptorSetLayout_Vertex;
 		VkWriteDescriptorSet writeDescriptorSet = {};
 		writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 		writeDescriptorSet.descriptorCount = 1;
@@ -956,10 +1633,8 @@ private:
 		VkDescriptorBufferInfo descriptorBufferInfo = { nullptr, 0, VK_WHOLE_SIZE };
 		writeDescriptorSet.pBufferInfo = &descriptorBufferInfo;
 
-		unsigned int chainSwapCount;
-		vlk.GetSwapchainImageCount(chainSwapCount);
-		gMatrixDescriptorSets.resize(chainSwapCount);
-		for (int i = 0; i < chainSwapCount; i++)
+		gMatrixDescriptorSets.resize(gMatrixBuffers.size());
+		for (int i = 0; i < gMatrixBuffers.size(); i++)
 		{
 			res = vkAllocateDescriptorSets(device, &descriptorsetAllocateInfo, &gMatrixDescriptorSets[i]);
 			if (res != VkResult::VK_SUCCESS)
@@ -975,141 +1650,145 @@ private:
 
 	bool LoadTextures()
 	{
-		VkQueue queue;
-		VkCommandPool commandPool;
-		VkPhysicalDevice physDevice;
-		VkResult vr;
-		vlk.GetGraphicsQueue((void**)&queue);
-		vlk.GetCommandPool((void**)&commandPool);
-		vlk.GetPhysicalDevice((void**)&physDevice);
-
-		// libktx, temporary variables
-		ktxTexture* kTexture;
-		KTX_error_code ktxResult;
-		ktxVulkanDeviceInfo vlkDeviceInfo;
-
-		// used to transfer texture CPU memory to GPU. just need one
-		ktxResult = ktxVulkanDeviceInfo_Construct(&vlkDeviceInfo, physDevice, device, queue, commandPool, nullptr);
-		if (ktxResult != KTX_error_code::KTX_SUCCESS)
-			return false;
-
-		// load all textures into CPU memory from file first
-		unsigned int totalDiffuseCount = gLevelSelector.levelParser.levelInfo.totalDiffuseCount + 1;
-		unsigned int totalSpecularCount = gLevelSelector.levelParser.levelInfo.totalSpecularCount + 1;
-		unsigned int totalNormalCount = gLevelSelector.levelParser.levelInfo.totalNormalCount + 1;
-		// Preallocate space for diffuse textures/views
-		gDiffuseTextures.resize(totalDiffuseCount);
-		gDiffuseTextureViews.resize(totalDiffuseCount);
-		// Preallocate space for specular textures/views
-		gSpecularTextureViews.resize(totalSpecularCount);
-		gSpecularTextures.resize(totalSpecularCount);
-		// Preallocate space for normal textures/views
-		gNormalTextureViews.resize(totalNormalCount);
-		gNormalTextures.resize(totalNormalCount);
-
-		unsigned int diffuseIndex = 0;
-		unsigned int specularIndex = 0;
-		unsigned int normalIndex = 0;
-		unsigned maxLod = 0;
-
-		// Create default diffuse map
-		ktxResult = CreateTexture(DEFAULT_DIFFUSE_MAP, &kTexture, vlkDeviceInfo, 
-			&(gDiffuseTextures[0]), diffuseIndex, maxLod);
-		if (ktxResult != KTX_error_code::KTX_SUCCESS)
-		{
-			std::cerr << "ERROR: LoadTextures - failed to load default diffuse map!\n";
-			return false;
+		TRACE_SCOPE("LoadTextures");
+		// Whatever the previous level still had queued is no longer needed
+		gTextureStreamer.Cancel();
+		gTextureCache.CancelRefines();
+		gStreamedTextureSlots.clear();
+		gTexturesStreaming = 0;
+		gTextureResidencyDue = true;
+
+		// Every material slot shows the defaults until its own maps arrive. After the first level they are
+		// resident, so a swap takes them without waiting on any upload; only startup loads them
+		gTextureCache.ResetStats();
+		const char* defaultPaths[TEXTURE_MAP_COUNT] = { DEFAULT_DIFFUSE_MAP, DEFAULT_SPECULAR_MAP, DEFAULT_NORMAL_MAP };
+		std::vector<unsigned int> defaultHandles;
+		for (const char* path : defaultPaths)
+		{
+			unsigned int handle = gTextureCache.AcquireResident(path);
+			if (handle != TEXTURE_CACHE_INVALID)
+				defaultHandles.push_back(handle);
 		}
-
-		// Create default specular map
-		ktxResult = CreateTexture(DEFAULT_SPECULAR_MAP, &kTexture, vlkDeviceInfo, 
-			&(gSpecularTextures[0]), specularIndex, maxLod);
-		if (ktxResult != KTX_error_code::KTX_SUCCESS)
+		bool loaded = defaultHandles.size() == TEXTURE_MAP_COUNT;
+		if (!loaded)
 		{
-			std::cerr << "ERROR: LoadTextures - failed to load default specular map!\n";
-			return false;
+			for (unsigned int handle : defaultHandles)
+				gTextureCache.Release(handle);
+			defaultHandles.clear();
+			loaded = gTextureCache.AcquireBatch(
+				std::vector<std::string>(defaultPaths, defaultPaths + TEXTURE_MAP_COUNT), defaultHandles);
 		}
-
-		// Create default normal map
-		ktxResult = CreateTexture(DEFAULT_NORMAL_MAP, &kTexture, vlkDeviceInfo,
-			&(gNormalTextures[0]), normalIndex, maxLod);
-		if (ktxResult != KTX_error_code::KTX_SUCCESS)
+		if (!loaded)
 		{
-			std::cerr << "ERROR: LoadTextures - failed to load default normal map!\n";
+			std::cerr << "ERROR: LoadTextures - failed to load the default maps\n";
+			for (unsigned int handle : defaultHandles)
+				gTextureCache.Release(handle);
 			return false;
 		}
 
-		// Create All Textures from objects
-		for (auto graphicsObject : gObjects)
+		// One handle per material map in the order BuildDrawStates numbers them, slot 0 is the default map.
+		// Files already resident (shared with the previous level) are bound right away, the rest are streamed
+		std::vector<unsigned int> handles[TEXTURE_MAP_COUNT];
+		for (unsigned int map = 0; map < TEXTURE_MAP_COUNT; map++)
+			handles[map].push_back(defaultHandles[map]);
+
+		std::vector<TextureStreamer::REQUEST> requests;
+		std::unordered_map<std::string, unsigned int> requestIds;
+		auto request = [&](const std::string& path, TEXTURE_MAP map, const graphics::MODEL& graphicsObject)
 		{
-			for (int i = 0; i < graphicsObject.materials.size(); i++)
+			unsigned int slot = (unsigned int)handles[map].size();
+			unsigned int handle = gTextureCache.AcquireResident(path);
+			if (handle != TEXTURE_CACHE_INVALID)
 			{
-				// Create Diffuse Texture
-				std::string textureStr = graphicsObject.diffuseTextures[i];
-				if (textureStr.compare("") != 0)
-				{
-					ktxResult = CreateTexture(textureStr.c_str(), &kTexture, vlkDeviceInfo, 
-						&(gDiffuseTextures[diffuseIndex]), diffuseIndex, maxLod);
-					if (ktxResult != KTX_error_code::KTX_SUCCESS)
-					{
-						std::cerr << "ERROR: LoadTextures - failed to load diffuse map (" << textureStr << ")\n";
-						return false;
-					}
-				}
+				handles[map].push_back(handle);
+				return;
+			}
+			gTextureCache.Retain(defaultHandles[map]);
+			handles[map].push_back(defaultHandles[map]);
 
-				// Create Specular Texture
-				textureStr = graphicsObject.specularTextures[i];
-				if (textureStr.compare("") != 0)
-				{
-					ktxResult = CreateTexture(textureStr.c_str(), &kTexture, vlkDeviceInfo, 
-						&(gSpecularTextures[specularIndex]), specularIndex, maxLod);
-					if (ktxResult != KTX_error_code::KTX_SUCCESS)
-					{
-						std::cerr << "ERROR: LoadTextures - failed to load diffuse map (" << textureStr << ")\n";
-						return false;
-					}
-				}
+			auto found = requestIds.emplace(TextureCache::CanonicalPath(path), (unsigned int)requests.size());
+			if (found.second)
+			{
+				requests.push_back({ found.first->second, path, {} });
+				gStreamedTextureSlots.emplace_back();
+			}
+			TextureStreamer::REQUEST& streamRequest = requests[found.first->second];
+			gStreamedTextureSlots[found.first->second].push_back({ map, slot });
+			for (const graphics::AABB& bounds : graphicsObject.instanceBounds)
+				streamRequest.positions.push_back({ (bounds.min.x + bounds.max.x) * 0.5f,
+					(bounds.min.y + bounds.max.y) * 0.5f, (bounds.min.z + bounds.max.z) * 0.5f });
+		};
 
-				// Create Normal Texture
-				textureStr = graphicsObject.normalTextures[i];
-				if (textureStr.compare("") != 0)
-				{
-					ktxResult = CreateTexture(textureStr.c_str(), &kTexture, vlkDeviceInfo,
-						&(gNormalTextures[normalIndex]), normalIndex, maxLod);
-					if (ktxResult != KTX_error_code::KTX_SUCCESS)
-					{
-						std::cerr << "ERROR: LoadTextures - failed to load normal map (" << textureStr << ")\n";
-						return false;
-					}
-				}
+		for (int i = 0; i < gObjects.size(); i++)
+		{
+			const graphics::MODEL& graphicsObject = gObjects[i];
+			for (int j = 0; j < graphicsObject.materials.size(); j++)
+			{
+				if (!graphicsObject.diffuseTextures[j].empty())
+					request(graphicsObject.diffuseTextures[j], TEXTURE_MAP_DIFFUSE, graphicsObject);
+				if (!graphicsObject.specularTextures[j].empty())
+					request(graphicsObject.specularTextures[j], TEXTURE_MAP_SPECULAR, graphicsObject);
+				if (!graphicsObject.normalTextures[j].empty())
+					request(graphicsObject.normalTextures[j], TEXTURE_MAP_NORMAL, graphicsObject);
 			}
 		}
 
-		// Error check, ensure proper number of diffuse textures were read in.
-		if (diffuseIndex != totalDiffuseCount)
+		// Drop the previous level's references only now, so textures both levels use stay resident
+		ReleaseTextures();
+		gDiffuseTextureHandles = handles[TEXTURE_MAP_DIFFUSE];
+		gSpecularTextureHandles = handles[TEXTURE_MAP_SPECULAR];
+		gNormalTextureHandles = handles[TEXTURE_MAP_NORMAL];
+
+		// Error check, ensure proper number of textures were read in.
+		unsigned int totalDiffuseCount = gLevelInfo.totalDiffuseCount + 1;
+		unsigned int totalSpecularCount = gLevelInfo.totalSpecularCount + 1;
+		unsigned int totalNormalCount = gLevelInfo.totalNormalCount + 1;
+		if (gDiffuseTextureHandles.size() != totalDiffuseCount)
 		{
-			std::cerr << "ERR: LoadTextures - diffuseMap count mismatch! (" << diffuseIndex <<
+			std::cerr << "ERR: LoadTextures - diffuseMap count mismatch! (" << gDiffuseTextureHandles.size() <<
 				" vs excepted " << totalDiffuseCount << ")\n";
 			return false;
 		}
-
-		// Error check, ensure proper number of specular textures were read in.
-		if (specularIndex != totalSpecularCount)
+		if (gSpecularTextureHandles.size() != totalSpecularCount)
 		{
-			std::cerr << "ERR: LoadTextures - specularMap count mismatch! (" << specularIndex <<
+			std::cerr << "ERR: LoadTextures - specularMap count mismatch! (" << gSpecularTextureHandles.size() <<
 				" vs excepted " << totalSpecularCount << ")\n";
 			return false;
 		}
-
-		// Error check, ensure proper number of normal textures were read in.
-		if (normalIndex != totalNormalCount)
+		if (gNormalTextureHandles.size() != totalNormalCount)
 		{
-			std::cerr << "ERR: LoadTextures - normalMap count mismatch! (" << specularIndex <<
-				" vs excepted " << totalSpecularCount << ")\n";
+			std::cerr << "ERR: LoadTextures - normalMap count mismatch! (" << gNormalTextureHandles.size() <<
+				" vs excepted " << totalNormalCount << ")\n";
 			return false;
 		}
 
-		// Create the sampler
+		ResolveTextureSets();
+		for (unsigned int map = 0; map < TEXTURE_MAP_COUNT; map++)
+			gTextureSlotSizes[map].assign(handles[map].size(), 0.0f);
+
+		gTexturesStreaming = (unsigned int)requests.size();
+		gTextureStreamStart = std::chrono::high_resolution_clock::now();
+		gTextureStreamer.Queue(std::move(requests));
+		if (gTexturesStreaming == 0)
+		{
+			PackTextureArrays();
+			FinishLoadReport();
+		}
+
+		const TextureCache::STATS& stats = gTextureCache.GetStats();
+		std::cout << "Textures - requested: " << stats.requests
+			<< " | already resident: " << stats.duplicatesAvoided
+			<< " | VRAM saved: " << stats.bytesSaved / (1024.0 * 1024.0) << "MB"
+			<< " | streaming: " << gTexturesStreaming << "\n";
+
+		return true;
+	}
+
+	// One sampler for every texture, created once so no descriptor set is rewritten while frames use it.
+	// Streamed textures arrive after it exists, so the LOD range is left open & each texture's view
+	// limits it to the levels it has
+	bool CreateTextureSampler()
+	{
 		VkSamplerCreateInfo samplerInfo = {};
 		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 		samplerInfo.flags = 0;
@@ -1121,7 +1800,7 @@ private:
 		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 		samplerInfo.mipLodBias = 0;
 		samplerInfo.minLod = 0;
-		samplerInfo.maxLod = maxLod;
+		samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 		samplerInfo.anisotropyEnable = VK_FALSE;
 		samplerInfo.maxAnisotropy = 1.0;
 		samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
@@ -1130,177 +1809,369 @@ private:
 		samplerInfo.unnormalizedCoordinates = VK_FALSE;
 		samplerInfo.pNext = nullptr;
 
-		vr = vkCreateSampler(device, &samplerInfo, nullptr, &gTextureSampler);
-		if (vr != VkResult::VK_SUCCESS)
+		if (vkCreateSampler(device, &samplerInfo, nullptr, &gTextureSampler) != VkResult::VK_SUCCESS)
 		{
-			std::cerr << "ERROR: LoadTextures - Failed to create sampler!\n";
+			std::cerr << "ERROR: CreateTextureSampler - Failed to create sampler!\n";
 			return false;
 		}
 
-		// Then create image views for diffuse textures
-		VkImageViewCreateInfo viewInfo = {};
-		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		viewInfo.flags = 0;
-		viewInfo.components = {
-			VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G,
-			VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A
-		};
-		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		viewInfo.subresourceRange.baseMipLevel = 0;
-		viewInfo.subresourceRange.baseArrayLayer = 0;
-		viewInfo.pNext = nullptr;
-
-		for (diffuseIndex = specularIndex = normalIndex = 0; 
-			diffuseIndex < gDiffuseTextures.size() 
-				|| specularIndex < gSpecularTextures.size() 
-				|| normalIndex < gNormalTextures.size(); 
-			diffuseIndex++, specularIndex++, normalIndex++)
-		{
-			// Textures are not directly accessed by the shaders and are abstracted
-			// by image views containing additional information and sub resource ranges.
-		
-			// Create diffuse image view
-			if (diffuseIndex < gDiffuseTextures.size()) 
+		// Resident textures point at it now, the cache writes it into every texture loaded later
+		gTextureCache.WriteDescriptors(gTextureSampler);
+		return true;
+	}
+
+	// Points the material slots of textures whose upload has finished at them, then records uploads for
+	// the textures the streamer has read since the last frame. Only placeholder references are released,
+	// images replaced by finer levels are retired by the cache
+	void StreamTextures()
+	{
+		TRACE_SCOPE("StreamTextures");
+		GW::MATH::GMATRIXF cameraWorld;
+		GW::MATH::GMatrix::InverseF(gMatrices.view, cameraWorld);
+		gTextureStreamer.SetViewer(cameraWorld.row4.x, cameraWorld.row4.y, cameraWorld.row4.z);
+		PlaceUploadedTextures();
+
+		// While this frame's transfer is still running everything stays queued in the streamer
+		std::vector<TextureStreamer::DECODED> taken;
+		if (gTextureCache.CanTransfer())
+			gTextureStreamer.TakeReady(taken, TEXTURE_STREAM_UPLOADS_PER_FRAME);
+		if (taken.empty())
+			return;
+
+		// Finer levels for resident textures go straight to the cache
+		std::vector<TextureStreamer::DECODED> decoded;
+		std::vector<std::string> refinePaths;
+		std::vector<ktxTexture*> refineTextures;
+		for (const TextureStreamer::DECODED& texture : taken)
+		{
+			if (texture.id != TEXTURE_STREAM_REFINE)
+				decoded.push_back(texture);
+			else
 			{
-				viewInfo.image = gDiffuseTextures[diffuseIndex].image;
-				viewInfo.format = gDiffuseTextures[diffuseIndex].imageFormat;
-				viewInfo.viewType = gDiffuseTextures[diffuseIndex].viewType;
-				viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-				viewInfo.subresourceRange.layerCount = gDiffuseTextures[diffuseIndex].layerCount;
-				viewInfo.subresourceRange.levelCount = gDiffuseTextures[diffuseIndex].levelCount;
-				viewInfo.subresourceRange.baseMipLevel = 0;
-				viewInfo.subresourceRange.baseArrayLayer = 0;
-				viewInfo.pNext = nullptr;
-				vr = vkCreateImageView(device, &viewInfo, nullptr,
-					&(gDiffuseTextureViews[diffuseIndex]));
-				if (vr != VkResult::VK_SUCCESS)
-				{
-					std::cerr << "ERROR: LoadTextures - Failed to create Image view (" << diffuseIndex << ")\n";
-					return false;
-				}
+				refinePaths.push_back(texture.path);
+				refineTextures.push_back(texture.kTexture);
+			}
+		}
+		if (!refinePaths.empty())
+			gTextureCache.RefineDecoded(refinePaths, refineTextures);
+		if (decoded.empty())
+			return;
 
-				VkWriteDescriptorSet write_descriptorset = {};
-				write_descriptorset.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				write_descriptorset.descriptorCount = 1;
-				write_descriptorset.dstArrayElement = 0;
-				write_descriptorset.dstBinding = 0;
-				write_descriptorset.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-				write_descriptorset.dstSet = gDiffuseTextureDescriptorSets[diffuseIndex];
-				VkDescriptorImageInfo diinfo = {
-					gTextureSampler,
-					gDiffuseTextureViews[diffuseIndex],
-					gDiffuseTextures[diffuseIndex].imageLayout
-				};
-				write_descriptorset.pImageInfo = &diinfo;
-				vkUpdateDescriptorSets(device, 1, &write_descriptorset, 0, nullptr);
+		// New textures load only the levels their largest slot was last measured to need
+		std::vector<std::string> paths;
+		std::vector<ktxTexture*> kTextures;
+		std::vector<float> screenSizes;
+		for (const TextureStreamer::DECODED& texture : decoded)
+		{
+			uint64_t fileBytes = LoadReport::FileSize(KtxTranscode::PreferredPath(texture.path));
+			gLoadReport.AddPhase(LOAD_PHASE_TEXTURE_DECODE, texture.milliseconds, fileBytes, 0, 1);
+			gLoadReport.AddTexture(texture.path, texture.milliseconds, fileBytes);
+
+			float screenSize = 0.0f;
+			for (const TEXTURE_SLOT& slot : gStreamedTextureSlots[texture.id])
+				screenSize = std::max(screenSize, gTextureSlotSizes[slot.map][slot.slot]);
+			paths.push_back(texture.path);
+			kTextures.push_back(texture.kTexture);
+			screenSizes.push_back(screenSize);
+		}
+		std::vector<unsigned int> handles;
+		gTextureCache.AcquireDecoded(paths, kTextures, handles, &screenSizes);
+
+		unsigned int failed = 0;
+		for (unsigned int i = 0; i < decoded.size(); i++)
+		{
+			if (handles[i] != TEXTURE_CACHE_INVALID)
+				gUploadingTextures.push_back({ decoded[i].id, handles[i], paths[i] });
+			else
+			{
+				std::cerr << "ERROR: StreamTextures - failed to load " << paths[i] << ", keeping the default map\n";
+				failed++;
 			}
+		}
+		TexturesArrived(failed);
+	}
 
-			// Create specular image view
-			if (specularIndex < gSpecularTextures.size())
+	// Swaps in every streamed texture whose upload has finished, failed ones leave the default map
+	void PlaceUploadedTextures()
+	{
+		std::vector<unsigned int>* slotHandles[TEXTURE_MAP_COUNT] = {
+			&gDiffuseTextureHandles, &gSpecularTextureHandles, &gNormalTextureHandles };
+		unsigned int placed = 0;
+		for (unsigned int i = 0; i < gUploadingTextures.size();)
+		{
+			UPLOADING_TEXTURE texture = gUploadingTextures[i];
+			if (gTextureCache.IsUploading(texture.handle))
 			{
-				viewInfo.image = gSpecularTextures[specularIndex].image;
-				viewInfo.format = gSpecularTextures[specularIndex].imageFormat;
-				viewInfo.viewType = gSpecularTextures[specularIndex].viewType;
-				viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-				viewInfo.subresourceRange.layerCount = gSpecularTextures[specularIndex].layerCount;
-				viewInfo.subresourceRange.levelCount = gSpecularTextures[specularIndex].levelCount;
-				viewInfo.subresourceRange.baseMipLevel = 0;
-				viewInfo.subresourceRange.baseArrayLayer = 0;
-				viewInfo.pNext = nullptr;
-				VkResult vr = vkCreateImageView(device, &viewInfo, nullptr,
-					&(gSpecularTextureViews[specularIndex]));
-				if (vr != VkResult::VK_SUCCESS)
-				{
-					std::cerr << "ERROR: LoadTextures - Failed to create Image view (" << specularIndex << ")\n";
-					return false;
-				}
+				i++;
+				continue;
+			}
+			gUploadingTextures[i] = gUploadingTextures.back();
+			gUploadingTextures.pop_back();
+			placed++;
+			if (gTextureCache.IsFailed(texture.handle))
+			{
+				std::cerr << "ERROR: StreamTextures - failed to upload " << texture.path << ", keeping the default map\n";
+				gTextureCache.Release(texture.handle);
+				continue;
+			}
 
-				VkWriteDescriptorSet write_descriptorset = {};
-				write_descriptorset.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				write_descriptorset.descriptorCount = 1;
-				write_descriptorset.dstArrayElement = 0;
-				write_descriptorset.dstBinding = 0;
-				write_descriptorset.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-				write_descriptorset.dstSet = gSpecularTextureDescriptorSets[specularIndex];
-				VkDescriptorImageInfo diinfo = {
-					gTextureSampler,
-					gSpecularTextureViews[specularIndex],
-					gSpecularTextures[specularIndex].imageLayout
-				};
-				write_descriptorset.pImageInfo = &diinfo;
-				vkUpdateDescriptorSets(device, 1, &write_descriptorset, 0, nullptr);
+			// The acquire holds one reference, every further slot takes its own
+			const std::vector<TEXTURE_SLOT>& slots = gStreamedTextureSlots[texture.id];
+			for (unsigned int j = 0; j < slots.size(); j++)
+			{
+				unsigned int& handle = (*slotHandles[slots[j].map])[slots[j].slot];
+				gTextureCache.Release(handle);
+				if (j > 0)
+					gTextureCache.Retain(texture.handle);
+				handle = texture.handle;
 			}
+		}
 
-			// Create normal image view
-			if (normalIndex < gNormalTextures.size())
+		// New textures & finished refines both change descriptor sets
+		if (placed > 0 || gTextureDescriptorVersion != gTextureCache.GetDescriptorVersion())
+			ResolveTextureSets();
+		TexturesArrived(placed);
+	}
+
+	// count streamed textures are in (or have failed), once the last one is the level's load is done
+	void TexturesArrived(unsigned int count)
+	{
+		if (count == 0 || gTexturesStreaming == 0)
+			return;
+		gTexturesStreaming -= std::min(gTexturesStreaming, count);
+		if (gTexturesStreaming == 0)
+		{
+			PackTextureArrays();
+			const TextureCache::STATS& stats = gTextureCache.GetStats();
+			std::cout << "Textures - loaded: " << stats.loaded << " in "
+				<< std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - gTextureStreamStart).count()
+				<< "ms | upload: " << stats.uploadMilliseconds << "ms"
+				<< " | mips generated: " << stats.levelsGenerated
+				<< " | resident: " << gTextureCache.GetResidentCount() << "\n";
+			FinishLoadReport();
+		}
+	}
+
+	// Once the level's textures are all in: adds the cache's share of the load, prints & writes the report
+	void FinishLoadReport()
+	{
+		if (!gLoadReport.IsStarted() || gLoadReport.IsFinished())
+			return;
+		const TextureCache::STATS& stats = gTextureCache.GetStats();
+		gLoadReport.AddPhase(LOAD_PHASE_TEXTURE_DECODE, stats.decodeMilliseconds, 0, 0, 0); // the default maps
+		gLoadReport.AddPhase(LOAD_PHASE_TEXTURE_UPLOAD, stats.uploadMilliseconds, 0, stats.bytesLoaded, stats.loaded);
+		gLoadReport.AddPhase(LOAD_PHASE_DESCRIPTORS, stats.descriptorMilliseconds, 0, 0, stats.descriptorSets);
+		gLoadReport.Finish(!gObjects.empty());
+		gLoadReport.Print(std::cout);
+		if (!gLoadReport.Write(LOAD_REPORT_PATH))
+			std::cerr << "ERROR: Unable to write the load report to " << LOAD_REPORT_PATH << "\n";
+	}
+
+	// Once a level's textures are all in, small ones sharing a format & size become layers of shared arrays
+	void PackTextureArrays()
+	{
+		// The textures switch to their arrays once the copies are done, StreamTextures resolves the new sets
+		unsigned int packed = gTextureCache.PackArrays();
+		std::cout << "Texture arrays - packing: " << packed << " textures\n";
+	}
+
+	// Fixed, or a share of what the driver says this process may still use (textures included)
+	void UpdateTextureBudget()
+	{
+		if (TEXTURE_VRAM_BUDGET_MB > 0)
+		{
+			gTextureCache.SetBudget((VkDeviceSize)TEXTURE_VRAM_BUDGET_MB * 1024 * 1024);
+			return;
+		}
+
+		VkDeviceSize heapBudget, heapUsage;
+		if (!VkUtils::QueryDeviceLocalBudget(physicalDevice, gMemoryBudgetSupported, heapBudget, heapUsage))
+		{
+			gTextureCache.SetBudget(heapBudget / 2);
+			return;
+		}
+		VkDeviceSize textureUsage = gTextureCache.GetResidentBytes();
+		VkDeviceSize otherUsage = heapUsage - std::min(heapUsage, textureUsage);
+		VkDeviceSize share = (VkDeviceSize)(heapBudget * TEXTURE_VRAM_BUDGET_SHARE);
+		gTextureCache.SetBudget(share > otherUsage ? share - otherUsage : 0);
+	}
+
+	// Projects every visible instance's bounds & reports the size to the textures its meshes use
+	void MeasureTextureSlots()
+	{
+		for (unsigned int map = 0; map < TEXTURE_MAP_COUNT; map++)
+			std::fill(gTextureSlotSizes[map].begin(), gTextureSlotSizes[map].end(), 0.0f);
+
+		unsigned int width, height;
+		GetClientSize(width, height);
+		float pixelsPerUnit = height / (2.0f * tanf(gCamera.FOV * 0.5f)); // at a distance of one
+		GW::MATH::GMATRIXF cameraWorld;
+		GW::MATH::GMatrix::InverseF(gMatrices.view, cameraWorld);
+
+		const std::vector<unsigned int>* slotHandles[TEXTURE_MAP_COUNT] = {
+			&gDiffuseTextureHandles, &gSpecularTextureHandles, &gNormalTextureHandles };
+		for (int i = 0; i < gObjects.size() && i < gVisibleInstances.size(); i++)
+		{
+			for (unsigned int j : gVisibleInstances[i])
 			{
-				viewInfo.image = gNormalTextures[normalIndex].image;
-				viewInfo.format = gNormalTextures[normalIndex].imageFormat;
-				viewInfo.viewType = gNormalTextures[normalIndex].viewType;
-				viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-				viewInfo.subresourceRange.layerCount = gNormalTextures[normalIndex].layerCount;
-				viewInfo.subresourceRange.levelCount = gNormalTextures[normalIndex].levelCount;
-				viewInfo.subresourceRange.baseMipLevel = 0;
-				viewInfo.subresourceRange.baseArrayLayer = 0;
-				viewInfo.pNext = nullptr;
-				VkResult vr = vkCreateImageView(device, &viewInfo, nullptr,
-					&(gNormalTextureViews[normalIndex]));
-				if (vr != VkResult::VK_SUCCESS)
+				const graphics::AABB& bounds = gObjects[i].instanceBounds[j];
+				float x = (bounds.max.x - bounds.min.x) * 0.5f, y = (bounds.max.y - bounds.min.y) * 0.5f,
+					z = (bounds.max.z - bounds.min.z) * 0.5f;
+				float radius = sqrtf(x * x + y * y + z * z);
+				x = bounds.min.x + x - cameraWorld.row4.x;
+				y = bounds.min.y + y - cameraWorld.row4.y;
+				z = bounds.min.z + z - cameraWorld.row4.z;
+				float distance = std::max(sqrtf(x * x + y * y + z * z), gCamera.nearPlane);
+				float pixels = 2.0f * radius * pixelsPerUnit / distance;
+
+				for (const DrawSort::DRAW_STATE& state : gMeshDrawStates[i])
 				{
-					std::cerr << "ERROR: LoadTextures - Failed to create Image view (" << normalIndex<< ")\n";
-					return false;
+					const unsigned int slots[TEXTURE_MAP_COUNT] = { state.diffuseSet, state.specularSet, state.normalSet };
+					for (unsigned int map = 0; map < TEXTURE_MAP_COUNT; map++)
+					{
+						if (slots[map] >= gTextureSlotSizes[map].size())
+							continue;
+						float& slotSize = gTextureSlotSizes[map][slots[map]];
+						slotSize = std::max(slotSize, pixels);
+						gTextureCache.RequestSize((*slotHandles[map])[slots[map]], pixels);
+					}
 				}
-
-				VkWriteDescriptorSet write_descriptorset = {};
-				write_descriptorset.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				write_descriptorset.descriptorCount = 1;
-				write_descriptorset.dstArrayElement = 0;
-				write_descriptorset.dstBinding = 0;
-				write_descriptorset.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-				write_descriptorset.dstSet = gNormalTextureDescriptorSets[normalIndex];
-				VkDescriptorImageInfo diinfo = {
-					gTextureSampler,
-					gNormalTextureViews[normalIndex],
-					gNormalTextures[normalIndex].imageLayout
-				};
-				write_descriptorset.pImageInfo = &diinfo;
-				vkUpdateDescriptorSets(device, 1, &write_descriptorset, 0, nullptr);
 			}
 		}
+	}
 
-		// After loading all textures you don't need these anymore
-		ktxTexture_Destroy(kTexture);
-		ktxVulkanDeviceInfo_Destruct(&vlkDeviceInfo);
+	// Every interval: measure, refresh the budget, then drop or request levels
+	void UpdateTextureResidency()
+	{
+		TRACE_SCOPE("UpdateTextureResidency");
+		if (!gTextureResidencyDue && gFrameCount % TEXTURE_RESIDENCY_INTERVAL != 0)
+			return;
+		gTextureResidencyDue = false;
+
+		MeasureTextureSlots();
+		UpdateTextureBudget();
+		std::vector<std::string> refinePaths;
+		gTextureCache.UpdateResidency(refinePaths);
+		for (const std::string& path : refinePaths)
+			gTextureStreamer.Add({ TEXTURE_STREAM_REFINE, path, {} });
+		// Smaller images are swapped in once their copies are done, StreamTextures resolves the new sets
+	}
 
-		return true;
+	void ResolveTextureSets()
+	{
+		auto resolveSets = [&](const std::vector<unsigned int>& handles, std::vector<VkDescriptorSet>& sets)
+		{
+			sets.resize(handles.size());
+			for (int i = 0; i < handles.size(); i++)
+				sets[i] = gTextureCache.GetDescriptorSet(handles[i]);
+		};
+		resolveSets(gDiffuseTextureHandles, gDiffuseTextureDescriptorSets);
+		resolveSets(gSpecularTextureHandles, gSpecularTextureDescriptorSets);
+		resolveSets(gNormalTextureHandles, gNormalTextureDescriptorSets);
+		const std::vector<unsigned int>* slotHandles[TEXTURE_MAP_COUNT] = {
+			&gDiffuseTextureHandles, &gSpecularTextureHandles, &gNormalTextureHandles };
+		for (unsigned int map = 0; map < TEXTURE_MAP_COUNT; map++)
+		{
+			gTextureLayers[map].resize(slotHandles[map]->size());
+			for (unsigned int i = 0; i < slotHandles[map]->size(); i++)
+				gTextureLayers[map][i] = gTextureCache.GetLayer((*slotHandles[map])[i]);
+		}
+		gTextureDescriptorVersion = gTextureCache.GetDescriptorVersion();
+		UpdateTextureMemory();
 	}
 
-	KTX_error_code CreateTexture(const char* fileName, ktxTexture** kTexture, 
-		ktxVulkanDeviceInfo vlkDeviceInfo,ktxVulkanTexture* destTexture, unsigned& index, unsigned& maxLod)
+	// Resident bytes behind each map's slots (a texture shared between maps counts for the first) &
+	// the descriptor pools, which only change along with them
+	void UpdateTextureMemory()
 	{
-		KTX_error_code ktxResult = ktxTexture_CreateFromNamedFile(fileName, KTX_TEXTURE_CREATE_NO_FLAGS, kTexture);
-		if (ktxResult != KTX_error_code::KTX_SUCCESS)
-			return ktxResult;
+		const std::vector<unsigned int>* slotHandles[TEXTURE_MAP_COUNT] = {
+			&gDiffuseTextureHandles, &gSpecularTextureHandles, &gNormalTextureHandles };
+		const MEMORY_CATEGORY categories[TEXTURE_MAP_COUNT] = {
+			MEMORY_TEXTURE_DIFFUSE, MEMORY_TEXTURE_SPECULAR, MEMORY_TEXTURE_NORMAL };
+		std::unordered_set<unsigned int> counted;
+		for (unsigned int map = 0; map < TEXTURE_MAP_COUNT; map++)
+		{
+			uint64_t bytes = 0;
+			for (unsigned int handle : *slotHandles[map])
+				if (counted.insert(handle).second)
+					bytes += gTextureCache.GetBytes(handle);
+			gMemoryStats.Set(categories[map], bytes);
+		}
 
-		// This gets mad if you don't encode/save the .ktx file in a format Vulkan likes
-		ktxResult = ktxTexture_VkUploadEx(*kTexture, &vlkDeviceInfo, destTexture,
-			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_SAMPLED_BIT,
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-		if (ktxResult != KTX_error_code::KTX_SUCCESS)
-			return ktxResult;
+		uint64_t descriptors = (uint64_t)gTextureCache.GetPoolCount() * TEXTURE_CACHE_POOL_SIZE + gMatrixBuffers.size();
+		gMemoryStats.Set(MEMORY_DESCRIPTOR_POOLS, descriptors * MEMORY_DESCRIPTOR_BYTES);
+	}
 
-		if (gDiffuseTextures[index].levelCount > maxLod)
-			maxLod = gDiffuseTextures[index].levelCount;
+	// Allocation size, which is what create_buffer allocates. 0 for a buffer that was never created
+	// (a failed create_buffer, or a model without that stream)
+	VkDeviceSize BufferBytes(VkBuffer buffer)
+	{
+		if (buffer == VK_NULL_HANDLE)
+			return 0;
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(device, buffer, &requirements);
+		return requirements.size;
+	}
+
+	static uint64_t GeometryBytes(const std::vector<graphics::MODEL>& objects)
+	{
+		uint64_t bytes = 0;
+		for (const graphics::MODEL& obj : objects)
+		{
+			bytes += obj.vertices.size() * sizeof(graphics::VERTEX) + obj.indices.size() * sizeof(unsigned int)
+				+ obj.worldMatrices.size() * sizeof(GW::MATH::GMATRIXF) + obj.instanceBounds.size() * sizeof(graphics::AABB)
+				+ obj.materials.size() * sizeof(graphics::MATERIAL) + obj.batches.size() * sizeof(graphics::BATCH) + obj.meshes.size() * sizeof(graphics::MESH);
+			for (const std::vector<graphics::BATCH>& lod : obj.lods)
+				bytes += lod.size() * sizeof(graphics::BATCH);
+		}
+		return bytes;
+	}
+
+	// The view is the inverse of the camera's world matrix, what UpdateCamera left this frame
+	void RecordCameraFrame()
+	{
+		if (!gRecordingCamera)
+			return;
+		auto now = std::chrono::high_resolution_clock::now();
+		CameraPath::FRAME frame;
+		GW::MATH::GMatrix::InverseF(gMatrices.view, frame.camera);
+		frame.lightDirection = gLight.Direction;
+		frame.delta = std::chrono::duration<float>(now - gLastRecordedFrame).count();
+		gLastRecordedFrame = now;
+		gCameraRecording.Add(frame);
+	}
+
+	void StopCameraRecording()
+	{
+		gRecordingCamera = false;
+		if (gCameraRecording.Save(CAMERA_PATH_PATH))
+			std::cout << "Camera path written to " << CAMERA_PATH_PATH << " (" << gCameraRecording.GetFrameCount() << " frames)\n";
+	}
 
-		// Increment index to the next diffuse texture location
-		++index;
+	void LogMemoryStats()
+	{
+		if (gFrameCount % MEMORY_STATS_LOG_INTERVAL != 0)
+			return;
+		gMemoryStats.Print(std::cout);
+	}
 
-		return KTX_error_code::KTX_SUCCESS;
+	// Gives this level's texture references back to the cache, uploads not placed yet included
+	void ReleaseTextures()
+	{
+		for (std::vector<unsigned int>* handles : { &gDiffuseTextureHandles, &gSpecularTextureHandles, &gNormalTextureHandles })
+		{
+			for (unsigned int handle : *handles)
+				gTextureCache.Release(handle);
+			handles->clear();
+		}
+		for (const UPLOADING_TEXTURE& texture : gUploadingTextures)
+			gTextureCache.Release(texture.handle);
+		gUploadingTextures.clear();
 	}
 
 	void WriteModelsToShaderData()
 	{
+		TRACE_SCOPE("WriteModelsToShaderData");
 		unsigned int matrixOffset = 0;
 		unsigned int materialOffset = 0;
 		for (int i = 0; i < gObjects.size(); i++)
@@ -1322,49 +2193,480 @@ private:
 		//GvkHelper::write_to_buffer(device, gMatrixData[index], &gShaderModelData, sizeof(SHADER_MODEL_DATA));
 	}
 
-	void CleanUpLevel()
+	// Resolves every mesh's material slot & texture descriptor sets, in the same order LoadTextures creates them
+	void BuildDrawStates()
 	{
-		// wait till everything has completed
-		vkDeviceWaitIdle(device);
+		gMeshDrawStates.resize(gObjects.size());
+		std::unordered_map<unsigned long long, unsigned int> textureSetIds;
+		// Slots naming the same file are one texture, so they land in the same texture set
+		std::unordered_map<std::string, unsigned int> textureIds;
+		auto textureId = [&textureIds](const std::string& path)
+		{
+			if (path.empty())
+				return 0u; // default map
+			return textureIds.emplace(TextureCache::CanonicalPath(path), (unsigned int)textureIds.size() + 1).first->second;
+		};
+		unsigned int materialBase = 0;
+		unsigned int diffuseBase = 1; // set 0 holds the default maps
+		unsigned int specularBase = 1;
+		unsigned int normalBase = 1;
+		for (int i = 0; i < gObjects.size(); i++)
+		{
+			const graphics::MODEL& obj = gObjects[i];
 
-		for (VkBuffer& buffer : gMatrixBuffers)
-			vkDestroyBuffer(device, buffer, nullptr);
-		for (VkDeviceMemory& data : gMatrixData)
-			vkFreeMemory(device, data, nullptr);
+			// Materials without a map use the default one
+			unsigned int materialCount = obj.materials.size();
+			std::vector<unsigned int> diffuseSets(materialCount), specularSets(materialCount), normalSets(materialCount);
+			std::vector<unsigned long long> combinations(materialCount);
+			for (int m = 0; m < materialCount; m++)
+			{
+				diffuseSets[m] = obj.diffuseTextures[m].empty() ? 0 : diffuseBase++;
+				specularSets[m] = obj.specularTextures[m].empty() ? 0 : specularBase++;
+				normalSets[m] = obj.normalTextures[m].empty() ? 0 : normalBase++;
+				combinations[m] = ((unsigned long long)textureId(obj.diffuseTextures[m]) << 42)
+					| ((unsigned long long)textureId(obj.specularTextures[m]) << 21) | textureId(obj.normalTextures[m]);
+			}
+
+			gMeshDrawStates[i].resize(obj.meshCount);
+			for (int j = 0; j < obj.meshCount; j++)
+			{
+				DrawSort::DRAW_STATE& state = gMeshDrawStates[i][j];
+				unsigned int material = obj.meshes[j].materialIndex;
+				unsigned long long combination = 0;
+				if (material >= materialCount)
+				{
+					state = { materialBase, 0, 0, 0, 0, 0 };
+				}
+				else
+				{
+					state.materialSlot = materialBase + material;
+					state.diffuseSet = diffuseSets[material];
+					state.specularSet = specularSets[material];
+					state.normalSet = normalSets[material];
+					combination = combinations[material];
+				}
+
+				state.textureSet = textureSetIds.emplace(combination, (unsigned int)textureSetIds.size()).first->second;
 
-		// Release allocated buffers, shaders & pipeline
-		for (vkObject vkObj : vkObjects)
+				// Set 0 is the default maps, which the variant replaces with constants
+				state.variant = (state.diffuseSet != 0 ? MATERIAL_HAS_DIFFUSE : 0)
+					| (state.specularSet != 0 ? MATERIAL_HAS_SPECULAR : 0)
+					| (state.normalSet != 0 ? MATERIAL_HAS_NORMAL : 0);
+			}
+			materialBase += obj.materialInfo.materialCount;
+		}
+	}
+
+	// One draw per visible model/LOD/mesh, keyed by pipeline, texture set, then nearest instance depth
+	void BuildDrawList()
+	{
+		TRACE_SCOPE("BuildDrawList");
+		gDrawList.Clear();
+		gUnsortedBindCount = 0;
+
+		unsigned int matrixOffset = 0;
+		for (int i = 0; i < gObjects.size(); i++)
 		{
-			vkDestroyBuffer(device, vkObj.indexHandle, nullptr);
-			vkFreeMemory(device, vkObj.indexData, nullptr);
-			vkDestroyBuffer(device, vkObj.vertexHandle, nullptr);
-			vkFreeMemory(device, vkObj.vertexData, nullptr);
+			const graphics::MODEL& obj = gObjects[i];
+			const std::vector<unsigned>& visible = gVisibleInstances[i];
+			if (!visible.empty())
+				gUnsortedBindCount += 2 + 4 * obj.meshCount; // vertex/index buffers, then pipeline & 3 texture sets per mesh
+
+			unsigned int lodStart = 0;
+			for (int lod = 0; lod < gLodInstanceCounts[i].size(); lod++)
+			{
+				unsigned int lodInstances = gLodInstanceCounts[i][lod];
+				if (lodInstances == 0)
+					continue;
+
+				// Nearest instance decides where the whole group lands in the front to back order
+				float nearest = FLT_MAX;
+				for (unsigned int k = lodStart; k < lodStart + lodInstances; k++)
+				{
+					const graphics::AABB& bounds = obj.instanceBounds[visible[k]];
+					GW::MATH::GVECTORF center = Culling::TransformPoint(gMatrices.view,
+						(bounds.min.x + bounds.max.x) * 0.5f, (bounds.min.y + bounds.max.y) * 0.5f, (bounds.min.z + bounds.max.z) * 0.5f);
+					graphics::VECTOR extent = MeshLod::Subtract(bounds.max, bounds.min);
+					nearest = std::min(nearest, center.z - std::sqrt(MeshLod::Dot(extent, extent)) * 0.5f);
+				}
+				unsigned int depth = DrawSort::QuantizeDepth(nearest, gCamera.farPlane);
+
+				for (int j = 0; j < obj.meshCount; j++)
+				{
+					const graphics::BATCH& drawInfo = obj.lods[lod][j];
+					if (drawInfo.indexCount == 0)
+						continue;
+					const DrawSort::DRAW_STATE& state = gMeshDrawStates[i][j];
+					gDrawList.Add({ DrawSort::MakeKey(state.variant, state.textureSet, depth, i, lod), (unsigned)i, (unsigned)j,
+						drawInfo.indexCount, drawInfo.indexOffset, matrixOffset + lodStart, lodInstances, state.materialSlot });
+				}
+				lodStart += lodInstances;
+			}
+			matrixOffset += obj.instanceCount;
 		}
 
-		// Destroy Texture Resources
-		for (VkImageView& imageView : gDiffuseTextureViews)
-			vkDestroyImageView(device, imageView, nullptr);
-		for (VkImageView& imageView : gSpecularTextureViews)
-			vkDestroyImageView(device, imageView, nullptr);
-		for (VkImageView& imageView : gNormalTextureViews)
-			vkDestroyImageView(device, imageView, nullptr);
-		for (ktxVulkanTexture& textureData : gDiffuseTextures)
+		gDrawStats = {};
+		gDrawStats.submitted = gDrawList.GetDraws().size();
+		gDrawList.Sort();
+		gDrawList.Merge();
+	}
+
+	// Only rebinds pipelines, buffers & texture sets when they differ from the previous draw's
+	void SubmitDrawList(VkCommandBuffer commandBuffer, const VkPipeline* variantPipelines)
+	{
+		TRACE_SCOPE("SubmitDrawList");
+		VkDeviceSize offsets[] = { 0 };
+		unsigned int boundModel = gObjects.size(); // nothing bound yet
+		unsigned int boundVariant = MATERIAL_VARIANT_COUNT;
+		VkDescriptorSet boundSets[3] = { VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE };
+		for (const DrawSort::DRAW& draw : gDrawList.GetDraws())
 		{
-			vkFreeMemory(device, textureData.deviceMemory, nullptr);
-			vkDestroyImage(device, textureData.image, nullptr);
+			if (draw.model != boundModel)
+			{
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, &(vkObjects[draw.model].vertexHandle), offsets);
+				vkCmdBindIndexBuffer(commandBuffer, vkObjects[draw.model].indexHandle, 0, VkIndexType::VK_INDEX_TYPE_UINT32);
+				boundModel = draw.model;
+				gDrawStats.bufferBinds += 2;
+			}
+
+			// Diffuse, specular & normal sets live at descriptor set 1, 2 & 3
+			const DrawSort::DRAW_STATE& state = gMeshDrawStates[draw.model][draw.mesh];
+			if (state.variant != boundVariant)
+			{
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, variantPipelines[state.variant]);
+				boundVariant = state.variant;
+				++gDrawStats.pipelineBinds;
+			}
+			VkDescriptorSet sets[3] = {
+				gDiffuseTextureDescriptorSets[state.diffuseSet],
+				gSpecularTextureDescriptorSets[state.specularSet],
+				gNormalTextureDescriptorSets[state.normalSet] };
+			for (int s = 0; s < 3; s++)
+			{
+				if (sets[s] == boundSets[s])
+					continue;
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+					pipelineLayout, s + 1, 1, &sets[s], 0, nullptr);
+				boundSets[s] = sets[s];
+				++gDrawStats.descriptorBinds;
+			}
+
+			PushConstants pushConstants = { draw.materialSlot, draw.matrixOffset,
+				gTextureLayers[TEXTURE_MAP_DIFFUSE][state.diffuseSet],
+				gTextureLayers[TEXTURE_MAP_SPECULAR][state.specularSet],
+				gTextureLayers[TEXTURE_MAP_NORMAL][state.normalSet] };
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+				0, sizeof(PushConstants), &pushConstants);
+			vkCmdDrawIndexed(commandBuffer, draw.indexCount, draw.instanceCount, draw.indexOffset, 0, 0);
+			gCullingStats.trianglesDrawn += (unsigned long long)(draw.indexCount / 3) * draw.instanceCount;
+			++gDrawStats.draws;
 		}
-		for (ktxVulkanTexture& textureData : gSpecularTextures)
+
+		unsigned int bindCount = gDrawStats.pipelineBinds + gDrawStats.bufferBinds + gDrawStats.descriptorBinds;
+		gDrawStats.bindsSaved = gUnsortedBindCount > bindCount ? gUnsortedBindCount - bindCount : 0;
+	}
+
+	// Auto mode sums the screen coverage of every visible instance as a cheap overdraw estimate
+	void UpdateDepthPrepass(const GW::MATH::GMATRIXF& viewProjection)
+	{
+		if (gDepthPrepassMode != DEPTH_PREPASS_AUTO)
 		{
-			vkFreeMemory(device, textureData.deviceMemory, nullptr);
-			vkDestroyImage(device, textureData.image, nullptr);
+			gDepthPrepassActive = gDepthPrepassMode == DEPTH_PREPASS_ON;
+			return;
 		}
-		for (ktxVulkanTexture& textureData : gNormalTextures)
+
+		gEstimatedOverdraw = 0.0f;
+		for (int i = 0; i < gObjects.size(); i++)
+			for (unsigned int j : gVisibleInstances[i])
+				gEstimatedOverdraw += Culling::ProjectedArea(gObjects[i].instanceBounds[j], viewProjection);
+
+		// Separate on/off thresholds so the pre-pass does not flicker on & off around one value
+		if (gEstimatedOverdraw > DEPTH_PREPASS_ENABLE_OVERDRAW)
+			gDepthPrepassActive = true;
+		else if (gEstimatedOverdraw < DEPTH_PREPASS_DISABLE_OVERDRAW)
+			gDepthPrepassActive = false;
+	}
+
+	// Same draws as the main pass, but positions only and no texture binds
+	void SubmitDepthPrepass(VkCommandBuffer commandBuffer)
+	{
+		VkDeviceSize offsets[] = { 0 };
+		unsigned int boundModel = gObjects.size(); // nothing bound yet
+		for (const DrawSort::DRAW& draw : gDrawList.GetDraws())
 		{
-			vkFreeMemory(device, textureData.deviceMemory, nullptr);
-			vkDestroyImage(device, textureData.image, nullptr);
+			if (draw.model != boundModel)
+			{
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, &(vkObjects[draw.model].positionHandle), offsets);
+				vkCmdBindIndexBuffer(commandBuffer, vkObjects[draw.model].indexHandle, 0, VkIndexType::VK_INDEX_TYPE_UINT32);
+				boundModel = draw.model;
+			}
+
+			PushConstants pushConstants = { draw.materialSlot, draw.matrixOffset };
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+				0, sizeof(PushConstants), &pushConstants);
+			vkCmdDrawIndexed(commandBuffer, draw.indexCount, draw.instanceCount, draw.indexOffset, 0, 0);
 		}
+	}
 
-		vkDestroySampler(device, gTextureSampler, nullptr);
+	// Everything starts out visible, phase one then carries it over frame to frame
+	void ResetCullingState()
+	{
+		gVisibleInstances.resize(gObjects.size());
+		gPhaseTwoInstances.resize(gObjects.size());
+		gInstanceVisibility.resize(gObjects.size());
+		gLodInstanceCounts.resize(gObjects.size());
+		for (int i = 0; i < gObjects.size(); i++)
+		{
+			gVisibleInstances[i].clear();
+			gLodInstanceCounts[i].clear();
+			gPhaseTwoInstances[i].clear();
+			gInstanceVisibility[i].assign(gObjects[i].instanceCount, true);
+		}
+		gHiZ.Invalidate();
+	}
+
+	// Packs every model's visible world matrices at the start of its matrix range
+	void WriteVisibleMatrices(VkDeviceMemory matrixData)
+	{
+		unsigned int matrixOffset = 0;
+		for (int i = 0; i < gObjects.size(); i++)
+		{
+			for (int j = 0; j < gVisibleInstances[i].size(); j++)
+				gShaderModelData.matrices[matrixOffset + j] = gObjects[i].worldMatrices[gVisibleInstances[i][j]];
+			matrixOffset += gObjects[i].instanceCount;
+		}
+		GvkHelper::write_to_buffer(device, matrixData, &gShaderModelData, sizeof(SHADER_MODEL_DATA));
+	}
+
+	void CullInstances(const GW::MATH::GMATRIXF& viewProjection)
+	{
+		TRACE_SCOPE("CullInstances");
+		gCullingStats = {};
+		Culling::ExtractFrustum(viewProjection, gFrustum);
+		if (gOcclusionMode == OCCLUSION_SOFTWARE)
+		{
+			CullInstancesSoftware(viewProjection);
+			return;
+		}
+		bool runOcclusion = gOcclusionMode == OCCLUSION_HIZ && gHiZ.IsValid();
+
+		// Frustum test, survivors are split into last frame's visible set (phase one) and the rest
+		for (int i = 0; i < gObjects.size(); i++)
+		{
+			const graphics::MODEL& obj = gObjects[i];
+			gVisibleInstances[i].clear();
+			gPhaseTwoInstances[i].clear();
+			for (unsigned int j = 0; j < obj.instanceCount; j++)
+			{
+				++gCullingStats.totalInstances;
+				if (!Culling::IsAABBInFrustum(gFrustum, obj.instanceBounds[j]))
+				{
+					++gCullingStats.frustumRejected;
+					gInstanceVisibility[i][j] = false;
+				}
+				else if (!runOcclusion || gInstanceVisibility[i][j])
+					gVisibleInstances[i].push_back(j);
+				else
+					gPhaseTwoInstances[i].push_back(j);
+			}
+			gCullingStats.phaseOneDrawn += gVisibleInstances[i].size();
+		}
+
+		if (!runOcclusion)
+			return;
+		if (!gHiZ.HasPyramid())
+		{
+			// No pyramid has come back yet, draw everything that passed the frustum test
+			for (int i = 0; i < gObjects.size(); i++)
+				for (unsigned int j : gPhaseTwoInstances[i])
+					gVisibleInstances[i].push_back(j);
+			return;
+		}
+
+		// Phase two: test everything against the newest finished pyramid (a ring of frames old), with
+		// the view it was rendered from. Newly visible instances join this frame. Whatever that view did
+		// not fully see counts as visible, the camera may have turned toward it since
+		const Culling::DepthPyramid& pyramid = gHiZ.GetPyramid();
+		const GW::MATH::GMATRIXF& pyramidViewProjection = gHiZ.GetPyramidViewProjection();
+		for (int i = 0; i < gObjects.size(); i++)
+		{
+			const graphics::MODEL& obj = gObjects[i];
+
+			// Phase one instances are drawn regardless, the result only feeds next frame
+			for (unsigned int j : gVisibleInstances[i])
+				gInstanceVisibility[i][j] = !pyramid.IsOccluded(obj.instanceBounds[j], pyramidViewProjection, true);
+
+			for (unsigned int j : gPhaseTwoInstances[i])
+			{
+				bool visible = !pyramid.IsOccluded(obj.instanceBounds[j], pyramidViewProjection, true);
+				gInstanceVisibility[i][j] = visible;
+				if (visible)
+				{
+					gVisibleInstances[i].push_back(j);
+					++gCullingStats.phaseTwoDrawn;
+				}
+				else
+					++gCullingStats.occlusionRejected;
+			}
+		}
+	}
+
+	// Draws this frame's visible instances into the HiZ depth target & submits the pyramid build, which
+	// CullInstances tests against once the frame's ring slot comes around again
+	void BuildOcclusionPyramid(const GW::MATH::GMATRIXF& viewProjection, VkDescriptorSet matrixSet)
+	{
+		if (gOcclusionMode != OCCLUSION_HIZ || !gHiZ.IsValid())
+			return;
+
+		VkCommandBuffer occlusionCommands = gHiZ.BeginOcclusionPass(viewProjection);
+		if (occlusionCommands == nullptr)
+			return;
+		gProfiler.BeginGpu(occlusionCommands, "HiZ occlusion depth");
+		RecordOcclusionDraws(occlusionCommands, matrixSet);
+		gProfiler.EndGpu(occlusionCommands);
+		if (!gHiZ.EndOcclusionPass(occlusionCommands))
+			std::cerr << "ERROR: Unable to submit the HiZ occlusion pass!\n";
+	}
+
+	// Occluders are rasterized on the CPU for the current view, so every instance is tested in a single pass
+	void CullInstancesSoftware(const GW::MATH::GMATRIXF& viewProjection)
+	{
+		gSoftwareOcclusion.Render(gObjects, viewProjection, gFrustum);
+
+		for (int i = 0; i < gObjects.size(); i++)
+		{
+			const graphics::MODEL& obj = gObjects[i];
+			gVisibleInstances[i].clear();
+			gPhaseTwoInstances[i].clear();
+			for (unsigned int j = 0; j < obj.instanceCount; j++)
+			{
+				++gCullingStats.totalInstances;
+				if (!Culling::IsAABBInFrustum(gFrustum, obj.instanceBounds[j]))
+					++gCullingStats.frustumRejected;
+				else if (gSoftwareOcclusion.IsOccluded(obj.instanceBounds[j], viewProjection))
+					++gCullingStats.occlusionRejected;
+				else
+					gVisibleInstances[i].push_back(j);
+			}
+			gCullingStats.phaseOneDrawn += gVisibleInstances[i].size();
+		}
+	}
+
+	// Sorts each model's visible instances by LOD so every LOD draws one contiguous matrix range
+	void AssignLods()
+	{
+		std::vector<unsigned> instanceLods;
+		std::vector<unsigned> sorted;
+		for (int i = 0; i < gObjects.size(); i++)
+		{
+			const graphics::MODEL& obj = gObjects[i];
+			std::vector<unsigned>& visible = gVisibleInstances[i];
+			unsigned int lodCount = gLodEnabled ? std::max((unsigned int)obj.lods.size(), 1u) : 1;
+			gLodInstanceCounts[i].assign(lodCount, 0);
+			if (lodCount == 1)
+			{
+				gLodInstanceCounts[i][0] = visible.size();
+				continue;
+			}
+
+			instanceLods.resize(visible.size());
+			for (int j = 0; j < visible.size(); j++)
+			{
+				instanceLods[j] = MeshLod::SelectLod(obj.instanceBounds[visible[j]], gMatrices.view, gMatrices.projection, lodCount);
+				++gLodInstanceCounts[i][instanceLods[j]];
+			}
+
+			// Counting sort, keeps the culling order within each LOD
+			std::vector<unsigned> lodStarts(lodCount, 0);
+			for (unsigned int lod = 1; lod < lodCount; lod++)
+				lodStarts[lod] = lodStarts[lod - 1] + gLodInstanceCounts[i][lod - 1];
+			sorted.resize(visible.size());
+			for (int j = 0; j < visible.size(); j++)
+				sorted[lodStarts[instanceLods[j]]++] = visible[j];
+			visible.swap(sorted);
+		}
+	}
+
+	void RecordOcclusionDraws(VkCommandBuffer commandBuffer, VkDescriptorSet matrixSet)
+	{
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+			0, 1, &matrixSet, 0, nullptr);
+
+		VkDeviceSize offsets[] = { 0 };
+		PushConstants pushConstants = { 0, 0 };
+		for (int i = 0; i < gObjects.size(); i++)
+		{
+			const graphics::MODEL& obj = gObjects[i];
+			unsigned int visibleCount = gVisibleInstances[i].size();
+			if (visibleCount > 0)
+			{
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, &(vkObjects[i].vertexHandle), offsets);
+				vkCmdBindIndexBuffer(commandBuffer, vkObjects[i].indexHandle, 0, VkIndexType::VK_INDEX_TYPE_UINT32);
+				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+					0, sizeof(PushConstants), &pushConstants);
+				for (int j = 0; j < obj.meshCount; j++)
+					vkCmdDrawIndexed(commandBuffer, obj.meshes[j].drawInfo.indexCount, visibleCount,
+						obj.meshes[j].drawInfo.indexOffset, 0, 0);
+			}
+			pushConstants.matrix_offset += obj.instanceCount;
+		}
+	}
+
+	void LogCullingStats()
+	{
+		if (gFrameCount % CULLING_STATS_LOG_INTERVAL != 0)
+			return;
+
+		std::cout << "Culling - instances: " << gCullingStats.totalInstances
+			<< " | frustum rejected: " << gCullingStats.frustumRejected
+			<< " | occlusion rejected: " << gCullingStats.occlusionRejected
+			<< " | phase one drawn: " << gCullingStats.phaseOneDrawn
+			<< " | phase two drawn: " << gCullingStats.phaseTwoDrawn
+			<< " | triangles drawn: " << gCullingStats.trianglesDrawn;
+		if (gOcclusionMode == OCCLUSION_SOFTWARE)
+			std::cout << " | occluders: " << gSoftwareOcclusion.GetStats().occludersRendered
+				<< " | occluder triangles: " << gSoftwareOcclusion.GetStats().trianglesRendered;
+		std::cout << "\n";
+
+		std::cout << "Draws - submitted: " << gDrawStats.submitted
+			<< " | after merge: " << gDrawStats.draws
+			<< " | pipeline binds: " << gDrawStats.pipelineBinds
+			<< " | descriptor binds: " << gDrawStats.descriptorBinds
+			<< " | buffer binds: " << gDrawStats.bufferBinds
+			<< " | binds saved: " << gDrawStats.bindsSaved
+			<< " | depth pre-pass: " << (gDepthPrepassActive ? "on" : "off")
+			<< " (" << DEPTH_PREPASS_MODE_NAMES[gDepthPrepassMode] << ", overdraw " << gEstimatedOverdraw << ")\n";
+
+		unsigned int partialCount, refiningCount;
+		gTextureCache.GetResidencyCounts(partialCount, refiningCount);
+		std::cout << "Texture residency - " << gTextureCache.GetResidentBytes() / (1024.0 * 1024.0) << "MB of "
+			<< gTextureCache.GetBudget() / (1024.0 * 1024.0) << "MB budget"
+			<< " | partially resident: " << partialCount
+			<< " | refining: " << refiningCount
+			<< " | refined: " << gTextureCache.GetStats().levelsRefined
+			<< " | evicted: " << gTextureCache.GetStats().levelsEvicted << "\n";
+	}
+
+	void CleanUpLevel()
+	{
+		// wait till everything has completed. Shutdown only: level swaps & shader reloads retire through
+		// gDeletionQueue instead, which is safe to empty once the device is idle
+		vkDeviceWaitIdle(device);
+		gDeletionQueue.FlushAll();
+
+		for (VkBuffer& buffer : gMatrixBuffers)
+		{
+			gMemoryStats.Remove(MEMORY_STORAGE_BUFFERS, BufferBytes(buffer));
+			vkDestroyBuffer(device, buffer, nullptr);
+		}
+		for (VkDeviceMemory& data : gMatrixData)
+			vkFreeMemory(device, data, nullptr);
+
+		// Release allocated buffers, a level still loading included
+		if (gLevelLoadThread.joinable())
+			gLevelLoadThread.join();
+		DestroyModelBuffers(vkObjects);
+		DestroyModelBuffers(gLoadedLevel.vkObjects);
 
 		vkDestroyDescriptorPool(device, descPool, nullptr);
 	}
@@ -1372,15 +2674,44 @@ private:
 
 	void CleanUp()
 	{
+		if (gCleanedUp)
+			return;
+		gCleanedUp = true;
+		if (Trace::IsEnabled())
+		{
+			Trace::Stop();
+			Trace::Write(TRACE_PATH);
+		}
+		if (gRecordingCamera)
+			StopCameraRecording();
+		gShaderWatcher.Stop();
+		if (gReloadReady)
+			DestroyShaderSet(gReloadedShaders);
+
 		CleanUpLevel();
 
+		gTextureStreamer.Stop();
+		ReleaseTextures();
+		gTextureCache.Destroy();
+		vkDestroySampler(device, gTextureSampler, nullptr);
+
 		vkDestroyShaderModule(device, vertexShader, nullptr);
 		vkDestroyShaderModule(device, pixelShader, nullptr);
+		vkDestroyShaderModule(device, depthVertexShader, nullptr);
+		vkDestroyShaderModule(device, hizBuildShader, nullptr);
+
+		gHiZ.Destroy();
+		gSoftwareOcclusion.Stop();
+		gProfiler.Destroy();
+		gFrameRing.Destroy();
+
+		gPipelineCache.Save();
+		gPipelineCache.Destroy();
 		
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout_Vertex, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout_Pixel, nullptr);
 
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-		vkDestroyPipeline(device, pipeline, nullptr);
+		DestroyGraphicsPipelines(gPipelines);
 	}
 };